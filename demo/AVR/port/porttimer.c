@@ -39,6 +39,7 @@
 /* ----------------------- Static variables ---------------------------------*/
 static USHORT   usTimerOCRADelta;
 static USHORT   usTimerOCRBDelta;
+static USHORT   usTimerTimeout50us;
 
 /* ----------------------- Start implementation -----------------------------*/
 BOOL
@@ -47,6 +48,7 @@ xMBPortTimersInit( USHORT usTim1Timerout50us )
     /* Calculate overflow counter an OCR values for Timer1. */
     usTimerOCRADelta =
         ( MB_TIMER_TICKS * usTim1Timerout50us ) / ( MB_50US_TICKS );
+    usTimerTimeout50us = usTim1Timerout50us;
 
     TCCR1A = 0x00;
     TCCR1B = 0x00;
@@ -82,6 +84,15 @@ vMBPortTimersDisable(  )
     TIFR1 |= _BV( OCF1A ) ;
 }
 
+USHORT
+usMBPortTimersGetElapsed( void )
+{
+    /* Timer1 is reset to zero when it is enabled. */
+    ULONG           ulElapsed50us = ( ( ULONG )TCNT1 * MB_50US_TICKS ) / MB_TIMER_TICKS;
+
+    return ulElapsed50us > usTimerTimeout50us ? usTimerTimeout50us : ( USHORT )ulElapsed50us;
+}
+
 SIGNAL( SIG_OUTPUT_COMPARE1A )
 {
     ( void )pxMBPortCBTimerExpired(  );
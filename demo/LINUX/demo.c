@@ -31,10 +31,14 @@
 
 /* ----------------------- Modbus includes ----------------------------------*/
 #include "mb.h"
+#include "mbconfig.h"
 #include "mbport.h"
+#include "mbregstore.h"
+#include "portshm.h"
 
 /* ----------------------- Defines ------------------------------------------*/
 #define PROG            "freemodbus"
+#define PERSIST_SYNC_MS 1000
 
 #define REG_INPUT_START 1000
 #define REG_INPUT_NREGS 4
@@ -42,10 +46,14 @@
 #define REG_HOLDING_NREGS 130
 
 /* ----------------------- Static variables ---------------------------------*/
-static USHORT   usRegInputStart = REG_INPUT_START;
 static USHORT   usRegInputBuf[REG_INPUT_NREGS];
+#if MB_REGSTORE_ENABLED == 0
+static USHORT   usRegInputStart = REG_INPUT_START;
 static USHORT   usRegHoldingStart = REG_HOLDING_START;
 static USHORT   usRegHoldingBuf[REG_HOLDING_NREGS];
+static BOOL     xShmEnabled;
+static BOOL     xPersistEnabled;
+#endif
 
 static enum ThreadState
 {
@@ -62,6 +70,9 @@ static BOOL     bCreatePollingThread( void );
 static enum ThreadState eGetPollingThreadState( void );
 static void     vSetPollingThreadState( enum ThreadState eNewState );
 static void    *pvPollingThread( void *pvParameter );
+#if MB_REGSTORE_ENABLED == 0
+static eMBErrorCode eShmError( eMBPortShmStatus eShmStatus );
+#endif
 
 /* ----------------------- Start implementation -----------------------------*/
 BOOL
@@ -101,9 +112,46 @@ int
 main( int argc, char *argv[] )
 {
     int             iExitCode;
+    int             iOpt;
     CHAR            cCh;
+#if MB_REGSTORE_ENABLED == 0
+    const CHAR     *szShmName = NULL;
+    const CHAR     *szPersistFile = NULL;
+#endif
 
     const UCHAR     ucSlaveID[] = { 0xAA, 0xBB, 0xCC };
+
+    /* The register store replaces the shared memory and the register file. */
+#if MB_REGSTORE_ENABLED > 0
+    while( ( iOpt = getopt( argc, argv, "" ) ) != -1 )
+    {
+        fprintf( stderr, "usage: %s\n", PROG );
+        return EXIT_FAILURE;
+    }
+#else
+    while( ( iOpt = getopt( argc, argv, "s:p:" ) ) != -1 )
+    {
+        switch ( iOpt )
+        {
+        case 's':
+            szShmName = optarg;
+            break;
+        case 'p':
+            szPersistFile = optarg;
+            break;
+        default:
+            fprintf( stderr, "usage: %s [-s shm-name | -p register-file]\n", PROG );
+            return EXIT_FAILURE;
+        }
+    }
+    /* Both would own the holding registers. */
+    if( ( szShmName != NULL ) && ( szPersistFile != NULL ) )
+    {
+        fprintf( stderr, "usage: %s [-s shm-name | -p register-file]\n", PROG );
+        return EXIT_FAILURE;
+    }
+#endif
+
     if( !bSetSignal( SIGQUIT, vSigShutdown ) ||
         !bSetSignal( SIGINT, vSigShutdown ) || !bSetSignal( SIGTERM, vSigShutdown ) )
     {
@@ -120,6 +168,34 @@ main( int argc, char *argv[] )
         fprintf( stderr, "%s: can't set slave id!\n", PROG );
         iExitCode = EXIT_FAILURE;
     }
+#if MB_REGSTORE_ENABLED > 0
+    /* The store uses protocol addresses which start at 0. */
+    else if( ( eMBRegStoreAddBank( MB_REGSTORE_INPUT, REG_INPUT_START - 1,
+                                   REG_INPUT_NREGS ) != MB_ENOERR ) ||
+             ( eMBRegStoreAddBank( MB_REGSTORE_HOLDING, REG_HOLDING_START - 1,
+                                   REG_HOLDING_NREGS ) != MB_ENOERR ) )
+    {
+        fprintf( stderr, "%s: can't initialize register store!\n", PROG );
+        iExitCode = EXIT_FAILURE;
+    }
+#else
+    /* Optionally share the registers with other processes. */
+    else if( ( szShmName != NULL ) &&
+             !( xShmEnabled = xMBPortShmOpen( szShmName, REG_INPUT_START - 1, REG_INPUT_NREGS,
+                                              REG_HOLDING_START - 1, REG_HOLDING_NREGS ) ) )
+    {
+        fprintf( stderr, "%s: can't create shared memory %s!\n", PROG, szShmName );
+        iExitCode = EXIT_FAILURE;
+    }
+    /* Optionally keep the holding registers across restarts. */
+    else if( ( szPersistFile != NULL ) &&
+             !( xPersistEnabled = xMBPortPersistOpen( szPersistFile, REG_HOLDING_START - 1,
+                                                      REG_HOLDING_NREGS, PERSIST_SYNC_MS ) ) )
+    {
+        fprintf( stderr, "%s: can't open register file %s!\n", PROG, szPersistFile );
+        iExitCode = EXIT_FAILURE;
+    }
+#endif
     else
     {
         vSetPollingThreadState( STOPPED );
@@ -188,6 +264,10 @@ main( int argc, char *argv[] )
 
         /* Release hardware resources. */
         ( void )eMBClose(  );
+#if MB_REGSTORE_ENABLED == 0
+        vMBPortShmClose(  );
+        vMBPortPersistClose(  );
+#endif
         iExitCode = EXIT_SUCCESS;
     }
     return iExitCode;
@@ -235,6 +315,21 @@ pvPollingThread( void *pvParameter )
             localtime_r(&now, &time_s);
             usRegInputBuf[0] = ( USHORT ) ( time_s.tm_min * 100);
             usRegInputBuf[0] += ( USHORT ) ( time_s.tm_sec );
+#if MB_REGSTORE_ENABLED > 0
+            /* Publish the whole block. A concurrent request never sees a
+             * partial update. */
+            ( void )eMBRegStoreWrite( MB_REGSTORE_INPUT, REG_INPUT_START - 1,
+                                      REG_INPUT_NREGS, usRegInputBuf );
+#else
+            if( xShmEnabled )
+            {
+                UCHAR           ucReg[2];
+
+                ucReg[0] = ( UCHAR ) ( usRegInputBuf[0] >> 8 );
+                ucReg[1] = ( UCHAR ) ( usRegInputBuf[0] & 0xFF );
+                ( void )eMBPortShmRegs( MB_SHM_INPUT, ucReg, REG_INPUT_START - 1, 1, TRUE );
+            }
+#endif
         }
         while( eGetPollingThreadState(  ) != SHUTDOWN );
     }
@@ -266,13 +361,34 @@ vSetPollingThreadState( enum ThreadState eNewState )
     ( void )pthread_mutex_unlock( &xLock );
 }
 
+#if MB_REGSTORE_ENABLED == 0
+/* A block held by another process is reported as SLAVE DEVICE BUSY. */
+static eMBErrorCode
+eShmError( eMBPortShmStatus eShmStatus )
+{
+    switch ( eShmStatus )
+    {
+    case MB_SHM_ENOERR:
+        return MB_ENOERR;
+    case MB_SHM_EBUSY:
+        return MB_ETIMEDOUT;
+    default:
+        return MB_ENOREG;
+    }
+}
+
 eMBErrorCode
 eMBRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs )
 {
     eMBErrorCode    eStatus = MB_ENOERR;
     int             iRegIndex;
 
-    if( ( usAddress >= REG_INPUT_START )
+    if( xShmEnabled )
+    {
+        eStatus = eShmError( eMBPortShmRegs( MB_SHM_INPUT, pucRegBuffer, usAddress - 1, usNRegs,
+                                             FALSE ) );
+    }
+    else if( ( usAddress >= REG_INPUT_START )
         && ( usAddress + usNRegs <= REG_INPUT_START + REG_INPUT_NREGS ) )
     {
         iRegIndex = ( int )( usAddress - usRegInputStart );
@@ -298,7 +414,19 @@ eMBRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs, eMBRegi
     eMBErrorCode    eStatus = MB_ENOERR;
     int             iRegIndex;
 
-    if( ( usAddress >= REG_HOLDING_START ) &&
+    if( xPersistEnabled )
+    {
+        if( !xMBPortPersistRegs( pucRegBuffer, usAddress - 1, usNRegs, eMode == MB_REG_WRITE ) )
+        {
+            eStatus = MB_ENOREG;
+        }
+    }
+    else if( xShmEnabled )
+    {
+        eStatus = eShmError( eMBPortShmRegs( MB_SHM_HOLDING, pucRegBuffer, usAddress - 1,
+                                             usNRegs, eMode == MB_REG_WRITE ) );
+    }
+    else if( ( usAddress >= REG_HOLDING_START ) &&
         ( usAddress + usNRegs <= REG_HOLDING_START + REG_HOLDING_NREGS ) )
     {
         iRegIndex = ( int )( usAddress - usRegHoldingStart );
@@ -346,3 +474,4 @@ eMBRegDiscreteCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNDiscrete )
 {
     return MB_ENOREG;
 }
+#endif
@@ -50,6 +50,13 @@ PR_BEGIN_EXTERN_C
     MB_LOG_DEBUG = 3
 } eMBPortLogLevel;
 
+typedef enum
+{
+    MB_SHM_ENOERR,              /* Registers have been copied. */
+    MB_SHM_ENOREG,              /* Range is not mapped. */
+    MB_SHM_EBUSY                /* Another process holds a block for too long. */
+} eMBPortShmStatus;
+
 typedef char    BOOL;
 typedef unsigned char UCHAR;
 typedef char    CHAR;
@@ -69,6 +76,21 @@ void            vMBPortTimerPoll(  );
 BOOL            xMBPortSerialPoll(  );
 BOOL            xMBPortSerialSetTimeout( ULONG dwTimeoutMs );
 
+/* Shared memory register map. The layout is described in portshm.h. */
+BOOL            xMBPortShmOpen( const CHAR * szName, USHORT usInputFirst, USHORT usInputCount,
+                                USHORT usHoldingFirst, USHORT usHoldingCount );
+void            vMBPortShmClose( void );
+eMBPortShmStatus eMBPortShmRegs( UCHAR ucTable, UCHAR * pucRegBuffer, USHORT usAddress,
+                                 USHORT usNRegs, BOOL xWrite );
+
+/* Holding registers kept in a memory mapped file. If ulSyncMs is zero every
+ * write is synced before the response, otherwise at most every ulSyncMs. */
+BOOL            xMBPortPersistOpen( const CHAR * szFile, USHORT usFirst, USHORT usCount,
+                                    ULONG ulSyncMs );
+void            vMBPortPersistClose( void );
+BOOL            xMBPortPersistRegs( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs,
+                                    BOOL xWrite );
+
 #ifdef __cplusplus
 PR_END_EXTERN_C
 #endif
@@ -0,0 +1,248 @@
+/*
+ * FreeModbus Libary: Linux Port
+ * Copyright (C) 2006 Christian Walter <wolti@sil.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- Standard includes --------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb.h"
+#include "mbport.h"
+#include "mbcrc.h"
+
+/* ----------------------- Defines ------------------------------------------*/
+
+/* The file starts with a header of PERSIST_HEADER_SIZE bytes followed by
+ * the registers in Modbus byte order. All header fields are big endian:
+ *
+ *   0  magic "MBPR"     4  version      6  first protocol address
+ *   8  register count  10  reserved    14  CRC16 of bytes 0 - 13
+ *
+ * The file is reused at startup if the header is valid and describes the
+ * same registers. Otherwise it is recreated with all registers zero.
+ */
+#define PERSIST_MAGIC           "MBPR"
+#define PERSIST_VERSION         1
+#define PERSIST_HEADER_SIZE     16
+#define PERSIST_CRC_OFF         14
+
+/* ----------------------- Static variables ---------------------------------*/
+static UCHAR   *pucPersistMap;
+static size_t   xPersistSize;
+static USHORT   usPersistFirst;
+static USHORT   usPersistCount;
+static ULONG    ulPersistSyncMs;
+static pthread_t xPersistThread;
+static volatile BOOL xPersistRunning;
+static volatile BOOL xPersistDirty;
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvPersistHeader( UCHAR * pucHeader, USHORT usFirst, USHORT usCount );
+static void    *pvMBPortPersistThread( void *pvArg );
+
+/* ----------------------- Start implementation -----------------------------*/
+BOOL
+xMBPortPersistOpen( const CHAR * szFile, USHORT usFirst, USHORT usCount, ULONG ulSyncMs )
+{
+    UCHAR           ucHeader[PERSIST_HEADER_SIZE];
+    struct stat     xStat;
+    size_t          xSize = PERSIST_HEADER_SIZE + 2U * usCount;
+    BOOL            xValid;
+    int             iFd;
+
+    if( ( pucPersistMap != NULL ) || ( usCount == 0 ) ||
+        ( ( ULONG )usFirst + usCount > 0x10000UL ) )
+    {
+        return FALSE;
+    }
+    if( ( iFd = open( szFile, O_RDWR | O_CREAT, 0660 ) ) == -1 )
+    {
+        vMBPortLog( MB_LOG_ERROR, "PERSIST", "Can't open %s: %s\n", szFile, strerror( errno ) );
+        return FALSE;
+    }
+
+    /* Keep the old values if the file matches. The header is compared as
+     * a whole including its CRC. */
+    prvvPersistHeader( ucHeader, usFirst, usCount );
+    xValid = ( fstat( iFd, &xStat ) == 0 ) && ( xStat.st_size == ( off_t ) xSize );
+    if( xValid )
+    {
+        UCHAR           ucOld[PERSIST_HEADER_SIZE];
+
+        xValid = ( pread( iFd, ucOld, sizeof( ucOld ), 0 ) == sizeof( ucOld ) ) &&
+            ( memcmp( ucOld, ucHeader, sizeof( ucOld ) ) == 0 );
+    }
+    if( !xValid )
+    {
+        vMBPortLog( MB_LOG_INFO, "PERSIST", "Initializing %s.\n", szFile );
+        if( ( ftruncate( iFd, 0 ) == -1 ) || ( ftruncate( iFd, ( off_t ) xSize ) == -1 ) ||
+            ( pwrite( iFd, ucHeader, sizeof( ucHeader ), 0 ) != sizeof( ucHeader ) ) ||
+            ( fdatasync( iFd ) == -1 ) )
+        {
+            vMBPortLog( MB_LOG_ERROR, "PERSIST", "Can't initialize %s: %s\n", szFile,
+                        strerror( errno ) );
+            ( void )close( iFd );
+            return FALSE;
+        }
+    }
+    pucPersistMap = mmap( NULL, xSize, PROT_READ | PROT_WRITE, MAP_SHARED, iFd, 0 );
+    ( void )close( iFd );
+    if( pucPersistMap == MAP_FAILED )
+    {
+        vMBPortLog( MB_LOG_ERROR, "PERSIST", "Can't map %s: %s\n", szFile, strerror( errno ) );
+        pucPersistMap = NULL;
+        return FALSE;
+    }
+
+    xPersistSize = xSize;
+    usPersistFirst = usFirst;
+    usPersistCount = usCount;
+    ulPersistSyncMs = ulSyncMs;
+    xPersistDirty = FALSE;
+    if( ulSyncMs > 0 )
+    {
+        xPersistRunning = TRUE;
+        if( pthread_create( &xPersistThread, NULL, pvMBPortPersistThread, NULL ) != 0 )
+        {
+            vMBPortLog( MB_LOG_ERROR, "PERSIST", "Can't create sync thread.\n" );
+            ( void )munmap( pucPersistMap, xSize );
+            pucPersistMap = NULL;
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void
+vMBPortPersistClose( void )
+{
+    if( pucPersistMap != NULL )
+    {
+        if( ulPersistSyncMs > 0 )
+        {
+            xPersistRunning = FALSE;
+            ( void )pthread_join( xPersistThread, NULL );
+        }
+        ( void )msync( pucPersistMap, xPersistSize, MS_SYNC );
+        ( void )munmap( pucPersistMap, xPersistSize );
+        pucPersistMap = NULL;
+    }
+}
+
+BOOL
+xMBPortPersistRegs( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs, BOOL xWrite )
+{
+    UCHAR          *pucRegs;
+    UCHAR          *pucPage;
+    long            lPageSize;
+
+    if( ( pucPersistMap == NULL ) || ( usAddress < usPersistFirst ) ||
+        ( ( ULONG )usAddress + usNRegs > ( ULONG )usPersistFirst + usPersistCount ) )
+    {
+        return FALSE;
+    }
+    pucRegs = pucPersistMap + PERSIST_HEADER_SIZE + 2U * ( usAddress - usPersistFirst );
+    if( !xWrite )
+    {
+        memcpy( pucRegBuffer, pucRegs, 2U * usNRegs );
+    }
+    else
+    {
+        memcpy( pucRegs, pucRegBuffer, 2U * usNRegs );
+        if( ulPersistSyncMs > 0 )
+        {
+            xPersistDirty = TRUE;
+        }
+        else
+        {
+            /* Write back the pages touched by the request before the
+             * response is sent. */
+            lPageSize = sysconf( _SC_PAGESIZE );
+            pucPage = pucPersistMap + ( ( pucRegs - pucPersistMap ) / lPageSize ) * lPageSize;
+            if( msync( pucPage, ( size_t )( pucRegs + 2U * usNRegs - pucPage ), MS_SYNC ) == -1 )
+            {
+                vMBPortLog( MB_LOG_ERROR, "PERSIST", "Can't sync registers: %s\n",
+                            strerror( errno ) );
+            }
+        }
+    }
+    return TRUE;
+}
+
+static void
+prvvPersistHeader( UCHAR * pucHeader, USHORT usFirst, USHORT usCount )
+{
+    USHORT          usCRC;
+
+    memset( pucHeader, 0, PERSIST_HEADER_SIZE );
+    memcpy( pucHeader, PERSIST_MAGIC, 4 );
+    pucHeader[4] = ( UCHAR )( PERSIST_VERSION >> 8 );
+    pucHeader[5] = ( UCHAR )( PERSIST_VERSION & 0xFF );
+    pucHeader[6] = ( UCHAR )( usFirst >> 8 );
+    pucHeader[7] = ( UCHAR )( usFirst & 0xFF );
+    pucHeader[8] = ( UCHAR )( usCount >> 8 );
+    pucHeader[9] = ( UCHAR )( usCount & 0xFF );
+    usCRC = usMBCRC16( pucHeader, PERSIST_CRC_OFF );
+    pucHeader[PERSIST_CRC_OFF] = ( UCHAR )( usCRC >> 8 );
+    pucHeader[PERSIST_CRC_OFF + 1] = ( UCHAR )( usCRC & 0xFF );
+}
+
+/* Write back modified registers every ulPersistSyncMs milliseconds. The
+ * poll thread only marks the map as dirty and never waits for the disk.
+ */
+static void    *
+pvMBPortPersistThread( void *pvArg )
+{
+    struct timespec xDelay;
+    BOOL            xRunning;
+
+    ( void )pvArg;
+    xDelay.tv_sec = ulPersistSyncMs / 1000;
+    xDelay.tv_nsec = ( long )( ulPersistSyncMs % 1000 ) * 1000000L;
+    do
+    {
+        xRunning = xPersistRunning;
+        if( xRunning )
+        {
+            ( void )nanosleep( &xDelay, NULL );
+        }
+        if( xPersistDirty )
+        {
+            xPersistDirty = FALSE;
+            if( msync( pucPersistMap, xPersistSize, MS_SYNC ) == -1 )
+            {
+                vMBPortLog( MB_LOG_ERROR, "PERSIST", "Can't sync registers: %s\n",
+                            strerror( errno ) );
+            }
+        }
+    }
+    while( xRunning );
+    return NULL;
+}
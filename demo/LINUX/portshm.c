@@ -0,0 +1,298 @@
+/*
+ * FreeModbus Libary: Linux Port
+ * Copyright (C) 2006 Christian Walter <wolti@sil.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- Standard includes --------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "port.h"
+#include "portshm.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb.h"
+#include "mbport.h"
+#include "mbutils.h"
+
+/* ----------------------- Defines ------------------------------------------*/
+#define SHM_ALIGN               64
+#define SHM_REQ_REGS_MAX        128
+#define SHM_REQ_BLOCKS_MAX      ( ( SHM_REQ_REGS_MAX + MB_SHM_BLOCK_REGS - 1 ) / MB_SHM_BLOCK_REGS + 1 )
+
+/* Attempts to lock or read a block which is modified by another process.
+ * The processor is yielded between attempts. */
+#define SHM_ATTEMPTS_MAX        1000
+
+/* ----------------------- Static variables ---------------------------------*/
+static xMBShmHeader *pxShmHeader;
+static size_t   xShmSize;
+static char     szShmName[64];
+
+/* ----------------------- Static functions ---------------------------------*/
+static xMBShmBlock *prvpxShmBlock( const xMBShmTable * pxTable, USHORT usIndex );
+static BOOL     prvxShmWriteLock( xMBShmBlock * pxBlock, uint32_t * pulSeq );
+static void     prvvShmWriteUnlock( xMBShmBlock * pxBlock, uint32_t ulSeq );
+
+/* ----------------------- Start implementation -----------------------------*/
+BOOL
+xMBPortShmOpen( const CHAR * szName, USHORT usInputFirst, USHORT usInputCount,
+                USHORT usHoldingFirst, USHORT usHoldingCount )
+{
+    xMBShmHeader   *pxHeader;
+    ULONG           ulInputBlocks;
+    ULONG           ulHoldingBlocks;
+    size_t          xSize;
+    int             iFd;
+
+    if( ( pxShmHeader != NULL ) || ( strlen( szName ) >= sizeof( szShmName ) ) ||
+        ( ( ULONG )usInputFirst + usInputCount > 0x10000UL ) ||
+        ( ( ULONG )usHoldingFirst + usHoldingCount > 0x10000UL ) )
+    {
+        return FALSE;
+    }
+    ulInputBlocks = ( usInputCount + MB_SHM_BLOCK_REGS - 1 ) / MB_SHM_BLOCK_REGS;
+    ulHoldingBlocks = ( usHoldingCount + MB_SHM_BLOCK_REGS - 1 ) / MB_SHM_BLOCK_REGS;
+    xSize = ( ( sizeof( xMBShmHeader ) + SHM_ALIGN - 1 ) / SHM_ALIGN ) * SHM_ALIGN;
+    xSize += ( ulInputBlocks + ulHoldingBlocks ) * sizeof( xMBShmBlock );
+
+    /* Start with a zeroed segment. Processes which still have the old one
+     * mapped keep their stale copy. */
+    ( void )shm_unlink( szName );
+    if( ( iFd = shm_open( szName, O_RDWR | O_CREAT | O_EXCL, 0660 ) ) == -1 )
+    {
+        vMBPortLog( MB_LOG_ERROR, "SHM", "Can't create shared memory %s: %s\n", szName,
+                    strerror( errno ) );
+        return FALSE;
+    }
+    if( ftruncate( iFd, ( off_t ) xSize ) == -1 )
+    {
+        vMBPortLog( MB_LOG_ERROR, "SHM", "Can't resize shared memory: %s\n", strerror( errno ) );
+        ( void )close( iFd );
+        ( void )shm_unlink( szName );
+        return FALSE;
+    }
+    pxHeader = mmap( NULL, xSize, PROT_READ | PROT_WRITE, MAP_SHARED, iFd, 0 );
+    ( void )close( iFd );
+    if( pxHeader == MAP_FAILED )
+    {
+        vMBPortLog( MB_LOG_ERROR, "SHM", "Can't map shared memory: %s\n", strerror( errno ) );
+        ( void )shm_unlink( szName );
+        return FALSE;
+    }
+
+    pxHeader->usVersion = MB_SHM_VERSION;
+    pxHeader->usBlockRegs = MB_SHM_BLOCK_REGS;
+    pxHeader->ulSize = ( uint32_t )xSize;
+    pxHeader->lOwnerPid = ( int32_t )getpid(  );
+    pxHeader->xTables[MB_SHM_INPUT].usFirst = usInputFirst;
+    pxHeader->xTables[MB_SHM_INPUT].usCount = usInputCount;
+    pxHeader->xTables[MB_SHM_INPUT].ulOffset =
+        ( uint32_t )( ( ( sizeof( xMBShmHeader ) + SHM_ALIGN - 1 ) / SHM_ALIGN ) * SHM_ALIGN );
+    pxHeader->xTables[MB_SHM_HOLDING].usFirst = usHoldingFirst;
+    pxHeader->xTables[MB_SHM_HOLDING].usCount = usHoldingCount;
+    pxHeader->xTables[MB_SHM_HOLDING].ulOffset =
+        ( uint32_t )( pxHeader->xTables[MB_SHM_INPUT].ulOffset + ulInputBlocks * sizeof( xMBShmBlock ) );
+    __atomic_store_n( &pxHeader->ulMagic, MB_SHM_MAGIC, __ATOMIC_RELEASE );
+
+    ( void )strcpy( szShmName, szName );
+    xShmSize = xSize;
+    pxShmHeader = pxHeader;
+    return TRUE;
+}
+
+void
+vMBPortShmClose( void )
+{
+    if( pxShmHeader != NULL )
+    {
+        ( void )munmap( pxShmHeader, xShmSize );
+        ( void )shm_unlink( szShmName );
+        pxShmHeader = NULL;
+    }
+}
+
+eMBPortShmStatus
+eMBPortShmRegs( UCHAR ucTable, UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs,
+                BOOL xWrite )
+{
+    const xMBShmTable *pxTable;
+    xMBShmBlock    *pxBlocks[SHM_REQ_BLOCKS_MAX];
+    uint32_t        ulSeqs[SHM_REQ_BLOCKS_MAX];
+    USHORT          usIndex;
+    USHORT          usReg;
+    USHORT          usRun;
+    USHORT          usLeft;
+    UCHAR          *pucBuf;
+    uint16_t       *pusRegs;
+    UCHAR           ucBlocks;
+    UCHAR           i;
+    BOOL            xRetry;
+    int             iAttempts = 0;
+
+    if( ( pxShmHeader == NULL ) || ( ucTable >= MB_SHM_TABLES ) || ( usNRegs == 0 ) ||
+        ( usNRegs > SHM_REQ_REGS_MAX ) )
+    {
+        return MB_SHM_ENOREG;
+    }
+    pxTable = &pxShmHeader->xTables[ucTable];
+    if( ( usAddress < pxTable->usFirst ) ||
+        ( ( ULONG )usAddress + usNRegs > ( ULONG )pxTable->usFirst + pxTable->usCount ) )
+    {
+        return MB_SHM_ENOREG;
+    }
+    usIndex = ( USHORT )( usAddress - pxTable->usFirst );
+    ucBlocks = ( UCHAR )( ( usIndex + usNRegs - 1 ) / MB_SHM_BLOCK_REGS - usIndex / MB_SHM_BLOCK_REGS + 1 );
+    for( i = 0; i < ucBlocks; i++ )
+    {
+        pxBlocks[i] = prvpxShmBlock( pxTable, ( USHORT )( usIndex / MB_SHM_BLOCK_REGS + i ) );
+    }
+
+    if( xWrite )
+    {
+        /* Blocks are locked in ascending order like every other writer. */
+        for( i = 0; i < ucBlocks; i++ )
+        {
+            if( !prvxShmWriteLock( pxBlocks[i], &ulSeqs[i] ) )
+            {
+                /* Nothing has been written. Restore the counters. */
+                while( i-- > 0 )
+                {
+                    __atomic_store_n( &pxBlocks[i]->ulSeq, ulSeqs[i], __ATOMIC_RELEASE );
+                }
+                return MB_SHM_EBUSY;
+            }
+        }
+    }
+    do
+    {
+        if( !xWrite )
+        {
+            for( i = 0; i < ucBlocks; i++ )
+            {
+                while( ( ulSeqs[i] = __atomic_load_n( &pxBlocks[i]->ulSeq, __ATOMIC_ACQUIRE ) ) & 1 )
+                {
+                    if( ++iAttempts >= SHM_ATTEMPTS_MAX )
+                    {
+                        return MB_SHM_EBUSY;
+                    }
+                    ( void )sched_yield(  );
+                }
+            }
+        }
+        pucBuf = pucRegBuffer;
+        usReg = usIndex;
+        for( i = 0, usLeft = usNRegs; usLeft > 0; i++ )
+        {
+            usRun = ( USHORT )( MB_SHM_BLOCK_REGS - usReg % MB_SHM_BLOCK_REGS );
+            if( usRun > usLeft )
+            {
+                usRun = usLeft;
+            }
+            pusRegs = &pxBlocks[i]->usRegs[usReg % MB_SHM_BLOCK_REGS];
+            if( xWrite )
+            {
+                vMBUtilRegsToHost( pusRegs, pucBuf, usRun );
+            }
+            else
+            {
+                vMBUtilRegsFromHost( pucBuf, pusRegs, usRun );
+            }
+            pucBuf += 2U * usRun;
+            usReg += usRun;
+            usLeft -= usRun;
+        }
+        xRetry = FALSE;
+        if( !xWrite )
+        {
+            __atomic_thread_fence( __ATOMIC_ACQUIRE );
+            for( i = 0; i < ucBlocks; i++ )
+            {
+                if( __atomic_load_n( &pxBlocks[i]->ulSeq, __ATOMIC_RELAXED ) != ulSeqs[i] )
+                {
+                    xRetry = TRUE;
+                }
+            }
+            if( xRetry && ( ++iAttempts >= SHM_ATTEMPTS_MAX ) )
+            {
+                return MB_SHM_EBUSY;
+            }
+        }
+    }
+    while( xRetry );
+    if( xWrite )
+    {
+        for( i = 0; i < ucBlocks; i++ )
+        {
+            prvvShmWriteUnlock( pxBlocks[i], ulSeqs[i] );
+        }
+        if( ucTable == MB_SHM_HOLDING )
+        {
+            ( void )__atomic_add_fetch( &pxShmHeader->ulWrites, 1, __ATOMIC_RELEASE );
+            ( void )syscall( SYS_futex, &pxShmHeader->ulWrites, FUTEX_WAKE, INT_MAX, NULL, NULL, 0 );
+        }
+    }
+    return MB_SHM_ENOERR;
+}
+
+static xMBShmBlock *
+prvpxShmBlock( const xMBShmTable * pxTable, USHORT usIndex )
+{
+    return ( xMBShmBlock * ) ( ( UCHAR * ) pxShmHeader + pxTable->ulOffset ) + usIndex;
+}
+
+/* Acquire a block by making its sequence counter odd. Only other writers
+ * have to wait here. Stores the even value before the lock in pulSeq.
+ * Returns FALSE if another writer holds the block for too long. */
+static BOOL
+prvxShmWriteLock( xMBShmBlock * pxBlock, uint32_t * pulSeq )
+{
+    uint32_t        ulSeq;
+    int             iAttempts;
+
+    for( iAttempts = 0; iAttempts < SHM_ATTEMPTS_MAX; iAttempts++ )
+    {
+        ulSeq = __atomic_load_n( &pxBlock->ulSeq, __ATOMIC_RELAXED );
+        if( ( ( ulSeq & 1 ) == 0 ) &&
+            __atomic_compare_exchange_n( &pxBlock->ulSeq, &ulSeq, ulSeq + 1, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_RELAXED ) )
+        {
+            __atomic_thread_fence( __ATOMIC_RELEASE );
+            *pulSeq = ulSeq;
+            return TRUE;
+        }
+        ( void )sched_yield(  );
+    }
+    return FALSE;
+}
+
+static void
+prvvShmWriteUnlock( xMBShmBlock * pxBlock, uint32_t ulSeq )
+{
+    __atomic_store_n( &pxBlock->ulSeq, ulSeq + 2, __ATOMIC_RELEASE );
+}
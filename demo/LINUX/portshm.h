@@ -0,0 +1,112 @@
+/*
+ * FreeModbus Libary: Linux Port
+ * Copyright (C) 2006 Christian Walter <wolti@sil.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * File: $Id$
+ */
+
+#ifndef _PORT_SHM_H
+#define _PORT_SHM_H
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory register map created by xMBPortShmOpen( ).
+ * This header only depends on <stdint.h> and can be included by other
+ * processes which access the map.
+ *
+ * The segment starts with an xMBShmHeader followed by the blocks of the
+ * input registers and then the blocks of the holding registers. A table
+ * holds usCount registers starting at the protocol address usFirst (the
+ * first register is 0). Register usFirst + i is the element
+ * i % MB_SHM_BLOCK_REGS of the block i / MB_SHM_BLOCK_REGS, and the first
+ * block of a table is at the byte offset ulOffset from the start of the
+ * segment. Registers are stored in host byte order.
+ *
+ * Every block is protected by its own sequence counter ulSeq, which is odd
+ * while a writer modifies the block.
+ *
+ * Reader:
+ *   1. Load ulSeq (acquire). Repeat while it is odd.
+ *   2. Copy the registers.
+ *   3. Issue an acquire fence and load ulSeq again. If it changed, start
+ *      over.
+ *
+ * Writer:
+ *   1. Compare and exchange ulSeq from an even value s to s + 1 (acquire),
+ *      followed by a release fence.
+ *   2. Store the registers.
+ *   3. Store s + 2 to ulSeq (release).
+ *
+ * A writer which modifies more than one block must lock them in ascending
+ * order and release them after all stores. The slave reads and writes all
+ * blocks of a request this way, so a Modbus request always sees and
+ * leaves a consistent state. Readers never block writers but retry as
+ * long as a block is modified, so writers should not update the same block
+ * in a tight loop and must not hold a block for long. The slave gives up
+ * after a short while and answers the request with a SLAVE DEVICE
+ * BUSY exception.
+ *
+ * After a Modbus request wrote holding registers the slave increments
+ * ulWrites and wakes every process which waits on it with
+ *
+ *   syscall( SYS_futex, &pxHeader->ulWrites, FUTEX_WAIT, ulSeen, pxTimeout,
+ *            NULL, 0 )
+ *
+ * where ulSeen is the value of ulWrites the process has handled last. The
+ * call returns at once if ulWrites has changed since. The futex is shared
+ * between processes, so FUTEX_PRIVATE_FLAG must not be used. lOwnerPid is
+ * the process of the slave. The header is valid once ulMagic is
+ * MB_SHM_MAGIC.
+ */
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_SHM_MAGIC            0x4D42534DUL    /* "MBSM" */
+#define MB_SHM_VERSION          2
+#define MB_SHM_BLOCK_REGS       64
+
+#define MB_SHM_INPUT            0               /* Index of the input registers. */
+#define MB_SHM_HOLDING          1               /* Index of the holding registers. */
+#define MB_SHM_TABLES           2
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef struct
+{
+    uint16_t        usFirst;
+    uint16_t        usCount;
+    uint32_t        ulOffset;
+} xMBShmTable;
+
+typedef struct
+{
+    uint32_t        ulMagic;
+    uint16_t        usVersion;
+    uint16_t        usBlockRegs;
+    uint32_t        ulSize;
+    int32_t         lOwnerPid;
+    uint32_t        ulWrites;
+    xMBShmTable     xTables[MB_SHM_TABLES];
+} xMBShmHeader;
+
+typedef struct
+{
+    uint32_t        ulSeq;
+    uint32_t        ulReserved;
+    uint16_t        usRegs[MB_SHM_BLOCK_REGS];
+} xMBShmBlock;
+
+#endif
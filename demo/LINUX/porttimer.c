@@ -22,6 +22,7 @@
 /* ----------------------- Standard includes --------------------------------*/
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "port.h"
 
@@ -36,11 +37,13 @@ ULONG           ulTimeOut;
 BOOL            bTimeoutEnable;
 
 static struct timeval xTimeLast;
+static USHORT   usTimerTimeout50us;
 
 /* ----------------------- Start implementation -----------------------------*/
 BOOL
 xMBPortTimersInit( USHORT usTim1Timerout50us )
 {
+    usTimerTimeout50us = usTim1Timerout50us;
     ulTimeOut = usTim1Timerout50us / 20U;
     if( ulTimeOut == 0 )
         ulTimeOut = 1;
@@ -95,3 +98,28 @@ vMBPortTimersDisable(  )
 {
     bTimeoutEnable = FALSE;
 }
+
+USHORT
+usMBPortTimersGetElapsed( void )
+{
+    struct timeval  xTimeCur;
+    ULONG           ulElapsed50us;
+
+    if( gettimeofday( &xTimeCur, NULL ) != 0 )
+    {
+        return 0;
+    }
+    ulElapsed50us = ( xTimeCur.tv_sec - xTimeLast.tv_sec ) * 20000L +
+        ( xTimeCur.tv_usec - xTimeLast.tv_usec ) / 50L;
+    return ulElapsed50us > usTimerTimeout50us ? usTimerTimeout50us : ( USHORT )ulElapsed50us;
+}
+
+void
+vMBPortTimersGetTimestamp( ULONG * pulSec, ULONG * pulNSec )
+{
+    struct timespec xTimeCur;
+
+    ( void )clock_gettime( CLOCK_MONOTONIC, &xTimeCur );
+    *pulSec = ( ULONG )xTimeCur.tv_sec;
+    *pulNSec = ( ULONG )xTimeCur.tv_nsec;
+}
@@ -0,0 +1,153 @@
+/*
+ * FreeModbus Libary: Linux Port
+ * Copyright (C) 2006 Christian Walter <wolti@sil.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- Standard includes --------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbutils.h"
+
+/* ----------------------- Defines ------------------------------------------*/
+#define BENCH_REGS_MAX          125     /* Largest read of holding registers. */
+#define BENCH_WORK              ( 4000000UL )   /* Registers per measurement. */
+
+/* ----------------------- Static variables ---------------------------------*/
+static UCHAR    ucPDU[2 * BENCH_REGS_MAX];
+static USHORT   usRegs[BENCH_REGS_MAX];
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvBenchScalarToHost( USHORT * pusRegs, const UCHAR * pucBuf, USHORT usNRegs );
+static void     prvvBenchScalarFromHost( UCHAR * pucBuf, const USHORT * pusRegs, USHORT usNRegs );
+static double   prvdBenchNowNs( void );
+
+/* ----------------------- Start implementation -----------------------------*/
+
+/* Time the portable loop against vMBUtilRegsToHost( ) and
+ * vMBUtilRegsFromHost( ) for every request size from 1 to 125 registers.
+ * The times are in nanoseconds per call. An optional argument scales the
+ * number of calls per measurement.
+ */
+int
+main( int argc, char *argv[] )
+{
+    ULONG           ulScale = argc > 1 ? strtoul( argv[1], NULL, 0 ) : 1;
+    ULONG           ulCalls;
+    ULONG           i;
+    USHORT          usNRegs;
+    double          dStart;
+    double          dScalarTo, dUtilTo, dScalarFrom, dUtilFrom;
+    USHORT          usCheck[BENCH_REGS_MAX];
+
+    if( ulScale == 0 )
+    {
+        fprintf( stderr, "usage: %s [scale]\n", argv[0] );
+        return 1;
+    }
+    for( i = 0; i < sizeof( ucPDU ); i++ )
+    {
+        ucPDU[i] = ( UCHAR )( i * 7 + 1 );
+    }
+
+    printf( "regs  scalar-to  util-to  speedup  scalar-from  util-from  speedup\n" );
+    for( usNRegs = 1; usNRegs <= BENCH_REGS_MAX; usNRegs++ )
+    {
+        /* Both variants must produce the same registers. */
+        prvvBenchScalarToHost( usCheck, ucPDU, usNRegs );
+        vMBUtilRegsToHost( usRegs, ucPDU, usNRegs );
+        if( memcmp( usCheck, usRegs, usNRegs * sizeof( USHORT ) ) != 0 )
+        {
+            fprintf( stderr, "vMBUtilRegsToHost( ) is wrong for %hu registers\n", usNRegs );
+            return 1;
+        }
+
+        ulCalls = ulScale * ( BENCH_WORK / usNRegs );
+
+        dStart = prvdBenchNowNs(  );
+        for( i = 0; i < ulCalls; i++ )
+        {
+            prvvBenchScalarToHost( usRegs, ucPDU, usNRegs );
+        }
+        dScalarTo = ( prvdBenchNowNs(  ) - dStart ) / ulCalls;
+
+        dStart = prvdBenchNowNs(  );
+        for( i = 0; i < ulCalls; i++ )
+        {
+            vMBUtilRegsToHost( usRegs, ucPDU, usNRegs );
+        }
+        dUtilTo = ( prvdBenchNowNs(  ) - dStart ) / ulCalls;
+
+        dStart = prvdBenchNowNs(  );
+        for( i = 0; i < ulCalls; i++ )
+        {
+            prvvBenchScalarFromHost( ucPDU, usRegs, usNRegs );
+        }
+        dScalarFrom = ( prvdBenchNowNs(  ) - dStart ) / ulCalls;
+
+        dStart = prvdBenchNowNs(  );
+        for( i = 0; i < ulCalls; i++ )
+        {
+            vMBUtilRegsFromHost( ucPDU, usRegs, usNRegs );
+        }
+        dUtilFrom = ( prvdBenchNowNs(  ) - dStart ) / ulCalls;
+
+        printf( "%4hu  %9.1f  %7.1f  %6.2fx  %11.1f  %9.1f  %6.2fx\n", usNRegs,
+                dScalarTo, dUtilTo, dScalarTo / dUtilTo, dScalarFrom, dUtilFrom, dScalarFrom / dUtilFrom );
+    }
+    return 0;
+}
+
+/* The portable loops of mbutils.c. They are not inlined such that both
+ * variants pay for a function call. */
+static void __attribute__ ( ( noinline ) )
+prvvBenchScalarToHost( USHORT * pusRegs, const UCHAR * pucBuf, USHORT usNRegs )
+{
+    USHORT          i;
+
+    for( i = 0; i < usNRegs; i++ )
+    {
+        pusRegs[i] = MB_UTIL_GET_REG( &pucBuf[2 * i] );
+    }
+}
+
+static void __attribute__ ( ( noinline ) )
+prvvBenchScalarFromHost( UCHAR * pucBuf, const USHORT * pusRegs, USHORT usNRegs )
+{
+    USHORT          i;
+
+    for( i = 0; i < usNRegs; i++ )
+    {
+        MB_UTIL_SET_REG( &pucBuf[2 * i], pusRegs[i] );
+    }
+}
+
+static double
+prvdBenchNowNs( void )
+{
+    struct timespec xTimeCur;
+
+    ( void )clock_gettime( CLOCK_MONOTONIC, &xTimeCur );
+    return xTimeCur.tv_sec * 1e9 + xTimeCur.tv_nsec;
+}
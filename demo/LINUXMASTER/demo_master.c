@@ -3,38 +3,45 @@
 #include "mbmaster.h"
 #include "port.h"
 #include "mbport.h"
+#include "mbconfig.h"
 
-void vMBReadInputRegCallback ( const UCHAR *cpucBuffer, USHORT usRegCnt ) {
-    const UCHAR *pucBufferCur = NULL;
-    unsigned short val;
+void vMBReadInputRegCallback ( const USHORT *pusRegs, USHORT usRegCnt ) {
+    USHORT i;
 
     printf("Reading %d input registers:\n", usRegCnt);
-    for (pucBufferCur = cpucBuffer; (pucBufferCur - cpucBuffer) != usRegCnt * 2;) {
-        val = *pucBufferCur++ << 8;
-        val |= *pucBufferCur++ & 0xFF;
-        printf(" %hu\n", val);
+    for (i = 0; i < usRegCnt; i++) {
+        printf(" %hu\n", pusRegs[i]);
     }
 }
 
-void vMBReadHoldingRegCallback ( const UCHAR *cpucBuffer, USHORT usRegCnt ) {
-    const UCHAR *pucBufferCur = NULL;
-    unsigned short val;
+void vMBReadHoldingRegCallback ( const USHORT *pusRegs, USHORT usRegCnt ) {
+    USHORT i;
 
     printf("Reading %d holding registers:\n", usRegCnt);
-    for (pucBufferCur = cpucBuffer; (pucBufferCur - cpucBuffer) != usRegCnt * 2;) {
-        val = *pucBufferCur++ << 8;
-        val |= *pucBufferCur++ & 0xFF;
-        printf(" %hu\n", val);
+    for (i = 0; i < usRegCnt; i++) {
+        printf(" %hu\n", pusRegs[i]);
     }
 }
 
 int main(int argc, char *argv[]) {
      unsigned short v_array[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
     
+#if MB_TCP_ENABLED > 0
+    /* demo_master <host> polls the Modbus TCP server at <host>. */
+    if (argc > 1) {
+        if (eMBTCPInit(MB_TCP_PORT_USE_DEFAULT) != MB_ENOERR) return 2;
+        if (eMBTCPAddTarget(0x0A, argv[1], MB_TCP_PORT_USE_DEFAULT) != MB_ENOERR) return 2;
+    }
+    else
+#endif
     if (eMBInit(MB_ASCII, 1, 38400, MB_PAR_EVEN) != MB_ENOERR) return 2;
     if (eMBEnable() != MB_ENOERR) return 2;
+    /* An optional second argument names a pcapng file for the traffic. */
+    if (argc > 2 && !xMBPortCaptureStart(argv[2])) return 2;
     for (;;) {
         if (eMBReadInputReg(0x0A, 1000, 4) != MB_ENOERR) {
+            /* Give the port a chance to (re)connect. */
+            eMBPoll();
             continue;
         }
         eMBPoll();
@@ -54,6 +61,12 @@ int main(int argc, char *argv[]) {
             continue;
         }
         eMBPoll();
+#if MB_TCP_ENABLED > 0
+        /* Requests to a TCP server are pipelined. Collect the responses. */
+        while (usMBTCPGetPending() > 0) {
+            eMBPoll();
+        }
+#endif
     }
     return 0;
 }
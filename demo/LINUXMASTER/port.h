@@ -68,6 +68,11 @@ void            vMBPortLog( eMBPortLogLevel eLevel, const CHAR * szModule,
 void            vMBPortTimerPoll(  );
 BOOL            xMBPortSerialPoll(  );
 BOOL            xMBPortSerialSetTimeout( ULONG dwTimeoutMs );
+BOOL            xMBTCPPortPoll( void );
+
+/* Write all frames passing the protocol stack to a pcapng file. */
+BOOL            xMBPortCaptureStart( const CHAR * szFile );
+void            vMBPortCaptureStop( void );
 
 #ifdef __cplusplus
 PR_END_EXTERN_C
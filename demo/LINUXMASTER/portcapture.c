@@ -0,0 +1,299 @@
+/*
+ * FreeModbus Libary: Linux Port
+ * Copyright (C) 2006 Christian Walter <wolti@sil.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- Standard includes --------------------------------*/
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbport.h"
+#include "mbcrc.h"
+
+/* ----------------------- Defines ------------------------------------------*/
+#define CAPTURE_SLOTS           256     /* Must be a power of two. */
+#define CAPTURE_SLOT_SIZE       264     /* MBAP header + largest PDU. */
+#define CAPTURE_IDLE_NS         10000000L
+
+/* pcapng block types and options. */
+#define PCAPNG_SHB              0x0A0D0D0AUL
+#define PCAPNG_IDB              0x00000001UL
+#define PCAPNG_EPB              0x00000006UL
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4DUL
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_IF_TSRESOL   9
+#define PCAPNG_OPT_EPB_FLAGS    2
+#define PCAPNG_FLAG_INBOUND     1
+#define PCAPNG_FLAG_OUTBOUND    2
+
+/* Serial frames are written as address, PDU and CRC to interface 0 and TCP
+ * frames with their MBAP header to interface 1. Wireshark decodes them once
+ * the DLT User table maps User 0 to "mbrtu" and User 1 to "mbtcp".
+ */
+#define CAPTURE_IF_RTU          0
+#define CAPTURE_IF_TCP          1
+#define LINKTYPE_USER0          147
+#define LINKTYPE_USER1          148
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef struct
+{
+    ULONG           ulSec;
+    ULONG           ulNSec;
+    UCHAR           ucInterface;
+    UCHAR           ucFlags;
+    USHORT          usLength;
+    UCHAR           ucData[CAPTURE_SLOT_SIZE];
+} xCaptureSlot;
+
+/* ----------------------- Static variables ---------------------------------*/
+static FILE    *pxCaptureFile;
+static pthread_t xCaptureThread;
+static volatile BOOL xCaptureRunning;
+
+/* Single producer (eMBPoll) and single consumer (flush thread) ring. */
+static xCaptureSlot xCaptureSlots[CAPTURE_SLOTS];
+static ULONG    ulCaptureHead;
+static ULONG    ulCaptureTail;
+static ULONG    ulCaptureDropped;
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     vMBPortCaptureFrame( eMBMode eMode, BOOL xSent, UCHAR ucAddress, USHORT usTID,
+                                     const UCHAR * pucPDU, USHORT usLength );
+static void    *pvMBPortCaptureThread( void *pvArg );
+static void     prvvCaptureWrite32( ULONG ulValue );
+static void     prvvCaptureWrite16( USHORT usValue );
+static void     prvvCaptureWriteIDB( USHORT usLinkType );
+static void     prvvCaptureWriteEPB( const xCaptureSlot * pxSlot );
+static BOOL     prvxCaptureFlush( void );
+
+/* ----------------------- Start implementation -----------------------------*/
+BOOL
+xMBPortCaptureStart( const CHAR * szFile )
+{
+    if( pxCaptureFile != NULL )
+    {
+        return FALSE;
+    }
+    if( ( pxCaptureFile = fopen( szFile, "wb" ) ) == NULL )
+    {
+        vMBPortLog( MB_LOG_ERROR, "CAP", "Can't open capture file %s.\n", szFile );
+        return FALSE;
+    }
+
+    /* Section header block without options and an unspecified length. */
+    prvvCaptureWrite32( PCAPNG_SHB );
+    prvvCaptureWrite32( 28 );
+    prvvCaptureWrite32( PCAPNG_BYTE_ORDER_MAGIC );
+    prvvCaptureWrite16( 1 );
+    prvvCaptureWrite16( 0 );
+    prvvCaptureWrite32( 0xFFFFFFFFUL );
+    prvvCaptureWrite32( 0xFFFFFFFFUL );
+    prvvCaptureWrite32( 28 );
+    prvvCaptureWriteIDB( LINKTYPE_USER0 );
+    prvvCaptureWriteIDB( LINKTYPE_USER1 );
+
+    __atomic_store_n( &ulCaptureHead, 0, __ATOMIC_RELAXED );
+    __atomic_store_n( &ulCaptureTail, 0, __ATOMIC_RELAXED );
+    ulCaptureDropped = 0;
+    xCaptureRunning = TRUE;
+    if( pthread_create( &xCaptureThread, NULL, pvMBPortCaptureThread, NULL ) != 0 )
+    {
+        vMBPortLog( MB_LOG_ERROR, "CAP", "Can't create capture thread.\n" );
+        fclose( pxCaptureFile );
+        pxCaptureFile = NULL;
+        return FALSE;
+    }
+    ( void )eMBRegisterCaptureCB( vMBPortCaptureFrame );
+    return TRUE;
+}
+
+void
+vMBPortCaptureStop( void )
+{
+    if( pxCaptureFile != NULL )
+    {
+        ( void )eMBRegisterCaptureCB( NULL );
+        xCaptureRunning = FALSE;
+        ( void )pthread_join( xCaptureThread, NULL );
+        ( void )prvxCaptureFlush(  );
+        if( ulCaptureDropped > 0 )
+        {
+            vMBPortLog( MB_LOG_WARN, "CAP", "%lu frames dropped.\n", ulCaptureDropped );
+        }
+        fclose( pxCaptureFile );
+        pxCaptureFile = NULL;
+    }
+}
+
+/* Called from eMBPoll( ). Copies the frame into the ring and never blocks. */
+static void
+vMBPortCaptureFrame( eMBMode eMode, BOOL xSent, UCHAR ucAddress, USHORT usTID,
+                     const UCHAR * pucPDU, USHORT usLength )
+{
+    ULONG           ulHead = __atomic_load_n( &ulCaptureHead, __ATOMIC_RELAXED );
+    ULONG           ulTail = __atomic_load_n( &ulCaptureTail, __ATOMIC_ACQUIRE );
+    xCaptureSlot   *pxSlot;
+    struct timespec xNow;
+    USHORT          usCRC16;
+
+    if( ( ulHead - ulTail ) >= CAPTURE_SLOTS )
+    {
+        ulCaptureDropped++;
+        return;
+    }
+    pxSlot = &xCaptureSlots[ulHead & ( CAPTURE_SLOTS - 1 )];
+
+    ( void )clock_gettime( CLOCK_REALTIME, &xNow );
+    pxSlot->ulSec = ( ULONG ) xNow.tv_sec;
+    pxSlot->ulNSec = ( ULONG ) xNow.tv_nsec;
+    pxSlot->ucFlags = xSent ? PCAPNG_FLAG_OUTBOUND : PCAPNG_FLAG_INBOUND;
+    if( usLength > CAPTURE_SLOT_SIZE - 7 )
+    {
+        usLength = CAPTURE_SLOT_SIZE - 7;
+    }
+    if( eMode == MB_TCP )
+    {
+        pxSlot->ucInterface = CAPTURE_IF_TCP;
+        pxSlot->ucData[0] = ( UCHAR ) ( usTID >> 8 );
+        pxSlot->ucData[1] = ( UCHAR ) ( usTID & 0xFF );
+        pxSlot->ucData[2] = 0;
+        pxSlot->ucData[3] = 0;
+        pxSlot->ucData[4] = ( UCHAR ) ( ( usLength + 1 ) >> 8 );
+        pxSlot->ucData[5] = ( UCHAR ) ( ( usLength + 1 ) & 0xFF );
+        pxSlot->ucData[6] = ucAddress;
+        memcpy( &pxSlot->ucData[7], pucPDU, usLength );
+        pxSlot->usLength = ( USHORT ) ( usLength + 7 );
+    }
+    else
+    {
+        /* ASCII frames are written as their RTU equivalent. */
+        pxSlot->ucInterface = CAPTURE_IF_RTU;
+        pxSlot->ucData[0] = ucAddress;
+        memcpy( &pxSlot->ucData[1], pucPDU, usLength );
+        usCRC16 = usMBCRC16( pxSlot->ucData, ( USHORT ) ( usLength + 1 ) );
+        pxSlot->ucData[usLength + 1] = ( UCHAR ) ( usCRC16 & 0xFF );
+        pxSlot->ucData[usLength + 2] = ( UCHAR ) ( usCRC16 >> 8 );
+        pxSlot->usLength = ( USHORT ) ( usLength + 3 );
+    }
+    __atomic_store_n( &ulCaptureHead, ulHead + 1, __ATOMIC_RELEASE );
+}
+
+static void    *
+pvMBPortCaptureThread( void *pvArg )
+{
+    struct timespec xIdle = { 0, CAPTURE_IDLE_NS };
+
+    ( void )pvArg;
+    while( xCaptureRunning )
+    {
+        if( !prvxCaptureFlush(  ) )
+        {
+            ( void )nanosleep( &xIdle, NULL );
+        }
+    }
+    return NULL;
+}
+
+/* Write all queued frames to the file. Returns FALSE if there were none. */
+static BOOL
+prvxCaptureFlush( void )
+{
+    ULONG           ulTail = __atomic_load_n( &ulCaptureTail, __ATOMIC_RELAXED );
+    ULONG           ulHead = __atomic_load_n( &ulCaptureHead, __ATOMIC_ACQUIRE );
+
+    if( ulTail == ulHead )
+    {
+        return FALSE;
+    }
+    while( ulTail != ulHead )
+    {
+        prvvCaptureWriteEPB( &xCaptureSlots[ulTail & ( CAPTURE_SLOTS - 1 )] );
+        ulTail++;
+        __atomic_store_n( &ulCaptureTail, ulTail, __ATOMIC_RELEASE );
+    }
+    ( void )fflush( pxCaptureFile );
+    return TRUE;
+}
+
+static void
+prvvCaptureWrite32( ULONG ulValue )
+{
+    uint32_t        ulRaw = ( uint32_t ) ulValue;
+
+    ( void )fwrite( &ulRaw, sizeof( ulRaw ), 1, pxCaptureFile );
+}
+
+static void
+prvvCaptureWrite16( USHORT usValue )
+{
+    uint16_t        usRaw = ( uint16_t ) usValue;
+
+    ( void )fwrite( &usRaw, sizeof( usRaw ), 1, pxCaptureFile );
+}
+
+/* Interface description block with nanosecond timestamps. */
+static void
+prvvCaptureWriteIDB( USHORT usLinkType )
+{
+    static const UCHAR ucTSResol[4] = { 9, 0, 0, 0 };
+
+    prvvCaptureWrite32( PCAPNG_IDB );
+    prvvCaptureWrite32( 32 );
+    prvvCaptureWrite16( usLinkType );
+    prvvCaptureWrite16( 0 );
+    prvvCaptureWrite32( CAPTURE_SLOT_SIZE );
+    prvvCaptureWrite16( PCAPNG_OPT_IF_TSRESOL );
+    prvvCaptureWrite16( 1 );
+    ( void )fwrite( ucTSResol, 1, sizeof( ucTSResol ), pxCaptureFile );
+    prvvCaptureWrite32( PCAPNG_OPT_END );
+    prvvCaptureWrite32( 32 );
+}
+
+/* Enhanced packet block with the direction in the epb_flags option. */
+static void
+prvvCaptureWriteEPB( const xCaptureSlot * pxSlot )
+{
+    static const UCHAR ucPad[3] = { 0, 0, 0 };
+    USHORT          usPadded = ( USHORT ) ( ( pxSlot->usLength + 3 ) & ~3 );
+    ULONG           ulBlockLength = 28UL + usPadded + 8UL + 4UL + 4UL;
+    uint64_t        ullTime = ( uint64_t ) pxSlot->ulSec * 1000000000ULL + pxSlot->ulNSec;
+
+    prvvCaptureWrite32( PCAPNG_EPB );
+    prvvCaptureWrite32( ulBlockLength );
+    prvvCaptureWrite32( pxSlot->ucInterface );
+    prvvCaptureWrite32( ( ULONG ) ( ullTime >> 32 ) );
+    prvvCaptureWrite32( ( ULONG ) ( ullTime & 0xFFFFFFFFUL ) );
+    prvvCaptureWrite32( pxSlot->usLength );
+    prvvCaptureWrite32( pxSlot->usLength );
+    ( void )fwrite( pxSlot->ucData, 1, pxSlot->usLength, pxCaptureFile );
+    ( void )fwrite( ucPad, 1, usPadded - pxSlot->usLength, pxCaptureFile );
+    prvvCaptureWrite16( PCAPNG_OPT_EPB_FLAGS );
+    prvvCaptureWrite16( 4 );
+    prvvCaptureWrite32( pxSlot->ucFlags );
+    prvvCaptureWrite32( PCAPNG_OPT_END );
+    prvvCaptureWrite32( ulBlockLength );
+}
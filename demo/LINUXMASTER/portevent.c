@@ -22,6 +22,7 @@
 /* ----------------------- Modbus includes ----------------------------------*/
 #include "mbmaster.h"
 #include "mbport.h"
+#include "mbconfig.h"
 
 /* ----------------------- Variables ----------------------------------------*/
 static eMBEventType eQueuedEvent;
@@ -63,6 +64,13 @@ xMBPortEventGet( eMBEventType * eEvent )
          * init functions.
          */
         ( void )xMBPortSerialPoll(  );
+#if MB_TCP_ENABLED > 0
+        /* Same for the connections to Modbus TCP servers. */
+        if( !xEventInQueue )
+        {
+            ( void )xMBTCPPortPoll(  );
+        }
+#endif
         if( xEventInQueue )
         {
             xEventHappened = xMBPortEventGet(eEvent);
@@ -0,0 +1,490 @@
+/*
+ * FreeModbus Libary: Linux Port
+ * Copyright (C) 2006 Christian Walter <wolti@sil.at>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- Standard includes --------------------------------*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbport.h"
+#include "mbconfig.h"
+
+#if MB_TCP_ENABLED > 0
+
+/* ----------------------- MBAP Header --------------------------------------*/
+#define MB_TCP_UID          6
+#define MB_TCP_LEN          4
+#define MB_TCP_FUNC         7
+
+/* ----------------------- Defines  -----------------------------------------*/
+#define MB_TCP_DEFAULT_PORT 502 /* Modbus TCP server port. */
+#define MB_TCP_POLL_TIMEOUT 50  /* Timeout in ms when waiting for data. */
+#define MB_TCP_RECONNECT    1000        /* Delay in ms before a connection is retried. */
+
+#define MB_TCP_BUF_SIZE     ( 253 + 7 ) /* Must hold a complete Modbus TCP frame. */
+#define MB_TCP_TX_BUF_SIZE  ( MB_TCP_MASTER_PIPELINE_DEPTH * MB_TCP_BUF_SIZE )
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef enum
+{
+    CONN_UNUSED,                /*!< Slot is free. */
+    CONN_CLOSED,                /*!< Waiting to (re)connect. */
+    CONN_CONNECTING,            /*!< Non blocking connect in progress. */
+    CONN_CONNECTED              /*!< Connection is established. */
+} eMBTCPConnState;
+
+typedef struct
+{
+    eMBTCPConnState eState;
+    int             iSocket;
+    struct sockaddr_in xAddr;
+    struct timespec xRetryTime;
+    UCHAR           aucBuf[MB_TCP_BUF_SIZE];
+    USHORT          usBufPos;
+    USHORT          usBytesLeft;
+    BOOL            bFrameReady;
+    UCHAR           aucTxBuf[MB_TCP_TX_BUF_SIZE];       /*!< Requests not yet accepted by the socket. */
+    USHORT          usTxPos;
+    USHORT          usTxLen;
+} xMBTCPConnection;
+
+/* ----------------------- Static variables ---------------------------------*/
+static xMBTCPConnection xConnections[MB_TCP_MASTER_CONNECTIONS_MAX];
+static USHORT   usDefaultPort;
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvMBTCPPortStartConnect( xMBTCPConnection * pxConn );
+static void     prvvMBTCPPortDropConnection( xMBTCPConnection * pxConn );
+static void     prvvMBTCPPortRead( xMBTCPConnection * pxConn );
+static void     prvvMBTCPPortWrite( xMBTCPConnection * pxConn );
+static BOOL     prvbMBTCPPortRetryDue( xMBTCPConnection * pxConn );
+
+/* ----------------------- Begin implementation -----------------------------*/
+BOOL
+xMBTCPPortInit( USHORT usTCPPort )
+{
+    int             i;
+
+    usDefaultPort = usTCPPort == 0 ? MB_TCP_DEFAULT_PORT : usTCPPort;
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        xConnections[i].eState = CONN_UNUSED;
+        xConnections[i].iSocket = -1;
+    }
+    return TRUE;
+}
+
+void
+vMBTCPPortClose( void )
+{
+    int             i;
+
+    vMBTCPPortDisable(  );
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        xConnections[i].eState = CONN_UNUSED;
+    }
+}
+
+void
+vMBTCPPortDisable( void )
+{
+    int             i;
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        if( xConnections[i].eState != CONN_UNUSED )
+        {
+            /* The connection is reopened by the next call of xMBTCPPortPoll
+             * after the stack has been enabled again. */
+            prvvMBTCPPortDropConnection( &xConnections[i] );
+            xConnections[i].xRetryTime.tv_sec = 0;
+        }
+    }
+}
+
+BOOL
+xMBTCPPortConnect( const CHAR * szHostAddress, USHORT usTCPPort, UCHAR * pucConnection )
+{
+    struct addrinfo xHints, *pxResult;
+    struct sockaddr_in xAddr;
+    int             i, iFree = -1;
+    BOOL            bOkay = FALSE;
+
+    memset( &xHints, 0, sizeof( xHints ) );
+    xHints.ai_family = AF_INET;
+    xHints.ai_socktype = SOCK_STREAM;
+    if( getaddrinfo( szHostAddress, NULL, &xHints, &pxResult ) != 0 )
+    {
+        vMBPortLog( MB_LOG_ERROR, "TCP-CONN", "Can't resolve host %s\n", szHostAddress );
+        return FALSE;
+    }
+    memcpy( &xAddr, pxResult->ai_addr, sizeof( xAddr ) );
+    freeaddrinfo( pxResult );
+    xAddr.sin_port = htons( usTCPPort == 0 ? usDefaultPort : usTCPPort );
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        if( xConnections[i].eState == CONN_UNUSED )
+        {
+            iFree = iFree == -1 ? i : iFree;
+        }
+        else if( ( xConnections[i].xAddr.sin_addr.s_addr == xAddr.sin_addr.s_addr ) &&
+                 ( xConnections[i].xAddr.sin_port == xAddr.sin_port ) )
+        {
+            /* Server is already known. Share the connection. */
+            *pucConnection = ( UCHAR ) i;
+            return TRUE;
+        }
+    }
+    if( iFree == -1 )
+    {
+        vMBPortLog( MB_LOG_ERROR, "TCP-CONN", "All connections in use.\n" );
+    }
+    else
+    {
+        xConnections[iFree].xAddr = xAddr;
+        xConnections[iFree].eState = CONN_CLOSED;
+        prvvMBTCPPortStartConnect( &xConnections[iFree] );
+        *pucConnection = ( UCHAR ) iFree;
+        bOkay = TRUE;
+    }
+    return bOkay;
+}
+
+BOOL
+xMBTCPPortIsConnected( UCHAR ucConnection )
+{
+    return ( ucConnection < MB_TCP_MASTER_CONNECTIONS_MAX ) &&
+        ( xConnections[ucConnection].eState == CONN_CONNECTED ) ? TRUE : FALSE;
+}
+
+BOOL
+xMBTCPPortSendRequest( UCHAR ucConnection, const UCHAR * pucMBTCPFrame, USHORT usTCPLength )
+{
+    xMBTCPConnection *pxConn = &xConnections[ucConnection];
+
+    if( !xMBTCPPortIsConnected( ucConnection ) )
+    {
+        return FALSE;
+    }
+    if( pxConn->usTxPos > 0 )
+    {
+        memmove( pxConn->aucTxBuf, &pxConn->aucTxBuf[pxConn->usTxPos],
+                 pxConn->usTxLen - pxConn->usTxPos );
+        pxConn->usTxLen -= pxConn->usTxPos;
+        pxConn->usTxPos = 0;
+    }
+    if( pxConn->usTxLen + usTCPLength > MB_TCP_TX_BUF_SIZE )
+    {
+        /* The server does not read its requests. Keep the connection and
+         * let the request time out. */
+        vMBPortLog( MB_LOG_WARN, "TCP-SEND", "Send buffer full.\n" );
+        return FALSE;
+    }
+    /* Queue the request behind unsent ones and send as much as the socket
+     * takes. The rest is sent by xMBTCPPortPoll( ) when it is writable. */
+    memcpy( &pxConn->aucTxBuf[pxConn->usTxLen], pucMBTCPFrame, usTCPLength );
+    pxConn->usTxLen += usTCPLength;
+    prvvMBTCPPortWrite( pxConn );
+    return pxConn->eState == CONN_CONNECTED ? TRUE : FALSE;
+}
+
+BOOL
+xMBTCPPortGetResponse( UCHAR * pucConnection, UCHAR ** ppucMBTCPFrame, USHORT * usTCPLength )
+{
+    int             i;
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        if( xConnections[i].bFrameReady )
+        {
+            *pucConnection = ( UCHAR ) i;
+            *ppucMBTCPFrame = &xConnections[i].aucBuf[0];
+            *usTCPLength = xConnections[i].usBufPos;
+
+            /* Reset the buffer. The frame stays valid until the next read. */
+            xConnections[i].bFrameReady = FALSE;
+            xConnections[i].usBufPos = 0;
+            xConnections[i].usBytesLeft = MB_TCP_FUNC;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*! \brief Drive all client connections.
+ *
+ * Retries closed connections, completes pending connects and reads data
+ * from connected servers. If a complete frame has been received the
+ * protocol stack is notified with an EV_FRAME_RECEIVED event. The function
+ * waits at most MB_TCP_POLL_TIMEOUT milliseconds for socket events.
+ */
+BOOL
+xMBTCPPortPoll( void )
+{
+    fd_set          xReadSet, xWriteSet;
+    struct timeval  xTimeout;
+    xMBTCPConnection *pxConn;
+    int             i, iMaxFd = -1, iError;
+    socklen_t       xLen;
+
+    FD_ZERO( &xReadSet );
+    FD_ZERO( &xWriteSet );
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        pxConn = &xConnections[i];
+        if( pxConn->bFrameReady )
+        {
+            /* Previous frame has not been fetched by the stack. */
+            ( void )xMBPortEventPost( EV_FRAME_RECEIVED );
+            return TRUE;
+        }
+        if( ( pxConn->eState == CONN_CLOSED ) && prvbMBTCPPortRetryDue( pxConn ) )
+        {
+            prvvMBTCPPortStartConnect( pxConn );
+        }
+        if( pxConn->eState == CONN_CONNECTING )
+        {
+            FD_SET( pxConn->iSocket, &xWriteSet );
+            iMaxFd = pxConn->iSocket > iMaxFd ? pxConn->iSocket : iMaxFd;
+        }
+        else if( pxConn->eState == CONN_CONNECTED )
+        {
+            FD_SET( pxConn->iSocket, &xReadSet );
+            if( pxConn->usTxPos != pxConn->usTxLen )
+            {
+                FD_SET( pxConn->iSocket, &xWriteSet );
+            }
+            iMaxFd = pxConn->iSocket > iMaxFd ? pxConn->iSocket : iMaxFd;
+        }
+    }
+    if( iMaxFd == -1 )
+    {
+        return TRUE;
+    }
+
+    xTimeout.tv_sec = 0;
+    xTimeout.tv_usec = MB_TCP_POLL_TIMEOUT * 1000;
+    if( select( iMaxFd + 1, &xReadSet, &xWriteSet, NULL, &xTimeout ) == -1 )
+    {
+        return errno == EINTR ? TRUE : FALSE;
+    }
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        pxConn = &xConnections[i];
+        if( ( pxConn->eState == CONN_CONNECTING ) && FD_ISSET( pxConn->iSocket, &xWriteSet ) )
+        {
+            xLen = sizeof( iError );
+            if( ( getsockopt( pxConn->iSocket, SOL_SOCKET, SO_ERROR, &iError, &xLen ) == -1 ) ||
+                ( iError != 0 ) )
+            {
+                prvvMBTCPPortDropConnection( pxConn );
+            }
+            else
+            {
+                pxConn->eState = CONN_CONNECTED;
+            }
+        }
+        if( ( pxConn->eState == CONN_CONNECTED ) && FD_ISSET( pxConn->iSocket, &xWriteSet ) )
+        {
+            prvvMBTCPPortWrite( pxConn );
+        }
+        if( ( pxConn->eState == CONN_CONNECTED ) && FD_ISSET( pxConn->iSocket, &xReadSet ) )
+        {
+            prvvMBTCPPortRead( pxConn );
+            if( pxConn->bFrameReady )
+            {
+                ( void )xMBPortEventPost( EV_FRAME_RECEIVED );
+                break;
+            }
+        }
+    }
+    return TRUE;
+}
+
+static void
+prvvMBTCPPortRead( xMBTCPConnection * pxConn )
+{
+    ssize_t         res;
+    USHORT          usLength;
+
+    /* The socket is non blocking. Read the header and the rest of the frame
+     * as long as data is available. */
+    while( ( pxConn->eState == CONN_CONNECTED ) && !pxConn->bFrameReady )
+    {
+        res = recv( pxConn->iSocket, &pxConn->aucBuf[pxConn->usBufPos], pxConn->usBytesLeft, 0 );
+        if( res == -1 )
+        {
+            if( ( errno != EINTR ) && ( errno != EAGAIN ) )
+            {
+                prvvMBTCPPortDropConnection( pxConn );
+            }
+            return;
+        }
+        else if( res == 0 )
+        {
+            /* Server closed the connection. */
+            prvvMBTCPPortDropConnection( pxConn );
+            return;
+        }
+
+        pxConn->usBufPos += ( USHORT ) res;
+        pxConn->usBytesLeft -= ( USHORT ) res;
+        if( ( pxConn->usBufPos >= MB_TCP_FUNC ) && ( pxConn->usBytesLeft == 0 ) )
+        {
+            /* Length is a byte count of Modbus PDU (function code + data) and the
+             * unit identifier. */
+            usLength = ( USHORT )( pxConn->aucBuf[MB_TCP_LEN] << 8U );
+            usLength |= ( USHORT )( pxConn->aucBuf[MB_TCP_LEN + 1] );
+
+            if( ( usLength < 2 ) || ( ( MB_TCP_UID + usLength ) > MB_TCP_BUF_SIZE ) )
+            {
+                /* We can't resynchronize on a TCP stream. */
+                vMBPortLog( MB_LOG_WARN, "TCP-RECV", "Invalid MBAP length %hu\n", usLength );
+                prvvMBTCPPortDropConnection( pxConn );
+            }
+            else if( pxConn->usBufPos < ( MB_TCP_UID + usLength ) )
+            {
+                pxConn->usBytesLeft = ( USHORT )( MB_TCP_UID + usLength - pxConn->usBufPos );
+            }
+            else
+            {
+                pxConn->bFrameReady = TRUE;
+            }
+        }
+    }
+}
+
+/* Send queued requests until the socket buffer is full. Only real errors
+ * drop the connection. */
+static void
+prvvMBTCPPortWrite( xMBTCPConnection * pxConn )
+{
+    ssize_t         res;
+
+    while( pxConn->usTxPos != pxConn->usTxLen )
+    {
+        res = send( pxConn->iSocket, &pxConn->aucTxBuf[pxConn->usTxPos],
+                    pxConn->usTxLen - pxConn->usTxPos, MSG_NOSIGNAL );
+        if( res == -1 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            if( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+            {
+                vMBPortLog( MB_LOG_WARN, "TCP-SEND", "Send failed: %s\n", strerror( errno ) );
+                prvvMBTCPPortDropConnection( pxConn );
+            }
+            return;
+        }
+        pxConn->usTxPos += ( USHORT ) res;
+    }
+    pxConn->usTxPos = 0;
+    pxConn->usTxLen = 0;
+}
+
+static void
+prvvMBTCPPortStartConnect( xMBTCPConnection * pxConn )
+{
+    int             iFlags, iNoDelay = 1;
+
+    pxConn->usBufPos = 0;
+    pxConn->usBytesLeft = MB_TCP_FUNC;
+    pxConn->bFrameReady = FALSE;
+    pxConn->usTxPos = 0;
+    pxConn->usTxLen = 0;
+
+    if( ( pxConn->iSocket = socket( AF_INET, SOCK_STREAM, IPPROTO_TCP ) ) == -1 )
+    {
+        prvvMBTCPPortDropConnection( pxConn );
+        return;
+    }
+    /* Requests are small and latency matters more than throughput. */
+    ( void )setsockopt( pxConn->iSocket, IPPROTO_TCP, TCP_NODELAY, &iNoDelay, sizeof( iNoDelay ) );
+    iFlags = fcntl( pxConn->iSocket, F_GETFL, 0 );
+    ( void )fcntl( pxConn->iSocket, F_SETFL, iFlags | O_NONBLOCK );
+
+    if( connect( pxConn->iSocket, ( struct sockaddr * )&pxConn->xAddr, sizeof( pxConn->xAddr ) ) == 0 )
+    {
+        pxConn->eState = CONN_CONNECTED;
+    }
+    else if( errno == EINPROGRESS )
+    {
+        pxConn->eState = CONN_CONNECTING;
+    }
+    else
+    {
+        prvvMBTCPPortDropConnection( pxConn );
+    }
+}
+
+static void
+prvvMBTCPPortDropConnection( xMBTCPConnection * pxConn )
+{
+    if( pxConn->iSocket != -1 )
+    {
+        ( void )close( pxConn->iSocket );
+        pxConn->iSocket = -1;
+    }
+    pxConn->eState = CONN_CLOSED;
+    pxConn->bFrameReady = FALSE;
+    vMBMasterTCPConnectionLost( ( UCHAR )( pxConn - &xConnections[0] ) );
+
+    ( void )clock_gettime( CLOCK_MONOTONIC, &pxConn->xRetryTime );
+    pxConn->xRetryTime.tv_sec += MB_TCP_RECONNECT / 1000;
+    pxConn->xRetryTime.tv_nsec += ( MB_TCP_RECONNECT % 1000 ) * 1000000L;
+    if( pxConn->xRetryTime.tv_nsec >= 1000000000L )
+    {
+        pxConn->xRetryTime.tv_sec++;
+        pxConn->xRetryTime.tv_nsec -= 1000000000L;
+    }
+}
+
+static BOOL
+prvbMBTCPPortRetryDue( xMBTCPConnection * pxConn )
+{
+    struct timespec xNow;
+
+    ( void )clock_gettime( CLOCK_MONOTONIC, &xNow );
+    return ( xNow.tv_sec > pxConn->xRetryTime.tv_sec ) ||
+        ( ( xNow.tv_sec == pxConn->xRetryTime.tv_sec ) &&
+          ( xNow.tv_nsec >= pxConn->xRetryTime.tv_nsec ) ) ? TRUE : FALSE;
+}
+
+#endif
@@ -22,6 +22,7 @@
 /* ----------------------- Standard includes --------------------------------*/
 #include <stdlib.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "port.h"
 
@@ -36,11 +37,13 @@ ULONG           ulTimeOut;
 BOOL            bTimeoutEnable;
 
 static struct timeval xTimeLast;
+static USHORT   usTimerTimeout50us;
 
 /* ----------------------- Start implementation -----------------------------*/
 BOOL
 xMBPortTimersInit( USHORT usTim1Timerout50us )
 {
+    usTimerTimeout50us = usTim1Timerout50us;
     ulTimeOut = usTim1Timerout50us / 20U;
     if( ulTimeOut == 0 )
         ulTimeOut = 1;
@@ -71,7 +74,7 @@ vMBPortTimerPoll(  )
         else
         {
             ulDeltaMS = ( xTimeCur.tv_sec - xTimeLast.tv_sec ) * 1000L +
-                ( xTimeCur.tv_usec - xTimeLast.tv_usec ) * 1000L;
+                ( xTimeCur.tv_usec - xTimeLast.tv_usec ) / 1000L;
             if( ulDeltaMS > ulTimeOut )
             {
                 bTimeoutEnable = FALSE;
@@ -95,3 +98,38 @@ vMBPortTimersDisable(  )
 {
     bTimeoutEnable = FALSE;
 }
+
+USHORT
+usMBPortTimersGetElapsed( void )
+{
+    struct timeval  xTimeCur;
+    ULONG           ulElapsed50us;
+
+    if( gettimeofday( &xTimeCur, NULL ) != 0 )
+    {
+        return 0;
+    }
+    ulElapsed50us = ( xTimeCur.tv_sec - xTimeLast.tv_sec ) * 20000L +
+        ( xTimeCur.tv_usec - xTimeLast.tv_usec ) / 50L;
+    return ulElapsed50us > usTimerTimeout50us ? usTimerTimeout50us : ( USHORT )ulElapsed50us;
+}
+
+ULONG
+ulMBPortTimersGetMs( void )
+{
+    struct timespec xTimeCur;
+
+    /* Not affected by changes of the system time. */
+    ( void )clock_gettime( CLOCK_MONOTONIC, &xTimeCur );
+    return ( ULONG )( xTimeCur.tv_sec * 1000UL + xTimeCur.tv_nsec / 1000000L );
+}
+
+void
+vMBPortTimersGetTimestamp( ULONG * pulSec, ULONG * pulNSec )
+{
+    struct timespec xTimeCur;
+
+    ( void )clock_gettime( CLOCK_MONOTONIC, &xTimeCur );
+    *pulSec = ( ULONG )xTimeCur.tv_sec;
+    *pulNSec = ( ULONG )xTimeCur.tv_nsec;
+}
@@ -42,6 +42,7 @@ PR_BEGIN_EXTERN_C
 #define ENTER_CRITICAL_SECTION( )
 #define EXIT_CRITICAL_SECTION( )
 #define MB_PORT_HAS_CLOSE	1
+#define MB_PORT_HAS_TCP_CONNECTION	1
 #ifndef TRUE
 #define TRUE            1
 #endif
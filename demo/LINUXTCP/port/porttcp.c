@@ -80,6 +80,7 @@ static fd_set   allset;
 static UCHAR    aucTCPBuf[MB_TCP_BUF_SIZE];
 static USHORT   usTCPBufPos;
 static USHORT   usTCPFrameBytesLeft;
+static ULONG    ulConnection;
 
 /* ----------------------- External functions -------------------------------*/
 CHAR           *WsaError2String( int dwError );
@@ -211,11 +212,16 @@ xMBPortTCPPool( void )
     {
         FD_ZERO( &fread );
         FD_SET( xClientSocket, &fread );
-        if( ( ( ret = select( xClientSocket + 1, &fread, NULL, NULL, &tval ) ) == SOCKET_ERROR )
-            || !ret )
+        if( ( ret = select( xClientSocket + 1, &fread, NULL, NULL, &tval ) ) == SOCKET_ERROR )
         {
             continue;
         }
+        if( !ret )
+        {
+            /* Return to eMBPoll( ) which may have to send a deferred
+             * response. */
+            return TRUE;
+        }
         if( ret > 0 )
         {
             if( FD_ISSET( xClientSocket, &fread ) )
@@ -289,6 +295,12 @@ xMBTCPPortGetRequest( UCHAR ** ppucMBTCPFrame, USHORT * usTCPLength )
     return TRUE;
 }
 
+ULONG
+ulMBTCPPortGetConnection( void )
+{
+    return xClientSocket != INVALID_SOCKET ? ulConnection : 0;
+}
+
 BOOL
 xMBTCPPortSendResponse( const UCHAR * pucMBTCPFrame, USHORT usTCPLength )
 {
@@ -359,6 +371,10 @@ prvbMBPortAcceptClient(  )
     else
     {
         xClientSocket = xNewSocket;
+        if( ++ulConnection == 0 )
+        {
+            ulConnection = 1;
+        }
         usTCPBufPos = 0;
         usTCPFrameBytesLeft = MB_TCP_FUNC;
         bOkay = TRUE;
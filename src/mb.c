@@ -41,6 +41,7 @@
 #include "mbframe.h"
 #include "mbproto.h"
 #include "mbfunc.h"
+#include "mbjournal.h"
 
 #include "mbport.h"
 #if MB_RTU_ENABLED == 1
@@ -56,10 +57,22 @@
 #ifndef MB_PORT_HAS_CLOSE
 #define MB_PORT_HAS_CLOSE 0
 #endif
+#ifndef MB_PORT_HAS_TCP_CONNECTION
+#define MB_PORT_HAS_TCP_CONNECTION 0
+#endif
+
+#if ( MB_DEFERRED_ENABLED > 0 ) && !defined( MB_PORT_BARRIER )
+#error "The port must define MB_PORT_BARRIER( ) in port.h"
+#endif
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_DEFERRED_HDR_SIZE        ( 7 )   /*!< Size of the MBAP header. */
+#define MB_DEFERRED_WRITE_RSP_SIZE  ( 5 )   /*!< Function code, address and value. */
 
 /* ----------------------- Static variables ---------------------------------*/
 
 static UCHAR    ucMBAddress;
+static UCHAR    ucMBRequestAddr;        /* Address of the request which is executed. */
 static eMBMode  eMBCurrentMode;
 
 static enum
@@ -77,6 +90,7 @@ static pvMBFrameStart pvMBFrameStartCur;
 static pvMBFrameStop pvMBFrameStopCur;
 static peMBFrameReceive peMBFrameReceiveCur;
 static pvMBFrameClose pvMBFrameCloseCur;
+static pvMBFrameGetTimes pvMBFrameGetTimesCur;
 
 /* Callback functions required by the porting layer. They are called when
  * an external event has happend which includes a timeout or the reception
@@ -89,6 +103,81 @@ BOOL( *pxMBPortCBTimerExpired ) ( void );
 BOOL( *pxMBFrameCBReceiveFSMCur ) ( void );
 BOOL( *pxMBFrameCBTransmitFSMCur ) ( void );
 
+static pvMBCaptureCB pvMBCaptureCur;
+
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+/* Slaves registered with eMBRegisterSlave( ). ucSlaveIndex maps an address
+ * to the index of its slave plus one and is zero for addresses without a
+ * slave. Free slots have the broadcast address. pxSlaveCur points to the
+ * callbacks of the request which is executed and is NULL for the default
+ * slave.
+ */
+static struct
+{
+    UCHAR           ucAddress;
+    xMBSlaveCallbacks xCallbacks;
+} xSlaves[MB_VIRTUAL_SLAVES_MAX];
+static UCHAR    ucSlaveIndex[256];
+static const xMBSlaveCallbacks *pxSlaveCur;
+#endif
+
+#if MB_DEFERRED_ENABLED > 0
+/* A request whose callback returned MB_EPENDING. The buffer holds the
+ * response without the values and leaves room for the MBAP header in
+ * front of the PDU, which eMBTCPSend( ) expects. The values of a write
+ * follow the response for the journal. The response is only sent to the
+ * client connection which sent the request. pucDeferRequest and
+ * ucDeferAddress describe the request which is executed. The state is
+ * changed after a barrier because eMBCompleteRequest( ) may be called by
+ * another thread.
+ */
+static struct
+{
+    volatile enum
+    {
+        DEFERRED_IDLE,
+        DEFERRED_PENDING,
+        DEFERRED_DONE
+    } eState;
+    UCHAR           ucAddress;
+    eMBException    eException;
+    USHORT          usLength;
+    USHORT          usDataLen;
+#if MB_PORT_HAS_TCP_CONNECTION > 0
+    ULONG           ulConnection;       /* Client which sent the request. */
+#endif
+#if MB_STATS_ENABLED > 0
+    int             iFunc;              /* Index of the handler in xFuncStats. */
+#endif
+#if MB_JOURNAL_ENABLED > 0
+    eMBJournalTable eWriteTable;
+    USHORT          usWriteAddress;
+    USHORT          usWriteCount;       /* Zero if the request is not a write. */
+#endif
+    UCHAR           ucBuf[MB_DEFERRED_HDR_SIZE + MB_PDU_SIZE_MAX];
+} xDeferred;
+static UCHAR   *pucDeferRequest;
+static UCHAR    ucDeferAddress;
+#endif
+
+#if MB_STATS_ENABLED > 0
+/* Statistics of the protocol stack. The framer counters are kept by the
+ * framers and only copied into the snapshot. The per function counters
+ * use the index of the handler in xFuncHandlers. The last entry counts
+ * function codes without a handler.
+ */
+static xMBStats xStats;
+static struct
+{
+    ULONG           ulRequests;
+    ULONG           ulExceptions;
+} xFuncStats[MB_FUNC_HANDLERS_MAX + 1];
+#endif
+#if MB_STATS_TIMING_ENABLED > 0
+static ULONG    ulStatsRcvUs;
+static BOOL     xStatsRspPending;
+#endif
+
 /* An array of Modbus functions handlers which associates Modbus function
  * codes with implementing functions.
  */
@@ -111,6 +200,9 @@ static xMBFunctionHandler xFuncHandlers[MB_FUNC_HANDLERS_MAX] = {
 #if MB_FUNC_READWRITE_HOLDING_ENABLED > 0
     {MB_FUNC_READWRITE_MULTIPLE_REGISTERS, eMBFuncReadWriteMultipleHoldingRegister},
 #endif
+#if MB_FUNC_DIAG_ENABLED > 0
+    {MB_FUNC_DIAG_DIAGNOSTIC, eMBFuncDiagnostic},
+#endif
 #if MB_FUNC_READ_COILS_ENABLED > 0
     {MB_FUNC_READ_COILS, eMBFuncReadCoils},
 #endif
@@ -125,6 +217,22 @@ static xMBFunctionHandler xFuncHandlers[MB_FUNC_HANDLERS_MAX] = {
 #endif
 };
 
+/* ----------------------- Static functions ---------------------------------*/
+eMBException    prveMBError2Exception( eMBErrorCode eErrorCode );
+static USHORT   prvusMBCaptureTID( const UCHAR * pucFrame );
+#if MB_DEFERRED_ENABLED > 0
+static eMBErrorCode prveMBDeferRequest( const UCHAR * pucRegBuffer, USHORT usDataLen );
+static eMBErrorCode prveMBDeferredSend( void );
+#if MB_JOURNAL_ENABLED > 0
+static void     prvvMBDeferWrite( eMBJournalTable eTable, const UCHAR * pucRegBuffer,
+                                  USHORT usAddress, USHORT usCount );
+#endif
+#endif
+#if MB_STATS_TIMING_ENABLED > 0
+static ULONG    prvulMBStatsNowUs( void );
+static void     prvvMBStatsRecord( ULONG * pulHistogram, ULONG ulTimeUs );
+#endif
+
 /* ----------------------- Start implementation -----------------------------*/
 eMBErrorCode
 eMBInit( eMBMode eMode, UCHAR ucSlaveAddress, UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity )
@@ -150,6 +258,7 @@ eMBInit( eMBMode eMode, UCHAR ucSlaveAddress, UCHAR ucPort, ULONG ulBaudRate, eM
             peMBFrameSendCur = eMBRTUSend;
             peMBFrameReceiveCur = eMBRTUReceive;
             pvMBFrameCloseCur = MB_PORT_HAS_CLOSE ? vMBPortClose : NULL;
+            pvMBFrameGetTimesCur = vMBRTUGetTimes;
             pxMBFrameCBByteReceived = xMBRTUReceiveFSM;
             pxMBFrameCBTransmitterEmpty = xMBRTUTransmitFSM;
             pxMBPortCBTimerExpired = xMBRTUTimerT35Expired;
@@ -164,6 +273,7 @@ eMBInit( eMBMode eMode, UCHAR ucSlaveAddress, UCHAR ucPort, ULONG ulBaudRate, eM
             peMBFrameSendCur = eMBASCIISend;
             peMBFrameReceiveCur = eMBASCIIReceive;
             pvMBFrameCloseCur = MB_PORT_HAS_CLOSE ? vMBPortClose : NULL;
+            pvMBFrameGetTimesCur = vMBASCIIGetTimes;
             pxMBFrameCBByteReceived = xMBASCIIReceiveFSM;
             pxMBFrameCBTransmitterEmpty = xMBASCIITransmitFSM;
             pxMBPortCBTimerExpired = xMBASCIITimerT1SExpired;
@@ -214,6 +324,7 @@ eMBTCPInit( USHORT ucTCPPort )
         peMBFrameReceiveCur = eMBTCPReceive;
         peMBFrameSendCur = eMBTCPSend;
         pvMBFrameCloseCur = MB_PORT_HAS_CLOSE ? vMBTCPPortClose : NULL;
+        pvMBFrameGetTimesCur = NULL;
         ucMBAddress = MB_TCP_PSEUDO_ADDRESS;
         eMBCurrentMode = MB_TCP;
         eMBState = STATE_DISABLED;
@@ -238,6 +349,13 @@ eMBRegisterCB( UCHAR ucFunctionCode, pxMBFunctionHandler pxHandler )
                 if( ( xFuncHandlers[i].pxHandler == NULL ) ||
                     ( xFuncHandlers[i].pxHandler == pxHandler ) )
                 {
+#if MB_STATS_ENABLED > 0
+                    if( xFuncHandlers[i].ucFunctionCode != ucFunctionCode )
+                    {
+                        xFuncStats[i].ulRequests = 0;
+                        xFuncStats[i].ulExceptions = 0;
+                    }
+#endif
                     xFuncHandlers[i].ucFunctionCode = ucFunctionCode;
                     xFuncHandlers[i].pxHandler = pxHandler;
                     break;
@@ -253,6 +371,10 @@ eMBRegisterCB( UCHAR ucFunctionCode, pxMBFunctionHandler pxHandler )
                 {
                     xFuncHandlers[i].ucFunctionCode = 0;
                     xFuncHandlers[i].pxHandler = NULL;
+#if MB_STATS_ENABLED > 0
+                    xFuncStats[i].ulRequests = 0;
+                    xFuncStats[i].ulExceptions = 0;
+#endif
                     break;
                 }
             }
@@ -268,6 +390,272 @@ eMBRegisterCB( UCHAR ucFunctionCode, pxMBFunctionHandler pxHandler )
     return eStatus;
 }
 
+eMBErrorCode
+eMBRegisterSlave( UCHAR ucSlaveAddress, const xMBSlaveCallbacks * pxCallbacks )
+{
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+    eMBErrorCode    eStatus = MB_ENOERR;
+    int             i;
+
+    if( ( ucSlaveAddress < MB_ADDRESS_MIN ) || ( ucSlaveAddress > MB_ADDRESS_MAX ) ||
+        ( ucSlaveAddress == ucMBAddress ) )
+    {
+        return MB_EINVAL;
+    }
+    ENTER_CRITICAL_SECTION(  );
+    i = ucSlaveIndex[ucSlaveAddress] - 1;
+    if( pxCallbacks == NULL )
+    {
+        if( i >= 0 )
+        {
+            ucSlaveIndex[ucSlaveAddress] = 0;
+            xSlaves[i].ucAddress = MB_ADDRESS_BROADCAST;
+        }
+    }
+    else
+    {
+        if( i < 0 )
+        {
+            for( i = 0; i < MB_VIRTUAL_SLAVES_MAX; i++ )
+            {
+                if( xSlaves[i].ucAddress == MB_ADDRESS_BROADCAST )
+                {
+                    break;
+                }
+            }
+        }
+        if( i < MB_VIRTUAL_SLAVES_MAX )
+        {
+            xSlaves[i].ucAddress = ucSlaveAddress;
+            xSlaves[i].xCallbacks = *pxCallbacks;
+            ucSlaveIndex[ucSlaveAddress] = ( UCHAR )( i + 1 );
+        }
+        else
+        {
+            eStatus = MB_ENORES;
+        }
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return eStatus;
+#else
+    ( void )ucSlaveAddress;
+    ( void )pxCallbacks;
+    return MB_EILLSTATE;
+#endif
+}
+
+UCHAR
+ucMBRequestAddress( void )
+{
+    return ucMBRequestAddr;
+}
+
+void           *
+pvMBSlaveContext( void )
+{
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+    return pxSlaveCur != NULL ? pxSlaveCur->pvContext : NULL;
+#else
+    return NULL;
+#endif
+}
+
+#if ( MB_VIRTUAL_SLAVES_ENABLED > 0 ) || ( MB_DEFERRED_ENABLED > 0 ) || ( MB_STATS_TIMING_ENABLED > 0 )
+eMBErrorCode
+eMBSlaveRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs )
+{
+    eMBErrorCode    eStatus;
+#if MB_STATS_TIMING_ENABLED > 0
+    ULONG           ulStartUs = prvulMBStatsNowUs(  );
+#endif
+
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+    if( pxSlaveCur != NULL )
+    {
+        eStatus = pxSlaveCur->peRegInputCB != NULL ?
+            pxSlaveCur->peRegInputCB( pucRegBuffer, usAddress, usNRegs ) : MB_ENOREG;
+    }
+    else
+#endif
+    {
+        eStatus = eMBRegInputCB( pucRegBuffer, usAddress, usNRegs );
+    }
+#if MB_STATS_TIMING_ENABLED > 0
+    prvvMBStatsRecord( xStats.ulCallbackTime, prvulMBStatsNowUs(  ) - ulStartUs );
+#endif
+#if MB_DEFERRED_ENABLED > 0
+    if( eStatus == MB_EPENDING )
+    {
+        eStatus = prveMBDeferRequest( pucRegBuffer, ( USHORT )( 2U * usNRegs ) );
+    }
+#endif
+    return eStatus;
+}
+
+eMBErrorCode
+eMBSlaveRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs,
+                      eMBRegisterMode eMode )
+{
+    eMBErrorCode    eStatus;
+#if MB_STATS_TIMING_ENABLED > 0
+    ULONG           ulStartUs = prvulMBStatsNowUs(  );
+#endif
+
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+    if( pxSlaveCur != NULL )
+    {
+        eStatus = pxSlaveCur->peRegHoldingCB != NULL ?
+            pxSlaveCur->peRegHoldingCB( pucRegBuffer, usAddress, usNRegs, eMode ) : MB_ENOREG;
+    }
+    else
+#endif
+    {
+        eStatus = eMBRegHoldingCB( pucRegBuffer, usAddress, usNRegs, eMode );
+    }
+#if MB_STATS_TIMING_ENABLED > 0
+    prvvMBStatsRecord( xStats.ulCallbackTime, prvulMBStatsNowUs(  ) - ulStartUs );
+#endif
+#if MB_DEFERRED_ENABLED > 0
+    if( eStatus == MB_EPENDING )
+    {
+        eStatus = prveMBDeferRequest( pucRegBuffer,
+                                      eMode == MB_REG_READ ? ( USHORT )( 2U * usNRegs ) : 0 );
+#if MB_JOURNAL_ENABLED > 0
+        if( ( eStatus == MB_EPENDING ) && ( eMode == MB_REG_WRITE ) )
+        {
+            prvvMBDeferWrite( MB_JOURNAL_HOLDING, pucRegBuffer, usAddress - 1, usNRegs );
+        }
+#endif
+    }
+#endif
+    return eStatus;
+}
+
+eMBErrorCode
+eMBSlaveRegCoilsCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNCoils,
+                    eMBRegisterMode eMode )
+{
+    eMBErrorCode    eStatus;
+#if MB_STATS_TIMING_ENABLED > 0
+    ULONG           ulStartUs = prvulMBStatsNowUs(  );
+#endif
+
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+    if( pxSlaveCur != NULL )
+    {
+        eStatus = pxSlaveCur->peRegCoilsCB != NULL ?
+            pxSlaveCur->peRegCoilsCB( pucRegBuffer, usAddress, usNCoils, eMode ) : MB_ENOREG;
+    }
+    else
+#endif
+    {
+        eStatus = eMBRegCoilsCB( pucRegBuffer, usAddress, usNCoils, eMode );
+    }
+#if MB_STATS_TIMING_ENABLED > 0
+    prvvMBStatsRecord( xStats.ulCallbackTime, prvulMBStatsNowUs(  ) - ulStartUs );
+#endif
+#if MB_DEFERRED_ENABLED > 0
+    if( eStatus == MB_EPENDING )
+    {
+        eStatus = prveMBDeferRequest( pucRegBuffer,
+                                      eMode == MB_REG_READ ? ( USHORT )( ( usNCoils + 7 ) / 8 ) : 0 );
+#if MB_JOURNAL_ENABLED > 0
+        if( ( eStatus == MB_EPENDING ) && ( eMode == MB_REG_WRITE ) )
+        {
+            prvvMBDeferWrite( MB_JOURNAL_COILS, pucRegBuffer, usAddress - 1, usNCoils );
+        }
+#endif
+    }
+#endif
+    return eStatus;
+}
+
+eMBErrorCode
+eMBSlaveRegDiscreteCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNDiscrete )
+{
+    eMBErrorCode    eStatus;
+#if MB_STATS_TIMING_ENABLED > 0
+    ULONG           ulStartUs = prvulMBStatsNowUs(  );
+#endif
+
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+    if( pxSlaveCur != NULL )
+    {
+        eStatus = pxSlaveCur->peRegDiscreteCB != NULL ?
+            pxSlaveCur->peRegDiscreteCB( pucRegBuffer, usAddress, usNDiscrete ) : MB_ENOREG;
+    }
+    else
+#endif
+    {
+        eStatus = eMBRegDiscreteCB( pucRegBuffer, usAddress, usNDiscrete );
+    }
+#if MB_STATS_TIMING_ENABLED > 0
+    prvvMBStatsRecord( xStats.ulCallbackTime, prvulMBStatsNowUs(  ) - ulStartUs );
+#endif
+#if MB_DEFERRED_ENABLED > 0
+    if( eStatus == MB_EPENDING )
+    {
+        eStatus = prveMBDeferRequest( pucRegBuffer, ( USHORT )( ( usNDiscrete + 7 ) / 8 ) );
+    }
+#endif
+    return eStatus;
+}
+#endif
+
+eMBErrorCode
+eMBCompleteRequest( eMBErrorCode eStatus, const UCHAR * pucRegBuffer )
+{
+#if MB_DEFERRED_ENABLED > 0
+    eMBErrorCode    eResult = MB_ENOERR;
+    BOOL            xPending;
+
+    if( eStatus == MB_EPENDING )
+    {
+        return MB_EINVAL;
+    }
+    ENTER_CRITICAL_SECTION(  );
+    xPending = xDeferred.eState == DEFERRED_PENDING ? TRUE : FALSE;
+    /* Read the parked request only after its state. */
+    MB_PORT_BARRIER(  );
+    if( !xPending )
+    {
+        eResult = MB_EILLSTATE;
+    }
+    else if( ( eStatus == MB_ENOERR ) && ( xDeferred.usDataLen > 0 ) && ( pucRegBuffer == NULL ) )
+    {
+        eResult = MB_EINVAL;
+    }
+    else
+    {
+        xDeferred.eException = prveMBError2Exception( eStatus );
+        if( eStatus == MB_ENOERR )
+        {
+            memcpy( &xDeferred.ucBuf[MB_DEFERRED_HDR_SIZE + xDeferred.usLength], pucRegBuffer,
+                    xDeferred.usDataLen );
+            xDeferred.usLength += xDeferred.usDataLen;
+        }
+        /* Publish the response after it is complete. */
+        MB_PORT_BARRIER(  );
+        xDeferred.eState = DEFERRED_DONE;
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return eResult;
+#else
+    ( void )eStatus;
+    ( void )pucRegBuffer;
+    return MB_EILLSTATE;
+#endif
+}
+
+BOOL
+xMBRequestPending( void )
+{
+#if MB_DEFERRED_ENABLED > 0
+    return xDeferred.eState != DEFERRED_IDLE ? TRUE : FALSE;
+#else
+    return FALSE;
+#endif
+}
 
 eMBErrorCode
 eMBClose( void )
@@ -315,6 +703,10 @@ eMBDisable( void )
     {
         pvMBFrameStopCur(  );
         eMBState = STATE_DISABLED;
+#if MB_DEFERRED_ENABLED > 0
+        /* A pending request is never answered. */
+        xDeferred.eState = DEFERRED_IDLE;
+#endif
         eStatus = MB_ENOERR;
     }
     else if( eMBState == STATE_DISABLED )
@@ -328,6 +720,81 @@ eMBDisable( void )
     return eStatus;
 }
 
+eMBErrorCode
+eMBRegisterCaptureCB( pvMBCaptureCB pvCaptureCB )
+{
+    ENTER_CRITICAL_SECTION(  );
+    pvMBCaptureCur = pvCaptureCB;
+    EXIT_CRITICAL_SECTION(  );
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBGetStats( xMBStats * pxStats )
+{
+#if MB_STATS_ENABLED > 0
+    ENTER_CRITICAL_SECTION(  );
+    *pxStats = xStats;
+    pxStats->ulFrames = xMBSerCounters.ulFrames;
+    pxStats->ulChecksumErrors = xMBSerCounters.ulChecksumErrors;
+    pxStats->ulOverruns = xMBSerCounters.ulOverruns;
+    EXIT_CRITICAL_SECTION(  );
+    return MB_ENOERR;
+#else
+    ( void )pxStats;
+    return MB_EILLSTATE;
+#endif
+}
+
+eMBErrorCode
+eMBGetFuncStats( UCHAR ucFunctionCode, ULONG * pulRequests, ULONG * pulExceptions )
+{
+#if MB_STATS_ENABLED > 0
+    eMBErrorCode    eStatus = MB_ENOREG;
+    int             i = MB_FUNC_HANDLERS_MAX;
+
+    ENTER_CRITICAL_SECTION(  );
+    if( ucFunctionCode != 0 )
+    {
+        for( i = 0; i < MB_FUNC_HANDLERS_MAX; i++ )
+        {
+            if( xFuncHandlers[i].ucFunctionCode == ucFunctionCode )
+            {
+                break;
+            }
+        }
+    }
+    if( ( ucFunctionCode == 0 ) || ( i < MB_FUNC_HANDLERS_MAX ) )
+    {
+        *pulRequests = xFuncStats[i].ulRequests;
+        *pulExceptions = xFuncStats[i].ulExceptions;
+        eStatus = MB_ENOERR;
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return eStatus;
+#else
+    ( void )ucFunctionCode;
+    ( void )pulRequests;
+    ( void )pulExceptions;
+    return MB_EILLSTATE;
+#endif
+}
+
+eMBErrorCode
+eMBResetStats( void )
+{
+    ENTER_CRITICAL_SECTION(  );
+#if MB_STATS_ENABLED > 0
+    memset( &xStats, 0, sizeof( xStats ) );
+    memset( xFuncStats, 0, sizeof( xFuncStats ) );
+#endif
+    xMBSerCounters.ulFrames = 0;
+    xMBSerCounters.ulChecksumErrors = 0;
+    xMBSerCounters.ulOverruns = 0;
+    EXIT_CRITICAL_SECTION(  );
+    return MB_ENOERR;
+}
+
 eMBErrorCode
 eMBPoll( void )
 {
@@ -340,6 +807,13 @@ eMBPoll( void )
     int             i;
     eMBErrorCode    eStatus = MB_ENOERR;
     eMBEventType    eEvent;
+#if MB_STATS_ENABLED > 0
+    int             iFunc;
+#endif
+#if MB_STATS_TIMING_ENABLED > 0
+    ULONG           ulStartUs;
+    xMBFrameTimes   xTimes;
+#endif
 
     /* Check if the protocol stack is ready. */
     if( eMBState != STATE_ENABLED )
@@ -358,11 +832,42 @@ eMBPoll( void )
 
         case EV_FRAME_RECEIVED:
             eStatus = peMBFrameReceiveCur( &ucRcvAddress, &ucMBFrame, &usLength );
+            if( ( eStatus == MB_ENOERR ) && ( pvMBCaptureCur != NULL ) )
+            {
+                pvMBCaptureCur( eMBCurrentMode, FALSE, ucRcvAddress, prvusMBCaptureTID( ucMBFrame ),
+                                ucMBFrame, usLength );
+            }
             if( eStatus == MB_ENOERR )
             {
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+                /* Modbus TCP requests for other units are answered by the
+                 * default slave. */
+                if( ( eMBCurrentMode == MB_TCP ) && ( ucSlaveIndex[ucRcvAddress] == 0 ) )
+                {
+                    ucRcvAddress = ucMBAddress;
+                }
+#endif
                 /* Check if the frame is for us. If not ignore the frame. */
-                if( ( ucRcvAddress == ucMBAddress ) || ( ucRcvAddress == MB_ADDRESS_BROADCAST ) )
+                if( ( ucRcvAddress == ucMBAddress ) || ( ucRcvAddress == MB_ADDRESS_BROADCAST )
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+                    || ( ucSlaveIndex[ucRcvAddress] != 0 )
+#endif
+                    )
                 {
+#if MB_STATS_TIMING_ENABLED > 0
+                    /* The serial framers know when the frame was complete.
+                     * The time until it is fetched here is part of the
+                     * response time. */
+                    if( pvMBFrameGetTimesCur != NULL )
+                    {
+                        pvMBFrameGetTimesCur( &xTimes );
+                        ulStatsRcvUs = xTimes.ulDoneSec * 1000000UL + xTimes.ulDoneNSec / 1000UL;
+                    }
+                    else
+                    {
+                        ulStatsRcvUs = prvulMBStatsNowUs(  );
+                    }
+#endif
                     ( void )xMBPortEventPost( EV_EXECUTE );
                 }
             }
@@ -371,6 +876,25 @@ eMBPoll( void )
         case EV_EXECUTE:
             ucFunctionCode = ucMBFrame[MB_PDU_FUNC_OFF];
             eException = MB_EX_ILLEGAL_FUNCTION;
+            ucMBRequestAddr = ucRcvAddress;
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+            i = ucSlaveIndex[ucRcvAddress];
+            pxSlaveCur = ( i != 0 ) ? &xSlaves[i - 1].xCallbacks : NULL;
+#endif
+#if MB_DEFERRED_ENABLED > 0
+            pucDeferRequest = ucMBFrame;
+            ucDeferAddress = ucRcvAddress;
+#endif
+#if MB_STATS_ENABLED > 0
+            /* Count the request before the handler. The diagnostics
+             * function returns these counters. */
+            iFunc = MB_FUNC_HANDLERS_MAX;
+            xStats.ulRequests++;
+            if( ucRcvAddress == MB_ADDRESS_BROADCAST )
+            {
+                xStats.ulBroadcasts++;
+            }
+#endif
             for( i = 0; i < MB_FUNC_HANDLERS_MAX; i++ )
             {
                 /* No more function handlers registered. Abort. */
@@ -380,14 +904,41 @@ eMBPoll( void )
                 }
                 else if( xFuncHandlers[i].ucFunctionCode == ucFunctionCode )
                 {
+#if MB_STATS_TIMING_ENABLED > 0
+                    ulStartUs = prvulMBStatsNowUs(  );
                     eException = xFuncHandlers[i].pxHandler( ucMBFrame, &usLength );
+                    prvvMBStatsRecord( xStats.ulHandlerTime, prvulMBStatsNowUs(  ) - ulStartUs );
+#else
+                    eException = xFuncHandlers[i].pxHandler( ucMBFrame, &usLength );
+#endif
+#if MB_STATS_ENABLED > 0
+                    iFunc = i;
+#endif
                     break;
                 }
             }
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+            pxSlaveCur = NULL;
+#endif
+#if MB_STATS_ENABLED > 0
+            xFuncStats[iFunc].ulRequests++;
+            if( ( eException != MB_EX_NONE ) && ( eException != MB_EX_PENDING ) )
+            {
+                xStats.ulExceptions++;
+                xFuncStats[iFunc].ulExceptions++;
+            }
+#if MB_DEFERRED_ENABLED > 0
+            else if( eException == MB_EX_PENDING )
+            {
+                /* Counted when the request is completed. */
+                xDeferred.iFunc = iFunc;
+            }
+#endif
+#endif
 
             /* If the request was not sent to the broadcast address we
-             * return a reply. */
-            if( ucRcvAddress != MB_ADDRESS_BROADCAST )
+             * return a reply. A deferred request is answered later. */
+            if( ( ucRcvAddress != MB_ADDRESS_BROADCAST ) && ( eException != MB_EX_PENDING ) )
             {
                 if( eException != MB_EX_NONE )
                 {
@@ -400,13 +951,215 @@ eMBPoll( void )
                 {
                     vMBPortTimersDelay( MB_ASCII_TIMEOUT_WAIT_BEFORE_SEND_MS );
                 }                
-                eStatus = peMBFrameSendCur( ucMBAddress, ucMBFrame, usLength );
+                eStatus = peMBFrameSendCur( ucRcvAddress, ucMBFrame, usLength );
+                if( ( eStatus == MB_ENOERR ) && ( pvMBCaptureCur != NULL ) )
+                {
+                    pvMBCaptureCur( eMBCurrentMode, TRUE, ucRcvAddress, prvusMBCaptureTID( ucMBFrame ),
+                                    ucMBFrame, usLength );
+                }
+#if MB_STATS_TIMING_ENABLED > 0
+                /* The serial framers post EV_FRAME_SENT when the last
+                 * character has been sent. TCP responses are sent at once. */
+                if( eMBCurrentMode == MB_TCP )
+                {
+                    prvvMBStatsRecord( xStats.ulResponseTime, prvulMBStatsNowUs(  ) - ulStatsRcvUs );
+                }
+                else
+                {
+                    xStatsRspPending = eStatus == MB_ENOERR ? TRUE : FALSE;
+                }
+#endif
             }
             break;
 
         case EV_FRAME_SENT:
+#if MB_STATS_TIMING_ENABLED > 0
+            if( xStatsRspPending )
+            {
+                prvvMBStatsRecord( xStats.ulResponseTime, prvulMBStatsNowUs(  ) - ulStatsRcvUs );
+                xStatsRspPending = FALSE;
+            }
+#endif
             break;
         }
     }
+#if MB_DEFERRED_ENABLED > 0
+    else if( xDeferred.eState == DEFERRED_DONE )
+    {
+        /* Send a deferred response only if no frame is waiting. */
+        MB_PORT_BARRIER(  );
+        return prveMBDeferredSend(  );
+    }
+#endif
     return MB_ENOERR;
 }
+
+#if MB_DEFERRED_ENABLED > 0
+/* Park the request whose callback returned MB_EPENDING. The response of a
+ * read is the part of the frame in front of the register buffer followed
+ * by the values passed to eMBCompleteRequest( ). A write is answered with
+ * the start of the request.
+ */
+static eMBErrorCode
+prveMBDeferRequest( const UCHAR * pucRegBuffer, USHORT usDataLen )
+{
+    USHORT          usLength;
+
+    if( !MB_PORT_HAS_TCP_CONNECTION || ( eMBCurrentMode != MB_TCP ) ||
+        ( xDeferred.eState != DEFERRED_IDLE ) )
+    {
+        /* A serial master waits for the response before it sends the
+         * next request, so only Modbus TCP requests are deferred. The port
+         * must tell the client connections apart. Answered with SLAVE
+         * DEVICE BUSY. */
+        return MB_ETIMEDOUT;
+    }
+    if( usDataLen > 0 )
+    {
+        usLength = ( USHORT )( pucRegBuffer - pucDeferRequest );
+    }
+    else
+    {
+        switch ( pucDeferRequest[MB_PDU_FUNC_OFF] )
+        {
+        case MB_FUNC_WRITE_SINGLE_COIL:
+        case MB_FUNC_WRITE_MULTIPLE_COILS:
+        case MB_FUNC_WRITE_REGISTER:
+        case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+            usLength = MB_DEFERRED_WRITE_RSP_SIZE;
+            break;
+        default:
+            /* The write of a read/write request must complete before
+             * the read. */
+            return MB_EIO;
+        }
+    }
+    memcpy( xDeferred.ucBuf, pucDeferRequest - MB_DEFERRED_HDR_SIZE, MB_DEFERRED_HDR_SIZE );
+    memcpy( &xDeferred.ucBuf[MB_DEFERRED_HDR_SIZE], pucDeferRequest, usLength );
+    xDeferred.ucAddress = ucDeferAddress;
+    xDeferred.usLength = usLength;
+    xDeferred.usDataLen = usDataLen;
+#if MB_PORT_HAS_TCP_CONNECTION > 0
+    xDeferred.ulConnection = ulMBTCPPortGetConnection(  );
+#endif
+#if MB_JOURNAL_ENABLED > 0
+    xDeferred.usWriteCount = 0;
+#endif
+    MB_PORT_BARRIER(  );
+    xDeferred.eState = DEFERRED_PENDING;
+    return MB_EPENDING;
+}
+
+#if MB_JOURNAL_ENABLED > 0
+/* Keep the values of a parked write behind the response. They are
+ * journaled once the application has completed the request. */
+static void
+prvvMBDeferWrite( eMBJournalTable eTable, const UCHAR * pucRegBuffer, USHORT usAddress,
+                  USHORT usCount )
+{
+    USHORT          usBytes;
+
+    if( eTable == MB_JOURNAL_HOLDING )
+    {
+        usBytes = ( USHORT )( 2U * usCount );
+    }
+    else
+    {
+        usBytes = ( USHORT )( ( usCount + 7U ) / 8U );
+    }
+    memcpy( &xDeferred.ucBuf[MB_DEFERRED_HDR_SIZE + xDeferred.usLength], pucRegBuffer, usBytes );
+    xDeferred.eWriteTable = eTable;
+    xDeferred.usWriteAddress = usAddress;
+    xDeferred.usWriteCount = usCount;
+}
+#endif
+
+/* Send the response of a completed request. If the framer fails the
+ * response is dropped and the master has to repeat the request. */
+static eMBErrorCode
+prveMBDeferredSend( void )
+{
+    UCHAR          *pucFrame = &xDeferred.ucBuf[MB_DEFERRED_HDR_SIZE];
+    USHORT          usLength = xDeferred.usLength;
+    eMBErrorCode    eStatus = MB_ENOERR;
+    BOOL            xSend = xDeferred.ucAddress != MB_ADDRESS_BROADCAST ? TRUE : FALSE;
+
+#if MB_JOURNAL_ENABLED > 0
+    /* Recorded here and not in eMBCompleteRequest( ) because the journal
+     * has a single producer, the thread calling eMBPoll( ). */
+    if( ( xDeferred.eException == MB_EX_NONE ) && ( xDeferred.usWriteCount > 0 ) )
+    {
+        vMBJournalAdd( xDeferred.ucAddress, xDeferred.eWriteTable, pucFrame[MB_PDU_FUNC_OFF],
+                       xDeferred.usWriteAddress, xDeferred.usWriteCount, &pucFrame[usLength] );
+    }
+#endif
+    if( xDeferred.eException != MB_EX_NONE )
+    {
+        pucFrame[MB_PDU_FUNC_OFF] |= MB_FUNC_ERROR;
+        pucFrame[MB_PDU_DATA_OFF] = xDeferred.eException;
+        usLength = 2;
+#if MB_STATS_ENABLED > 0
+        xStats.ulExceptions++;
+        xFuncStats[xDeferred.iFunc].ulExceptions++;
+#endif
+    }
+#if MB_PORT_HAS_TCP_CONNECTION > 0
+    if( ulMBTCPPortGetConnection(  ) != xDeferred.ulConnection )
+    {
+        /* The client which sent the request is gone. */
+        xSend = FALSE;
+    }
+#endif
+    if( xSend )
+    {
+        eStatus = peMBFrameSendCur( xDeferred.ucAddress, pucFrame, usLength );
+        if( ( eStatus == MB_ENOERR ) && ( pvMBCaptureCur != NULL ) )
+        {
+            pvMBCaptureCur( eMBCurrentMode, TRUE, xDeferred.ucAddress, prvusMBCaptureTID( pucFrame ),
+                            pucFrame, usLength );
+        }
+    }
+    xDeferred.eState = DEFERRED_IDLE;
+    return eStatus;
+}
+#endif
+
+/* Transaction identifier of a frame for the capture callback. */
+static USHORT
+prvusMBCaptureTID( const UCHAR * pucFrame )
+{
+#if MB_TCP_ENABLED > 0
+    if( eMBCurrentMode == MB_TCP )
+    {
+        return usMBTCPGetTID( pucFrame );
+    }
+#endif
+    ( void )pucFrame;
+    return 0;
+}
+
+#if MB_STATS_TIMING_ENABLED > 0
+static ULONG
+prvulMBStatsNowUs( void )
+{
+    ULONG           ulSec;
+    ULONG           ulNSec;
+
+    vMBPortTimersGetTimestamp( &ulSec, &ulNSec );
+    return ulSec * 1000000UL + ulNSec / 1000UL;
+}
+
+/* Count a duration in the bucket of its most significant bit. */
+static void
+prvvMBStatsRecord( ULONG * pulHistogram, ULONG ulTimeUs )
+{
+    int             iBucket = 0;
+
+    while( ( ulTimeUs != 0 ) && ( iBucket < MB_STATS_BUCKETS - 1 ) )
+    {
+        ulTimeUs >>= 1;
+        iBucket++;
+    }
+    pulHistogram[iBucket]++;
+}
+#endif
@@ -118,7 +118,8 @@ typedef enum
     MB_ENORES,                  /*!< insufficient resources. */
     MB_EIO,                     /*!< I/O error. */
     MB_EILLSTATE,               /*!< protocol stack in illegal state. */
-    MB_ETIMEDOUT                /*!< timeout error occurred. */
+    MB_ETIMEDOUT,               /*!< timeout error occurred. */
+    MB_EPENDING                 /*!< request completed by eMBCompleteRequest( ). */
 } eMBErrorCode;
 
 
@@ -215,8 +216,9 @@ eMBErrorCode    eMBDisable( void );
  * transmitter state machines. 
  *
  * \return If the protocol stack is not in the enabled state the function
- *   returns eMBErrorCode::MB_EILLSTATE. Otherwise it returns 
- *   eMBErrorCode::MB_ENOERR.
+ *   returns eMBErrorCode::MB_EILLSTATE. If the response of a request
+ *   completed with eMBCompleteRequest( ) could not be sent it returns the
+ *   error of the framer. Otherwise it returns eMBErrorCode::MB_ENOERR.
  */
 eMBErrorCode    eMBPoll( void );
 
@@ -265,6 +267,171 @@ eMBErrorCode    eMBSetSlaveID( UCHAR ucSlaveID, BOOL xIsRunning,
 eMBErrorCode    eMBRegisterCB( UCHAR ucFunctionCode, 
                                pxMBFunctionHandler pxHandler );
 
+/*! \ingroup modbus
+ * \brief Register callbacks of a slave registered with eMBRegisterSlave( ).
+ *
+ * The callbacks have the same semantics as eMBRegInputCB( ),
+ * eMBRegHoldingCB( ), eMBRegCoilsCB( ) and eMBRegDiscreteCB( ). A \c NULL
+ * callback answers all requests for this table with an <b>ILLEGAL DATA
+ * ADDRESS</b> exception. The same callbacks can serve several slaves
+ * which are told apart by \c pvContext.
+ */
+typedef struct
+{
+    eMBErrorCode( *peRegInputCB ) ( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs );
+    eMBErrorCode( *peRegHoldingCB ) ( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs,
+                                      eMBRegisterMode eMode );
+    eMBErrorCode( *peRegCoilsCB ) ( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNCoils,
+                                    eMBRegisterMode eMode );
+    eMBErrorCode( *peRegDiscreteCB ) ( UCHAR * pucRegBuffer, USHORT usAddress,
+                                       USHORT usNDiscrete );
+    void           *pvContext;  /*!< Returned by pvMBSlaveContext( ). */
+} xMBSlaveCallbacks;
+
+/*! \ingroup modbus
+ * \brief Answer requests for another slave address.
+ *
+ * Requests for \c ucSlaveAddress are executed by the same function
+ * handlers as requests for the address passed to eMBInit( ) but use the
+ * register callbacks in \c pxCallbacks, which are copied. In Modbus TCP
+ * the unit identifier selects the slave and requests for other units are
+ * answered by the default callbacks. Broadcasts are only executed by the
+ * default callbacks. It is only available if MB_VIRTUAL_SLAVES_ENABLED is
+ * set.
+ *
+ * \param ucSlaveAddress The slave address or unit identifier. Registering
+ *   an address again replaces its callbacks.
+ * \param pxCallbacks The register callbacks or \c NULL to remove the slave.
+ *
+ * \return eMBErrorCode::MB_ENOERR if the slave has been registered or
+ *   removed. eMBErrorCode::MB_EINVAL if the address is the broadcast
+ *   address, above MB_ADDRESS_MAX or the address passed to eMBInit( ).
+ *   eMBErrorCode::MB_ENORES if MB_VIRTUAL_SLAVES_MAX slaves are registered.
+ */
+eMBErrorCode    eMBRegisterSlave( UCHAR ucSlaveAddress, const xMBSlaveCallbacks * pxCallbacks );
+
+/*! \ingroup modbus
+ * \brief Return the slave address of the request which is executed.
+ *
+ * It may only be called from the register callbacks and function
+ * handlers. In Modbus TCP mode it is the unit identifier of the request.
+ */
+UCHAR           ucMBRequestAddress( void );
+
+/*! \ingroup modbus
+ * \brief Return the context of the slave whose request is executed.
+ *
+ * It may only be called from the register callbacks and function
+ * handlers. It returns \c NULL for the address passed to eMBInit( ).
+ */
+void           *pvMBSlaveContext( void );
+
+/*! \ingroup modbus
+ * \brief Complete a request whose register callback returned
+ *   eMBErrorCode::MB_EPENDING.
+ *
+ * The response is sent by the next call of eMBPoll( ). In the meantime
+ * eMBPoll( ) continues to execute other requests. It is only available if
+ * MB_DEFERRED_ENABLED is set.
+ *
+ * \param eStatus The result of the callback. Any error code except
+ *   eMBErrorCode::MB_EPENDING is converted into an exception as if the
+ *   callback had returned it.
+ * \param pucRegBuffer The values of a read request in the format of the
+ *   callback buffer. They are copied. Ignored for write requests and if
+ *   \c eStatus is not eMBErrorCode::MB_ENOERR.
+ *
+ * \return eMBErrorCode::MB_ENOERR if the request has been completed.
+ *   eMBErrorCode::MB_EILLSTATE if no request is pending and
+ *   eMBErrorCode::MB_EINVAL if an argument is not valid.
+ */
+eMBErrorCode    eMBCompleteRequest( eMBErrorCode eStatus, const UCHAR * pucRegBuffer );
+
+/*! \ingroup modbus
+ * \brief Return TRUE while a deferred request has not been answered.
+ *
+ * Only one request can be deferred at a time. If a callback returns
+ * eMBErrorCode::MB_EPENDING while another request is pending the request
+ * is answered with a <b>SLAVE DEVICE BUSY</b> exception. A callback should
+ * check this function before it starts a deferred operation.
+ */
+BOOL            xMBRequestPending( void );
+
+/*! \ingroup modbus
+ * \brief Callback which receives a copy of every frame.
+ *
+ * It is called from eMBPoll( ) for every frame received by the protocol
+ * stack and for every frame which has been passed to the transmitter.
+ * \c pucPDU points to the Modbus PDU and is only valid during the call.
+ * The address is the slave address, the unit identifier or
+ * MB_TCP_PSEUDO_ADDRESS if the unit identifier is not known. \c usTID is
+ * the transaction identifier of the MBAP header of a Modbus TCP frame and
+ * 0 for serial frames.
+ */
+typedef void    ( *pvMBCaptureCB ) ( eMBMode eMode, BOOL xSent, UCHAR ucAddress, USHORT usTID,
+                                     const UCHAR * pucPDU, USHORT usLength );
+
+/*! \ingroup modbus
+ * \brief Install a callback for capturing frames, e.g. into a file.
+ *
+ * \param pvCaptureCB The capture callback or \c NULL to stop capturing.
+ */
+eMBErrorCode    eMBRegisterCaptureCB( pvMBCaptureCB pvCaptureCB );
+
+/*! \ingroup modbus
+ * \brief Number of buckets of the timing histograms.
+ *
+ * Bucket 0 counts durations below 1us and bucket n durations from 2^(n-1)us
+ * up to 2^n us. The last bucket also counts all longer durations.
+ */
+#define MB_STATS_BUCKETS        ( 24 )
+
+/*! \ingroup modbus
+ * \brief Statistics of the slave protocol stack.
+ *
+ * The framer counters are only maintained in RTU and ASCII mode. The
+ * histograms are only recorded if MB_STATS_TIMING_ENABLED is set. In RTU
+ * and ASCII mode the response time starts when the framer has detected
+ * the end of the request, in Modbus TCP mode when eMBPoll( ) fetches it.
+ * The handler time includes the register callbacks.
+ */
+typedef struct
+{
+    ULONG           ulFrames;           /*!< Frames detected including bad ones. */
+    ULONG           ulChecksumErrors;   /*!< Frames with a CRC or LRC error. */
+    ULONG           ulOverruns;         /*!< Frames which were too long or lost. */
+    ULONG           ulRequests;         /*!< Requests for this slave. */
+    ULONG           ulBroadcasts;       /*!< Broadcast requests. */
+    ULONG           ulExceptions;       /*!< Requests answered with an exception. */
+    ULONG           ulResponseTime[MB_STATS_BUCKETS];   /*!< Request received to response sent. */
+    ULONG           ulHandlerTime[MB_STATS_BUCKETS];    /*!< Execution time of the function handlers. */
+    ULONG           ulCallbackTime[MB_STATS_BUCKETS];   /*!< Execution time of the register callbacks. */
+} xMBStats;
+
+/*! \ingroup modbus
+ * \brief Return a snapshot of the statistics.
+ *
+ * \return eMBErrorCode::MB_EILLSTATE if statistics are disabled.
+ */
+eMBErrorCode    eMBGetStats( xMBStats * pxStats );
+
+/*! \ingroup modbus
+ * \brief Return the number of requests and exceptions of a function code.
+ *
+ * The counters of a function code are cleared when its handler is
+ * registered or removed. Function code 0 returns the counters of all
+ * function codes without a handler.
+ *
+ * \return eMBErrorCode::MB_ENOREG if the function code has no handler.
+ */
+eMBErrorCode    eMBGetFuncStats( UCHAR ucFunctionCode, ULONG * pulRequests,
+                                 ULONG * pulExceptions );
+
+/*! \ingroup modbus
+ * \brief Clear all statistics including the counters of the framer.
+ */
+eMBErrorCode    eMBResetStats( void );
+
 /* ----------------------- Callback -----------------------------------------*/
 
 /*! \defgroup modbus_registers Modbus Registers
@@ -308,6 +475,9 @@ eMBErrorCode    eMBRegisterCB( UCHAR ucFunctionCode,
  *       exception is sent as a response.
  *   - eMBErrorCode::MB_EIO If an unrecoverable error occurred. In this case
  *       a <b>SLAVE DEVICE FAILURE</b> exception is sent as a response.
+ *   - eMBErrorCode::MB_EPENDING If the request is completed later with
+ *       eMBCompleteRequest( ). Only if MB_DEFERRED_ENABLED is set and
+ *       the stack runs in Modbus TCP mode.
  */
 eMBErrorCode    eMBRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress,
                                USHORT usNRegs );
@@ -343,6 +513,9 @@ eMBErrorCode    eMBRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress,
  *       exception is sent as a response.
  *   - eMBErrorCode::MB_EIO If an unrecoverable error occurred. In this case
  *       a <b>SLAVE DEVICE FAILURE</b> exception is sent as a response.
+ *   - eMBErrorCode::MB_EPENDING If the request is completed later with
+ *       eMBCompleteRequest( ). Only if MB_DEFERRED_ENABLED is set and
+ *       the stack runs in Modbus TCP mode.
  */
 eMBErrorCode    eMBRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress,
                                  USHORT usNRegs, eMBRegisterMode eMode );
@@ -378,6 +551,9 @@ eMBErrorCode    eMBRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress,
  *       exception is sent as a response.
  *   - eMBErrorCode::MB_EIO If an unrecoverable error occurred. In this case
  *       a <b>SLAVE DEVICE FAILURE</b> exception is sent as a response.
+ *   - eMBErrorCode::MB_EPENDING If the request is completed later with
+ *       eMBCompleteRequest( ). Only if MB_DEFERRED_ENABLED is set and
+ *       the stack runs in Modbus TCP mode.
  */
 eMBErrorCode    eMBRegCoilsCB( UCHAR * pucRegBuffer, USHORT usAddress,
                                USHORT usNCoils, eMBRegisterMode eMode );
@@ -407,6 +583,9 @@ eMBErrorCode    eMBRegCoilsCB( UCHAR * pucRegBuffer, USHORT usAddress,
  *       exception is sent as a response.
  *   - eMBErrorCode::MB_EIO If an unrecoverable error occurred. In this case
  *       a <b>SLAVE DEVICE FAILURE</b> exception is sent as a response.
+ *   - eMBErrorCode::MB_EPENDING If the request is completed later with
+ *       eMBCompleteRequest( ). Only if MB_DEFERRED_ENABLED is set and
+ *       the stack runs in Modbus TCP mode.
  */
 eMBErrorCode    eMBRegDiscreteCB( UCHAR * pucRegBuffer, USHORT usAddress,
                                   USHORT usNDiscrete );
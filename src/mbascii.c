@@ -38,8 +38,8 @@
 /* ----------------------- Modbus includes ----------------------------------*/
 #include "mb.h"
 #include "mbconfig.h"
-#include "mbascii.h"
 #include "mbframe.h"
+#include "mbascii.h"
 
 #include "mbcrc.h"
 #include "mbport.h"
@@ -54,6 +54,13 @@
 #define MB_SER_PDU_SIZE_LRC     1       /*!< Size of LRC field in PDU. */
 #define MB_SER_PDU_ADDR_OFF     0       /*!< Offset of slave address in Ser-PDU. */
 #define MB_SER_PDU_PDU_OFF      1       /*!< Offset of Modbus-PDU in Ser-PDU. */
+#define MB_SER_BUF_NONE         2       /*!< No receive buffer. */
+#if MB_SER_DOUBLE_BUFFER_ENABLED > 0
+#define MB_SER_RCV_BUFS         2       /*!< Number of receive buffers. */
+#else
+#define MB_SER_RCV_BUFS         1
+#define ucRTUSndBuf             ( ucRTURcvBuf[0] )
+#endif
 
 /* ----------------------- Type definitions ---------------------------------*/
 typedef enum
@@ -85,16 +92,27 @@ static UCHAR    prvucMBBIN2CHAR( UCHAR ucByte );
 
 static UCHAR    prvucMBLRC( UCHAR * pucFrame, USHORT usLen );
 
+static void     prvvMBASCIIFrameDone( void );
+
 /* ----------------------- Static variables ---------------------------------*/
 static volatile eMBSndState eSndState;
 static volatile eMBRcvState eRcvState;
 
-/* We reuse the Modbus RTU buffer because only one buffer is needed and the
- * RTU buffer is bigger. */
-extern volatile UCHAR ucRTUBuf[];
-static volatile UCHAR *ucASCIIBuf = ucRTUBuf;
+/* We reuse the Modbus RTU buffers because only one framer is active. They
+ * are used in the same way as in RTU. */
+extern volatile UCHAR ucRTURcvBuf[MB_SER_RCV_BUFS][MB_SER_PDU_SIZE_MAX];
+#if MB_SER_DOUBLE_BUFFER_ENABLED > 0
+extern volatile UCHAR ucRTUSndBuf[MB_SER_PDU_SIZE_MAX];
+#endif
+#if MB_SER_TIMES_ENABLED > 0
+extern volatile xMBFrameTimes xRTURcvTimes[MB_SER_RCV_BUFS];
+#endif
 
 static volatile USHORT usRcvBufferPos;
+static volatile UCHAR ucRcvBufCur;      /*!< Buffer filled by the receiver. */
+static volatile UCHAR ucRcvBufDone = MB_SER_BUF_NONE;   /*!< Last complete frame. */
+static volatile UCHAR ucRcvBufUser = MB_SER_BUF_NONE;   /*!< Returned by eMBASCIIReceive( ). */
+static volatile USHORT usRcvFrameLength;        /*!< Length of the last complete frame. */
 static volatile eMBBytePos eBytePos;
 
 static volatile UCHAR *pucSndBufferCur;
@@ -148,42 +166,87 @@ eMBASCIIStop( void )
     EXIT_CRITICAL_SECTION(  );
 }
 
+/* Return the send buffer. A frame built there is not copied by
+ * eMBASCIISend( ). */
 void
 vMBASCIIGetBuffer( UCHAR ** ppucFrame ) {
-  *ppucFrame = ( UCHAR * ) & ucASCIIBuf[MB_SER_PDU_PDU_OFF];
+  *ppucFrame = ( UCHAR * ) & ucRTUSndBuf[MB_SER_PDU_PDU_OFF];
 }
 
 eMBErrorCode
 eMBASCIIReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame, USHORT * pusLength )
 {
     eMBErrorCode    eStatus = MB_ENOERR;
+    volatile UCHAR *pucRcvBuf;
 
     ENTER_CRITICAL_SECTION(  );
-    assert( usRcvBufferPos < MB_SER_PDU_SIZE_MAX );
+    assert( usRcvFrameLength < MB_SER_PDU_SIZE_MAX );
 
-    /* Length and CRC check */
-    if( ( usRcvBufferPos >= MB_SER_PDU_SIZE_MIN )
-        && ( prvucMBLRC( ( UCHAR * ) ucASCIIBuf, usRcvBufferPos ) == 0 ) )
+    if( ucRcvBufDone == MB_SER_BUF_NONE )
     {
-        /* Save the address field. All frames are passed to the upper layed
-         * and the decision if a frame is used is done there.
-         */
-        *pucRcvAddress = ucASCIIBuf[MB_SER_PDU_ADDR_OFF];
+        /* The frame has already been overwritten by the next one. */
+        ucRcvBufUser = MB_SER_BUF_NONE;
+        eStatus = MB_EIO;
+    }
+    else
+    {
+        /* The caller owns the buffer until the next call. The buffer of
+         * the previous frame can be used by the receiver again. */
+        ucRcvBufUser = ucRcvBufDone;
+        ucRcvBufDone = MB_SER_BUF_NONE;
+        if( ucRcvBufCur == ucRcvBufUser )
+        {
+            ucRcvBufCur = ( UCHAR )( ( ucRcvBufUser + 1 ) % MB_SER_RCV_BUFS );
+        }
+        pucRcvBuf = ucRTURcvBuf[ucRcvBufUser];
 
-        /* Total length of Modbus-PDU is Modbus-Serial-Line-PDU minus
-         * size of address field and CRC checksum.
-         */
-        *pusLength = ( USHORT )( usRcvBufferPos - MB_SER_PDU_PDU_OFF - MB_SER_PDU_SIZE_LRC );
+        /* Length and CRC check */
+        if( ( usRcvFrameLength >= MB_SER_PDU_SIZE_MIN )
+            && ( prvucMBLRC( ( UCHAR * ) pucRcvBuf, usRcvFrameLength ) == 0 ) )
+        {
+            /* Save the address field. All frames are passed to the upper layed
+             * and the decision if a frame is used is done there.
+             */
+            *pucRcvAddress = pucRcvBuf[MB_SER_PDU_ADDR_OFF];
+
+            /* Total length of Modbus-PDU is Modbus-Serial-Line-PDU minus
+             * size of address field and CRC checksum.
+             */
+            *pusLength = ( USHORT )( usRcvFrameLength - MB_SER_PDU_PDU_OFF - MB_SER_PDU_SIZE_LRC );
+
+            /* Return the start of the Modbus PDU to the caller. */
+            *pucFrame = ( UCHAR * ) & pucRcvBuf[MB_SER_PDU_PDU_OFF];
+        }
+        else
+        {
+            xMBSerCounters.ulChecksumErrors++;
+            eStatus = MB_EIO;
+        }
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return eStatus;
+}
 
-        /* Return the start of the Modbus PDU to the caller. */
-        *pucFrame = ( UCHAR * ) & ucASCIIBuf[MB_SER_PDU_PDU_OFF];
+/* Return the times of the frame returned by the last call of
+ * eMBASCIIReceive( ). They are zero if the frame has been lost. */
+void
+vMBASCIIGetTimes( xMBFrameTimes * pxTimes )
+{
+    ENTER_CRITICAL_SECTION(  );
+#if MB_SER_TIMES_ENABLED > 0
+    if( ucRcvBufUser != MB_SER_BUF_NONE )
+    {
+        *pxTimes = xRTURcvTimes[ucRcvBufUser];
     }
     else
+#endif
     {
-        eStatus = MB_EIO;
+        pxTimes->ulStartSec = 0;
+        pxTimes->ulStartNSec = 0;
+        pxTimes->ulDoneSec = 0;
+        pxTimes->ulDoneNSec = 0;
     }
     EXIT_CRITICAL_SECTION(  );
-    return eStatus;
 }
 
 eMBErrorCode
@@ -200,16 +263,21 @@ eMBASCIISend( UCHAR ucSlaveAddress, const UCHAR * pucFrame, USHORT usLength )
     if( eRcvState == STATE_RX_IDLE )
     {
         /* First byte before the Modbus-PDU is the slave address. */
-        pucSndBufferCur = ( UCHAR * ) pucFrame - 1;
+        pucSndBufferCur = ucRTUSndBuf;
         usSndBufferCount = 1;
 
-        /* Now copy the Modbus-PDU into the Modbus-Serial-Line-PDU. */
+        /* Now copy the Modbus-PDU into the Modbus-Serial-Line-PDU. A
+         * response is usually built in the receive buffer. */
         pucSndBufferCur[MB_SER_PDU_ADDR_OFF] = ucSlaveAddress;
+        if( pucFrame != &ucRTUSndBuf[MB_SER_PDU_PDU_OFF] )
+        {
+            memcpy( ( UCHAR * ) &ucRTUSndBuf[MB_SER_PDU_PDU_OFF], pucFrame, usLength );
+        }
         usSndBufferCount += usLength;
 
         /* Calculate LRC checksum for Modbus-Serial-Line-PDU. */
         usLRC = prvucMBLRC( ( UCHAR * ) pucSndBufferCur, usSndBufferCount );
-        ucASCIIBuf[usSndBufferCount++] = usLRC;
+        ucRTUSndBuf[usSndBufferCount++] = usLRC;
 
         /* Activate the transmitter. */
         eSndState = STATE_TX_START;
@@ -263,7 +331,7 @@ xMBASCIIReceiveFSM( void )
             case BYTE_HIGH_NIBBLE:
                 if( usRcvBufferPos < MB_SER_PDU_SIZE_MAX )
                 {
-                    ucASCIIBuf[usRcvBufferPos] = ( UCHAR )( ucResult << 4 );
+                    ucRTURcvBuf[ucRcvBufCur][usRcvBufferPos] = ( UCHAR )( ucResult << 4 );
                     eBytePos = BYTE_LOW_NIBBLE;
                     break;
                 }
@@ -271,6 +339,8 @@ xMBASCIIReceiveFSM( void )
                 {
                     /* not handled in Modbus specification but seems
                      * a resonable implementation. */
+                    xMBSerCounters.ulFrames++;
+                    xMBSerCounters.ulOverruns++;
                     eRcvState = STATE_RX_IDLE;
                     /* Disable previously activated timer because of error state. */
                     vMBPortTimersDisable(  );
@@ -278,7 +348,7 @@ xMBASCIIReceiveFSM( void )
                 break;
 
             case BYTE_LOW_NIBBLE:
-                ucASCIIBuf[usRcvBufferPos] |= ucResult;
+                ucRTURcvBuf[ucRcvBufCur][usRcvBufferPos] |= ucResult;
                 usRcvBufferPos++;
                 eBytePos = BYTE_HIGH_NIBBLE;
                 break;
@@ -293,6 +363,7 @@ xMBASCIIReceiveFSM( void )
              * received. */
             vMBPortTimersDisable(  );
             /* Receiver is again in idle state. */
+            prvvMBASCIIFrameDone(  );
             eRcvState = STATE_RX_IDLE;
 
             /* Notify the caller of eMBASCIIReceive that a new frame
@@ -312,6 +383,7 @@ xMBASCIIReceiveFSM( void )
         else
         {
             /* Frame is not okay. Delete entire frame. */
+            xMBSerCounters.ulFrames++;
             eRcvState = STATE_RX_IDLE;
         }
         break;
@@ -322,6 +394,17 @@ xMBASCIIReceiveFSM( void )
             /* Enable timer for character timeout. */
             vMBPortTimersEnable(  );
             /* Reset the input buffers to store the frame. */
+            if( ucRcvBufDone == ucRcvBufCur )
+            {
+                /* The receiver has to reuse the buffer of the last frame.
+                 * It has not been fetched and is lost. */
+                ucRcvBufDone = MB_SER_BUF_NONE;
+                xMBSerCounters.ulOverruns++;
+            }
+#if MB_SER_TIMES_ENABLED > 0
+            vMBPortTimersGetTimestamp( ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulStartSec,
+                                       ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulStartNSec );
+#endif
             usRcvBufferPos = 0;;
             eBytePos = BYTE_HIGH_NIBBLE;
             eRcvState = STATE_RX_RCV;
@@ -488,4 +571,29 @@ prvucMBLRC( UCHAR * pucFrame, USHORT usLen )
     return ucLRC;
 }
 
+/* A frame has been received completely. Continue with the other buffer
+ * unless the protocol stack still uses it. If the last frame has not been
+ * fetched yet it is dropped in favour of the new one. */
+static void
+prvvMBASCIIFrameDone( void )
+{
+    UCHAR           ucRcvBufNext = ( UCHAR )( ( ucRcvBufCur + 1 ) % MB_SER_RCV_BUFS );
+
+    xMBSerCounters.ulFrames++;
+    if( ucRcvBufDone != MB_SER_BUF_NONE )
+    {
+        xMBSerCounters.ulOverruns++;
+    }
+#if MB_SER_TIMES_ENABLED > 0
+    vMBPortTimersGetTimestamp( ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulDoneSec,
+                               ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulDoneNSec );
+#endif
+    usRcvFrameLength = usRcvBufferPos;
+    ucRcvBufDone = ucRcvBufCur;
+    if( ucRcvBufUser != ucRcvBufNext )
+    {
+        ucRcvBufCur = ucRcvBufNext;
+    }
+}
+
 #endif
@@ -44,6 +44,7 @@ void            vMBASCIIGetBuffer( UCHAR ** ppucFrame );
 
 eMBErrorCode    eMBASCIIReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame,
                                  USHORT * pusLength );
+void            vMBASCIIGetTimes( xMBFrameTimes * pxTimes );
 eMBErrorCode    eMBASCIISend( UCHAR slaveAddress, const UCHAR * pucFrame,
                               USHORT usLength );
 BOOL            xMBASCIIReceiveFSM( void );
@@ -76,6 +76,247 @@ PR_BEGIN_EXTERN_C
 #define MB_ASCII_TIMEOUT_WAIT_BEFORE_SEND_MS    (  0 )
 #endif
 
+/*! \brief If Modbus RTU frames should be completed by their expected length.
+ *
+ * Normally the end of a RTU frame is detected after 3.5 character times of
+ * silence. If enabled the receiver computes the length of the frame from
+ * the function code and the byte count. As soon as this number of bytes
+ * has been received and the CRC is valid the frame is passed to the
+ * protocol stack without waiting for t3.5. This works for requests (slave)
+ * and responses (master) of the functions 1 to 6, 15, 16 and 23 and for
+ * exception responses. Other frames still end after t3.5.
+ */
+#define MB_RTU_EARLY_EOF_ENABLED                (  0 )
+
+/*! \brief If the Modbus RTU receiver should check the t1.5 character gap.
+ *
+ * A frame with a silence of more than 1.5 character times between two
+ * characters is invalid and is discarded. The check requires the function
+ * usMBPortTimersGetElapsed( ) from the porting layer and a port which
+ * calls the receive callback for every character when it arrives. The
+ * Linux ports provide the function but read characters in blocks. They
+ * only detect gaps between blocks.
+ */
+#define MB_RTU_T15_ENABLED                      (  0 )
+
+/*! \brief If the RTU and ASCII framers should double buffer received frames.
+ *
+ * If enabled received frames are stored alternately in two buffers and
+ * frames are sent from a third one. The receiver can continue with the
+ * next frame while the protocol stack still works on the last one, which
+ * helps the bus monitor and the master. This costs two additional buffers
+ * of 256 bytes. Otherwise a single buffer is used for receiving and
+ * sending and a frame which arrives before the last one has been handled
+ * overwrites it.
+ */
+#define MB_SER_DOUBLE_BUFFER_ENABLED            (  0 )
+
+/*! \brief Maximum number of Modbus TCP servers a master can talk to.
+ *
+ * Every server (IP address and port) the master sends requests to needs
+ * one connection. Several unit identifiers can share a connection, e.g.
+ * when they are located behind the same gateway.
+ */
+#define MB_TCP_MASTER_CONNECTIONS_MAX           (  4 )
+
+/*! \brief Number of requests a Modbus TCP master keeps in flight on one
+ *    connection.
+ *
+ * Requests are sent without waiting for the responses of the previous
+ * requests as long as less than this number of requests are outstanding.
+ * Responses are matched by the MBAP transaction identifier and can arrive
+ * in any order.
+ */
+#define MB_TCP_MASTER_PIPELINE_DEPTH            (  8 )
+
+/*! \brief Time in milliseconds a Modbus TCP master waits for a response.
+ *
+ * If no response has been received within this time the transaction is
+ * dropped and its slot is available for a new request. Requests queued
+ * with eMBSubmit( ) use the response timeout of their slave instead and
+ * release the slot as soon as they time out or are sent again.
+ */
+#define MB_TCP_MASTER_TIMEOUT_MS                ( 1000 )
+
+/*! \brief Time in milliseconds a serial master waits for a response. */
+#define MB_MASTER_RESPONSE_TIMEOUT_MS           ( 1000 )
+
+/*! \brief Number of requests which can be submitted to the master at the
+ *    same time.
+ *
+ * Every request submitted with eMBSubmit( ) occupies an entry until its
+ * completion callback has been called. An entry holds the encoded request
+ * PDU, i.e. it needs about MB_PDU_SIZE_MAX bytes of memory.
+ */
+#define MB_MASTER_REQUESTS_MAX                  ( 16 )
+
+/*! \brief Lower bound of the adaptive response timeout in milliseconds.
+ *
+ * The master measures the round trip time of every slave and waits for a
+ * response for the smoothed round trip time plus four times its variation.
+ * The timeout never exceeds MB_MASTER_RESPONSE_TIMEOUT_MS (serial) or
+ * MB_TCP_MASTER_TIMEOUT_MS (TCP) which is also used until the first
+ * response of a slave has been received.
+ */
+#define MB_MASTER_RTO_MIN_MS                    ( 50 )
+
+/*! \brief Number of times a request is repeated if the slave does not
+ *    answer.
+ *
+ * Writes are not repeated in Modbus TCP mode because later requests may
+ * already have been sent.
+ */
+#define MB_MASTER_RETRIES_MAX                   (  2 )
+
+/*! \brief Time in milliseconds before an offline slave is probed again.
+ *
+ * If a request has not been answered after all retries the slave is
+ * considered offline. Further requests to it fail immediately except for
+ * a single probe request after this time. Every failed probe doubles the
+ * time up to MB_MASTER_PROBE_MAX_MS.
+ */
+#define MB_MASTER_PROBE_MIN_MS                  ( 1000 )
+
+/*! \brief Maximum time in milliseconds between two probes of an offline
+ *    slave.
+ */
+#define MB_MASTER_PROBE_MAX_MS                  ( 30000 )
+
+/*! \brief If the cyclic scan engine of the master should be enabled. */
+#define MB_MASTER_SCAN_ENABLED                  (  1 )
+
+/*! \brief Maximum number of blocks in the scan list of the master. */
+#define MB_MASTER_SCAN_MAX                      ( 16 )
+
+/*! \brief Size of the local image of the scan engine.
+ *
+ * Every register or coil of a block in the scan list occupies one entry
+ * of the image.
+ */
+#define MB_MASTER_SCAN_IMAGE_SIZE               ( 512 )
+
+/*! \brief If the read planner of the master should be enabled. */
+#define MB_MASTER_PLAN_ENABLED                  (  1 )
+
+/*! \brief Maximum number of read plans. */
+#define MB_MASTER_PLANS_MAX                     (  4 )
+
+/*! \brief Maximum number of tags in a read plan. */
+#define MB_MASTER_PLAN_TAGS_MAX                 ( 64 )
+
+/*! \brief Maximum number of read requests a plan is split into. */
+#define MB_MASTER_PLAN_READS_MAX                ( 16 )
+
+/*! \brief Number of address ranges the planner can remember as forbidden.
+ *
+ * If a slave answers a merged read with an illegal data address exception
+ * the unused addresses between the tags of this read are remembered and
+ * not read again.
+ */
+#define MB_MASTER_PLAN_FORBIDDEN_MAX            ( 16 )
+
+/*! \brief If the write combining buffer of the master should be enabled. */
+#define MB_MASTER_WC_ENABLED                    (  1 )
+
+/*! \brief Maximum number of buffered writes. */
+#define MB_MASTER_WC_WRITES_MAX                 ( 64 )
+
+/*! \brief Time in milliseconds a write waits for further writes.
+ *
+ * Buffered writes of a slave are sent when the oldest of them has waited
+ * this long. If set to 0 writes are only sent by eMBWriteFlush( ).
+ */
+#define MB_MASTER_WC_WINDOW_MS                  ( 10 )
+
+/*! \brief If the bus monitor should be enabled. */
+#define MB_MONITOR_ENABLED                      (  1 )
+
+/*! \brief Size of the buffer in bytes which holds the frames recorded by
+ *    the bus monitor.
+ *
+ * Every frame needs MB_MONITOR_HEADER_SIZE bytes plus the size of the
+ * address and the PDU. Must be a power of two.
+ */
+#define MB_MONITOR_BUFFER_SIZE                  ( 8192 )
+
+/*! \brief If the slave should count requests and exceptions per function. */
+#define MB_STATS_ENABLED                        (  1 )
+
+/*! \brief If the slave should record the histograms of the response,
+ *    handler and callback times.
+ *
+ * The porting layer must implement vMBPortTimersGetTimestamp( ). It is
+ * only used if MB_STATS_ENABLED is set.
+ */
+#define MB_STATS_TIMING_ENABLED                 (  0 )
+
+/*! \brief If the register store should be enabled.
+ *
+ * The store implements the register callbacks of the slave. The
+ * application must not define them if it is enabled.
+ */
+#define MB_REGSTORE_ENABLED                     (  0 )
+
+/*! \brief A page of the register store holds 2^MB_REGSTORE_PAGE_SHIFT
+ *    registers or 16 times as many bits.
+ */
+#define MB_REGSTORE_PAGE_SHIFT                  (  5 )
+
+/*! \brief Number of pages of the register store. */
+#define MB_REGSTORE_PAGES_MAX                   ( 32 )
+
+/*! \brief Number of page tables of the register store.
+ *
+ * A page table maps 64 consecutive pages of a table.
+ */
+#define MB_REGSTORE_MAPS_MAX                    (  8 )
+
+/*! \brief Maximum number of address ranges of the register store. */
+#define MB_REGSTORE_BANKS_MAX                   (  8 )
+
+/*! \brief If the register store should publish updates with a sequence
+ *    counter.
+ *
+ * Writers are always serialized with ENTER_CRITICAL_SECTION( ). If enabled
+ * readers never block. A reader copies the values and retries if a writer
+ * was active in the meantime, so every read of the store is a consistent
+ * snapshot. Disable it if the store is only accessed from a single thread.
+ */
+#define MB_REGSTORE_SEQLOCK_ENABLED             (  1 )
+
+/*! \brief If writes to holding registers and coils should be recorded in
+ *    a journal.
+ *
+ * The porting layer must implement vMBPortTimersGetTimestamp( ).
+ */
+#define MB_JOURNAL_ENABLED                      (  0 )
+
+/*! \brief Number of entries of the journal. Must be a power of two. */
+#define MB_JOURNAL_ENTRIES                      ( 16 )
+
+/*! \brief If the slave should answer more than one address.
+ *
+ * Additional slaves are registered with eMBRegisterSlave( ). Each one has
+ * its own register callbacks and shares the function handlers with the
+ * address passed to eMBInit( ).
+ */
+#define MB_VIRTUAL_SLAVES_ENABLED               (  0 )
+
+/*! \brief Maximum number of slaves registered with eMBRegisterSlave( ). */
+#define MB_VIRTUAL_SLAVES_MAX                   (  8 )
+
+/*! \brief If register callbacks may complete a request later.
+ *
+ * A callback returns eMBErrorCode::MB_EPENDING and the application calls
+ * eMBCompleteRequest( ) when the values are available. Only one request
+ * can be outstanding. Serial masters wait for each response, so in RTU
+ * and ASCII mode the request is answered with SLAVE DEVICE BUSY instead.
+ * The same applies to Modbus TCP ports which do not define
+ * MB_PORT_HAS_TCP_CONNECTION, because a late response could reach a
+ * different client.
+ */
+#define MB_DEFERRED_ENABLED                     (  0 )
+
 /*! \brief Maximum number of Modbus functions codes the protocol stack
  *    should support.
  *
@@ -125,6 +366,13 @@ PR_BEGIN_EXTERN_C
 /*! \brief If the <em>Read/Write Multiple Registers</em> function should be enabled. */
 #define MB_FUNC_READWRITE_HOLDING_ENABLED       (  1 )
 
+/*! \brief If the <em>Diagnostics</em> function should be enabled.
+ *
+ * The counters of the slave are only available if MB_STATS_ENABLED is set.
+ * Otherwise only the bus counters of the serial framers are returned.
+ */
+#define MB_FUNC_DIAG_ENABLED                    (  1 )
+
 /*! @} */
 #ifdef __cplusplus
     PR_END_EXTERN_C
@@ -66,6 +66,36 @@ PR_BEGIN_EXTERN_C
 #define MB_PDU_FUNC_OFF     0   /*!< Offset of function code in PDU. */
 #define MB_PDU_DATA_OFF     1   /*!< Offset for response data in PDU. */
 
+/* The serial framers record when a frame was received if the bus monitor
+ * or the response time statistics of the slave need it. */
+#if ( MB_MONITOR_ENABLED > 0 ) || ( MB_STATS_TIMING_ENABLED > 0 )
+#define MB_SER_TIMES_ENABLED    1
+#else
+#define MB_SER_TIMES_ENABLED    0
+#endif
+
+/* ----------------------- Type definitions ---------------------------------*/
+
+/*! \brief Counters maintained by the serial framers. */
+typedef struct
+{
+    ULONG           ulFrames;           /*!< Frames detected including bad ones. */
+    ULONG           ulChecksumErrors;   /*!< Frames with a CRC or LRC error. */
+    ULONG           ulOverruns;         /*!< Frames which were too long or lost. */
+} xMBFrameCounters;
+
+/*! \brief Counters of the active serial framer. Updated by the receivers. */
+extern volatile xMBFrameCounters xMBSerCounters;
+
+/*! \brief Times of a frame received by a serial framer. */
+typedef struct
+{
+    ULONG           ulStartSec;         /*!< First character of the frame. */
+    ULONG           ulStartNSec;
+    ULONG           ulDoneSec;          /*!< End of the frame was detected. */
+    ULONG           ulDoneNSec;
+} xMBFrameTimes;
+
 /* ----------------------- Prototypes  0-------------------------------------*/
 typedef void    ( *pvMBFrameStart ) ( void );
 
@@ -83,6 +113,8 @@ typedef void    ( *pvMBFrameClose ) ( void );
 
 typedef void    ( *pvMBFrameGetBuffer ) ( UCHAR ** ppucFrame );
 
+typedef void    ( *pvMBFrameGetTimes ) ( xMBFrameTimes * pxTimes );
+
 #ifdef __cplusplus
 PR_END_EXTERN_C
 #endif
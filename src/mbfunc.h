@@ -34,6 +34,30 @@
 #ifdef __cplusplus
 PR_BEGIN_EXTERN_C
 #endif
+/* The function handlers call the register callbacks through these macros.
+ * With virtual slaves they are dispatched to the slave of the request.
+ * With deferred requests a pending request is parked. The statistics
+ * record the execution time of the callbacks. */
+#if ( MB_VIRTUAL_SLAVES_ENABLED > 0 ) || ( MB_DEFERRED_ENABLED > 0 ) || ( MB_STATS_TIMING_ENABLED > 0 )
+eMBErrorCode    eMBSlaveRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs );
+eMBErrorCode    eMBSlaveRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs,
+                                      eMBRegisterMode eMode );
+eMBErrorCode    eMBSlaveRegCoilsCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNCoils,
+                                    eMBRegisterMode eMode );
+eMBErrorCode    eMBSlaveRegDiscreteCB( UCHAR * pucRegBuffer, USHORT usAddress,
+                                       USHORT usNDiscrete );
+
+#define MB_REG_INPUT_CB         eMBSlaveRegInputCB
+#define MB_REG_HOLDING_CB       eMBSlaveRegHoldingCB
+#define MB_REG_COILS_CB         eMBSlaveRegCoilsCB
+#define MB_REG_DISCRETE_CB      eMBSlaveRegDiscreteCB
+#else
+#define MB_REG_INPUT_CB         eMBRegInputCB
+#define MB_REG_HOLDING_CB       eMBRegHoldingCB
+#define MB_REG_COILS_CB         eMBRegCoilsCB
+#define MB_REG_DISCRETE_CB      eMBRegDiscreteCB
+#endif
+
 #if MB_FUNC_OTHER_REP_SLAVEID_BUF > 0
     eMBException eMBFuncReportSlaveID( UCHAR * pucFrame, USHORT * usLen );
 #endif
@@ -74,6 +98,10 @@ eMBException    eMBFuncReadDiscreteInputs( UCHAR * pucFrame, USHORT * usLen );
 eMBException    eMBFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen );
 #endif
 
+#if MB_FUNC_DIAG_ENABLED > 0
+eMBException    eMBFuncDiagnostic( UCHAR * pucFrame, USHORT * usLen );
+#endif
+
 #ifdef __cplusplus
 PR_END_EXTERN_C
 #endif
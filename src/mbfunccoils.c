@@ -40,6 +40,8 @@
 #include "mbframe.h"
 #include "mbproto.h"
 #include "mbconfig.h"
+#include "mbfunc.h"
+#include "mbjournal.h"
 
 /* ----------------------- Defines ------------------------------------------*/
 #define MB_PDU_FUNC_READ_ADDR_OFF           ( MB_PDU_DATA_OFF )
@@ -113,8 +115,8 @@ eMBFuncReadCoils( UCHAR * pucFrame, USHORT * usLen )
             *usLen += 1;
 
             eRegStatus =
-                eMBRegCoilsCB( pucFrameCur, usRegAddress, usCoilCount,
-                               MB_REG_READ );
+                MB_REG_COILS_CB( pucFrameCur, usRegAddress, usCoilCount,
+                                 MB_REG_READ );
 
             /* If an error occured convert it into a Modbus exception. */
             if( eRegStatus != MB_ENOERR )
@@ -173,13 +175,21 @@ eMBFuncWriteCoil( UCHAR * pucFrame, USHORT * usLen )
                 ucBuf[0] = 0;
             }
             eRegStatus =
-                eMBRegCoilsCB( &ucBuf[0], usRegAddress, 1, MB_REG_WRITE );
+                MB_REG_COILS_CB( &ucBuf[0], usRegAddress, 1, MB_REG_WRITE );
 
             /* If an error occured convert it into a Modbus exception. */
             if( eRegStatus != MB_ENOERR )
             {
                 eStatus = prveMBError2Exception( eRegStatus );
             }
+#if MB_JOURNAL_ENABLED > 0
+            else
+            {
+                vMBJournalAdd( ucMBRequestAddress(  ), MB_JOURNAL_COILS,
+                               MB_FUNC_WRITE_SINGLE_COIL, ( USHORT )( usRegAddress - 1 ), 1,
+                               &ucBuf[0] );
+            }
+#endif
         }
         else
         {
@@ -235,8 +245,8 @@ eMBFuncWriteMultipleCoils( UCHAR * pucFrame, USHORT * usLen )
             ( ucByteCountVerify == ucByteCount ) )
         {
             eRegStatus =
-                eMBRegCoilsCB( &pucFrame[MB_PDU_FUNC_WRITE_MUL_VALUES_OFF],
-                               usRegAddress, usCoilCnt, MB_REG_WRITE );
+                MB_REG_COILS_CB( &pucFrame[MB_PDU_FUNC_WRITE_MUL_VALUES_OFF],
+                                 usRegAddress, usCoilCnt, MB_REG_WRITE );
 
             /* If an error occured convert it into a Modbus exception. */
             if( eRegStatus != MB_ENOERR )
@@ -245,6 +255,11 @@ eMBFuncWriteMultipleCoils( UCHAR * pucFrame, USHORT * usLen )
             }
             else
             {
+#if MB_JOURNAL_ENABLED > 0
+                vMBJournalAdd( ucMBRequestAddress(  ), MB_JOURNAL_COILS,
+                               MB_FUNC_WRITE_MULTIPLE_COILS, ( USHORT )( usRegAddress - 1 ), usCoilCnt,
+                               &pucFrame[MB_PDU_FUNC_WRITE_MUL_VALUES_OFF] );
+#endif
                 /* The response contains the function code, the starting address
                  * and the quantity of registers. We reuse the old values in the 
                  * buffer because they are still valid. */
@@ -27,3 +27,142 @@
  *
  * File: $Id: mbfuncdiag.c,v 1.3 2006/12/07 22:10:34 wolti Exp $
  */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb.h"
+#include "mbframe.h"
+#include "mbproto.h"
+#include "mbconfig.h"
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_PDU_FUNC_DIAG_SUBFUNC_OFF            ( MB_PDU_DATA_OFF + 0 )
+#define MB_PDU_FUNC_DIAG_DATA_OFF               ( MB_PDU_DATA_OFF + 2 )
+#define MB_PDU_FUNC_DIAG_SIZE                   ( 4 )
+
+/* Diagnostic sub-function codes. */
+#define MB_DIAG_RETURN_QUERY_DATA               ( 0x00 )
+#define MB_DIAG_RETURN_DIAG_REGISTER            ( 0x02 )
+#define MB_DIAG_CLEAR_COUNTERS                  ( 0x0A )
+#define MB_DIAG_BUS_MESSAGE_COUNT               ( 0x0B )
+#define MB_DIAG_BUS_COMM_ERROR_COUNT            ( 0x0C )
+#define MB_DIAG_BUS_EXCEPTION_COUNT             ( 0x0D )
+#define MB_DIAG_SLAVE_MESSAGE_COUNT             ( 0x0E )
+#define MB_DIAG_SLAVE_NO_RESPONSE_COUNT         ( 0x0F )
+#define MB_DIAG_SLAVE_NAK_COUNT                 ( 0x10 )
+#define MB_DIAG_SLAVE_BUSY_COUNT                ( 0x11 )
+#define MB_DIAG_BUS_CHAR_OVERRUN_COUNT          ( 0x12 )
+#define MB_DIAG_CLEAR_OVERRUN_COUNTER           ( 0x14 )
+
+/* ----------------------- Start implementation -----------------------------*/
+
+#if MB_FUNC_DIAG_ENABLED > 0
+
+eMBException
+eMBFuncDiagnostic( UCHAR * pucFrame, USHORT * usLen )
+{
+    USHORT          usSubFunction;
+    USHORT          usData;
+    ULONG           ulCount = 0;
+    xMBStats        xStats;
+    eMBException    eStatus = MB_EX_NONE;
+
+    if( *usLen < ( MB_PDU_FUNC_DIAG_SIZE + MB_PDU_SIZE_MIN ) )
+    {
+        /* Can't be a valid request because the length is incorrect. */
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    usSubFunction = ( USHORT )( pucFrame[MB_PDU_FUNC_DIAG_SUBFUNC_OFF] << 8 );
+    usSubFunction |= ( USHORT )( pucFrame[MB_PDU_FUNC_DIAG_SUBFUNC_OFF + 1] );
+
+    /* Return query data echoes the request. Its data field can have any
+     * length. */
+    if( usSubFunction == MB_DIAG_RETURN_QUERY_DATA )
+    {
+        return MB_EX_NONE;
+    }
+
+    /* All other sub-functions have a single data field of zero. */
+    usData = ( USHORT )( pucFrame[MB_PDU_FUNC_DIAG_DATA_OFF] << 8 );
+    usData |= ( USHORT )( pucFrame[MB_PDU_FUNC_DIAG_DATA_OFF + 1] );
+    if( ( *usLen != ( MB_PDU_FUNC_DIAG_SIZE + MB_PDU_SIZE_MIN ) ) || ( usData != 0 ) )
+    {
+        return MB_EX_ILLEGAL_DATA_VALUE;
+    }
+
+    /* The counters of the protocol stack read as zero if statistics are
+     * disabled. The framer counters are always maintained. */
+    if( eMBGetStats( &xStats ) != MB_ENOERR )
+    {
+        memset( &xStats, 0, sizeof( xStats ) );
+        xStats.ulFrames = xMBSerCounters.ulFrames;
+        xStats.ulChecksumErrors = xMBSerCounters.ulChecksumErrors;
+        xStats.ulOverruns = xMBSerCounters.ulOverruns;
+    }
+
+    switch ( usSubFunction )
+    {
+    case MB_DIAG_RETURN_DIAG_REGISTER:
+    case MB_DIAG_SLAVE_NAK_COUNT:
+    case MB_DIAG_SLAVE_BUSY_COUNT:
+        /* Not supported by this implementation. Always zero. */
+        break;
+
+    case MB_DIAG_CLEAR_COUNTERS:
+        ( void )eMBResetStats(  );
+        break;
+
+    case MB_DIAG_CLEAR_OVERRUN_COUNTER:
+        ENTER_CRITICAL_SECTION(  );
+        xMBSerCounters.ulOverruns = 0;
+        EXIT_CRITICAL_SECTION(  );
+        break;
+
+    case MB_DIAG_BUS_MESSAGE_COUNT:
+        ulCount = xStats.ulFrames;
+        break;
+
+    case MB_DIAG_BUS_COMM_ERROR_COUNT:
+        ulCount = xStats.ulChecksumErrors;
+        break;
+
+    case MB_DIAG_BUS_EXCEPTION_COUNT:
+        ulCount = xStats.ulExceptions;
+        break;
+
+    case MB_DIAG_SLAVE_MESSAGE_COUNT:
+        ulCount = xStats.ulRequests;
+        break;
+
+    case MB_DIAG_SLAVE_NO_RESPONSE_COUNT:
+        /* Broadcasts are the only requests which are not answered. */
+        ulCount = xStats.ulBroadcasts;
+        break;
+
+    case MB_DIAG_BUS_CHAR_OVERRUN_COUNT:
+        ulCount = xStats.ulOverruns;
+        break;
+
+    default:
+        eStatus = MB_EX_ILLEGAL_FUNCTION;
+        break;
+    }
+
+    if( eStatus == MB_EX_NONE )
+    {
+        /* The counters are 16 bit values which wrap around. The response
+         * echoes the sub-function code. */
+        pucFrame[MB_PDU_FUNC_DIAG_DATA_OFF] = ( UCHAR )( ( ulCount >> 8 ) & 0xFF );
+        pucFrame[MB_PDU_FUNC_DIAG_DATA_OFF + 1] = ( UCHAR )( ulCount & 0xFF );
+    }
+    return eStatus;
+}
+
+#endif
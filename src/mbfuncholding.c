@@ -40,6 +40,8 @@
 #include "mbframe.h"
 #include "mbproto.h"
 #include "mbconfig.h"
+#include "mbfunc.h"
+#include "mbjournal.h"
 
 /* ----------------------- Defines ------------------------------------------*/
 #define MB_PDU_FUNC_READ_ADDR_OFF               ( MB_PDU_DATA_OFF + 0)
@@ -87,14 +89,22 @@ eMBFuncWriteHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
         usRegAddress++;
 
         /* Make callback to update the value. */
-        eRegStatus = eMBRegHoldingCB( &pucFrame[MB_PDU_FUNC_WRITE_VALUE_OFF],
-                                      usRegAddress, 1, MB_REG_WRITE );
+        eRegStatus = MB_REG_HOLDING_CB( &pucFrame[MB_PDU_FUNC_WRITE_VALUE_OFF],
+                                        usRegAddress, 1, MB_REG_WRITE );
 
         /* If an error occured convert it into a Modbus exception. */
         if( eRegStatus != MB_ENOERR )
         {
             eStatus = prveMBError2Exception( eRegStatus );
         }
+#if MB_JOURNAL_ENABLED > 0
+        else
+        {
+            vMBJournalAdd( ucMBRequestAddress(  ), MB_JOURNAL_HOLDING, MB_FUNC_WRITE_REGISTER,
+                           ( USHORT )( usRegAddress - 1 ), 1,
+                           &pucFrame[MB_PDU_FUNC_WRITE_VALUE_OFF] );
+        }
+#endif
     }
     else
     {
@@ -133,8 +143,8 @@ eMBFuncWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
         {
             /* Make callback to update the register values. */
             eRegStatus =
-                eMBRegHoldingCB( &pucFrame[MB_PDU_FUNC_WRITE_MUL_VALUES_OFF],
-                                 usRegAddress, usRegCount, MB_REG_WRITE );
+                MB_REG_HOLDING_CB( &pucFrame[MB_PDU_FUNC_WRITE_MUL_VALUES_OFF],
+                                   usRegAddress, usRegCount, MB_REG_WRITE );
 
             /* If an error occured convert it into a Modbus exception. */
             if( eRegStatus != MB_ENOERR )
@@ -143,6 +153,12 @@ eMBFuncWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
             }
             else
             {
+#if MB_JOURNAL_ENABLED > 0
+                vMBJournalAdd( ucMBRequestAddress(  ), MB_JOURNAL_HOLDING,
+                               MB_FUNC_WRITE_MULTIPLE_REGISTERS,
+                               ( USHORT )( usRegAddress - 1 ), usRegCount,
+                               &pucFrame[MB_PDU_FUNC_WRITE_MUL_VALUES_OFF] );
+#endif
                 /* The response contains the function code, the starting
                  * address and the quantity of registers. We reuse the
                  * old values in the buffer because they are still valid.
@@ -203,7 +219,7 @@ eMBFuncReadHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
             *usLen += 1;
 
             /* Make callback to fill the buffer. */
-            eRegStatus = eMBRegHoldingCB( pucFrameCur, usRegAddress, usRegCount, MB_REG_READ );
+            eRegStatus = MB_REG_HOLDING_CB( pucFrameCur, usRegAddress, usRegCount, MB_REG_READ );
             /* If an error occured convert it into a Modbus exception. */
             if( eRegStatus != MB_ENOERR )
             {
@@ -267,11 +283,17 @@ eMBFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
             ( ( 2 * usRegWriteCount ) == ucRegWriteByteCount ) )
         {
             /* Make callback to update the register values. */
-            eRegStatus = eMBRegHoldingCB( &pucFrame[MB_PDU_FUNC_READWRITE_WRITE_VALUES_OFF],
-                                          usRegWriteAddress, usRegWriteCount, MB_REG_WRITE );
+            eRegStatus = MB_REG_HOLDING_CB( &pucFrame[MB_PDU_FUNC_READWRITE_WRITE_VALUES_OFF],
+                                            usRegWriteAddress, usRegWriteCount, MB_REG_WRITE );
 
             if( eRegStatus == MB_ENOERR )
             {
+#if MB_JOURNAL_ENABLED > 0
+                vMBJournalAdd( ucMBRequestAddress(  ), MB_JOURNAL_HOLDING,
+                               MB_FUNC_READWRITE_MULTIPLE_REGISTERS,
+                               ( USHORT )( usRegWriteAddress - 1 ), usRegWriteCount,
+                               &pucFrame[MB_PDU_FUNC_READWRITE_WRITE_VALUES_OFF] );
+#endif
                 /* Set the current PDU data pointer to the beginning. */
                 pucFrameCur = &pucFrame[MB_PDU_FUNC_OFF];
                 *usLen = MB_PDU_FUNC_OFF;
@@ -286,7 +308,7 @@ eMBFuncReadWriteMultipleHoldingRegister( UCHAR * pucFrame, USHORT * usLen )
 
                 /* Make the read callback. */
                 eRegStatus =
-                    eMBRegHoldingCB( pucFrameCur, usRegReadAddress, usRegReadCount, MB_REG_READ );
+                    MB_REG_HOLDING_CB( pucFrameCur, usRegReadAddress, usRegReadCount, MB_REG_READ );
                 if( eRegStatus == MB_ENOERR )
                 {
                     *usLen += 2 * usRegReadCount;
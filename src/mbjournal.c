@@ -0,0 +1,127 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb.h"
+#include "mbconfig.h"
+#include "mbport.h"
+#include "mbjournal.h"
+
+#if MB_JOURNAL_ENABLED > 0
+
+#ifndef MB_PORT_BARRIER
+#error "The port must define MB_PORT_BARRIER( ) in port.h"
+#endif
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_JOURNAL_MASK         ( MB_JOURNAL_ENTRIES - 1 )
+
+/* ----------------------- Static variables ---------------------------------*/
+
+/* The producer only writes ulJournalHead and the consumer only writes
+ * ulJournalTail. Both are free running and the difference is the number
+ * of entries in the journal.
+ */
+static xMBJournalEntry xJournal[MB_JOURNAL_ENTRIES];
+static volatile ULONG ulJournalHead;
+static volatile ULONG ulJournalTail;
+static volatile ULONG ulJournalDropped;
+
+/* ----------------------- Start implementation -----------------------------*/
+void
+vMBJournalAdd( UCHAR ucSlaveAddress, eMBJournalTable eTable, UCHAR ucFunctionCode,
+               USHORT usAddress, USHORT usCount, const UCHAR * pucValues )
+{
+    xMBJournalEntry *pxEntry;
+    ULONG           ulHead = ulJournalHead;
+    USHORT          usBytes;
+
+    if( eTable == MB_JOURNAL_HOLDING )
+    {
+        usBytes = ( USHORT )( 2U * usCount );
+    }
+    else
+    {
+        usBytes = ( USHORT )( ( usCount + 7U ) / 8U );
+    }
+    if( ( ulHead - ulJournalTail >= MB_JOURNAL_ENTRIES ) || ( usBytes > MB_JOURNAL_VALUES_MAX ) )
+    {
+        ulJournalDropped++;
+        return;
+    }
+
+    pxEntry = &xJournal[ulHead & MB_JOURNAL_MASK];
+    vMBPortTimersGetTimestamp( &pxEntry->ulSec, &pxEntry->ulNSec );
+    pxEntry->usAddress = usAddress;
+    pxEntry->usCount = usCount;
+    pxEntry->ucAddress = ucSlaveAddress;
+    pxEntry->ucTable = ( UCHAR )eTable;
+    pxEntry->ucFunctionCode = ucFunctionCode;
+    memcpy( pxEntry->ucValues, pucValues, usBytes );
+
+    /* Publish the entry after it is complete. */
+    MB_PORT_BARRIER(  );
+    ulJournalHead = ulHead + 1;
+}
+
+USHORT
+usMBJournalRead( xMBJournalEntry * pxEntries, USHORT usMax )
+{
+    ULONG           ulHead = ulJournalHead;
+    ULONG           ulTail = ulJournalTail;
+    USHORT          usEntries;
+
+    /* Read the entries only after the head which published them. */
+    MB_PORT_BARRIER(  );
+    for( usEntries = 0; ( usEntries < usMax ) && ( ulTail != ulHead ); usEntries++, ulTail++ )
+    {
+        pxEntries[usEntries] = xJournal[ulTail & MB_JOURNAL_MASK];
+    }
+
+    /* Free the slots after they were copied. */
+    MB_PORT_BARRIER(  );
+    ulJournalTail = ulTail;
+    return usEntries;
+}
+
+ULONG
+ulMBJournalDropped( void )
+{
+    return ulJournalDropped;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+#ifndef _MB_JOURNAL_H
+#define _MB_JOURNAL_H
+
+#ifdef __cplusplus
+PR_BEGIN_EXTERN_C
+#endif
+/*! \defgroup modbus_journal Write Journal
+ * \code #include "mbjournal.h" \endcode
+ *
+ * An optional journal of all writes to holding registers and coils which
+ * were accepted by the register callbacks. It is enabled with
+ * MB_JOURNAL_ENABLED. The functions of the slave append an entry after
+ * the callback returned without an error and the application consumes
+ * the entries with usMBJournalRead( ) from another thread. A write which
+ * was completed with eMBCompleteRequest( ) is appended when eMBPoll( )
+ * sends its response.
+ *
+ * The journal is a ring buffer with a single producer, the thread calling
+ * eMBPoll( ), and a single consumer. Neither side takes a lock. If the
+ * journal is full new entries are dropped and counted. The slave never
+ * waits for the consumer.
+ *
+ * \code
+ * xMBJournalEntry xEntries[8];
+ * USHORT          usEntries;
+ *
+ * while( ( usEntries = usMBJournalRead( xEntries, 8 ) ) > 0 )
+ * {
+ *     vApplyChanges( xEntries, usEntries );
+ * }
+ * \endcode
+ */
+/*! \addtogroup modbus_journal
+ *  @{
+ */
+/* ----------------------- Defines ------------------------------------------*/
+
+/*! \brief Size of the largest value field of a write request. */
+#define MB_JOURNAL_VALUES_MAX   ( 246 )
+
+/* ----------------------- Type definitions ---------------------------------*/
+
+/*! \brief The tables recorded in the journal. */
+typedef enum
+{
+    MB_JOURNAL_HOLDING,         /*!< Holding registers. */
+    MB_JOURNAL_COILS            /*!< Coils. */
+} eMBJournalTable;
+
+/*! \brief An entry of the journal. */
+typedef struct
+{
+    ULONG           ulSec;      /*!< Timestamp of the write. */
+    ULONG           ulNSec;     /*!< Nanoseconds of the timestamp. */
+    USHORT          usAddress;  /*!< First protocol address starting at 0. */
+    USHORT          usCount;    /*!< Number of registers or coils. */
+    UCHAR           ucAddress;  /*!< Slave address or unit identifier of the request. */
+    UCHAR           ucTable;    /*!< One of eMBJournalTable. */
+    UCHAR           ucFunctionCode;     /*!< Function code of the request. */
+
+    /*! The values in the format of the PDU. Registers are stored high byte
+     * first and coils are packed with the first coil in the LSB of the
+     * first byte. */
+    UCHAR           ucValues[MB_JOURNAL_VALUES_MAX];
+} xMBJournalEntry;
+
+/* ----------------------- Function prototypes ------------------------------*/
+
+/*! \brief Append a write to the journal.
+ *
+ * This function is called by the functions of the slave and must not be
+ * called by the application.
+ */
+void            vMBJournalAdd( UCHAR ucSlaveAddress, eMBJournalTable eTable,
+                               UCHAR ucFunctionCode, USHORT usAddress, USHORT usCount,
+                               const UCHAR * pucValues );
+
+/*! \brief Remove up to usMax of the oldest entries from the journal.
+ *
+ * \return The number of entries copied to pxEntries. Zero if the journal
+ *   is empty.
+ */
+USHORT          usMBJournalRead( xMBJournalEntry * pxEntries, USHORT usMax );
+
+/*! \brief Return the number of entries dropped because the journal was
+ *   full. */
+ULONG           ulMBJournalDropped( void );
+
+/*! @} */
+
+#ifdef __cplusplus
+PR_END_EXTERN_C
+#endif
+#endif
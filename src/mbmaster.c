@@ -41,6 +41,7 @@
 #include "mbframe.h"
 #include "mbproto.h"
 #include "mbmasterfunc.h"
+#include "mbutils.h"
 
 #include "mbport.h"
 #if MB_RTU_ENABLED == 1
@@ -50,13 +51,70 @@
 #include "mbascii.h"
 #endif
 #if MB_TCP_ENABLED == 1
-#include "mbtcp.h"
+#include "mbmastertcp.h"
 #endif
+#include "mbmasterscan.h"
+#include "mbmasterwrite.h"
 
 #ifndef MB_PORT_HAS_CLOSE
 #define MB_PORT_HAS_CLOSE 0
 #endif
 
+#define MB_REQUEST_NONE         ( MB_MASTER_REQUESTS_MAX )
+
+/* ----------------------- Type definitions ---------------------------------*/
+
+/* A request submitted with eMBSubmit( ). The PDU is encoded when the
+ * request is submitted and copied into the frame buffer when it is sent.
+ */
+typedef struct
+{
+    enum
+    {
+        REQ_FREE,               /*!< Entry is not used. */
+        REQ_QUEUED,             /*!< Waiting for transmission. */
+        REQ_SENT                /*!< Waiting for the response. */
+    } eState;
+    UCHAR           ucGeneration;       /*!< Makes handles of reused entries unique. */
+    ULONG           ulSequence; /*!< Submission order. */
+    eMBPriority     ePriority;
+    BOOL            xDeadline;  /*!< If the request must be sent before ulDeadlineMs. */
+    ULONG           ulDeadlineMs;
+    BOOL            xSkipped;   /*!< Connection had no room in this transmission pass. */
+    UCHAR           ucId;
+    UCHAR           ucFunctionCode;
+    USHORT          usStartAddr;
+    USHORT          usLen;
+    ULONG           ulSubmitMs;
+    ULONG           ulSentMs;
+    UCHAR           ucRetries;  /*!< Number of times the request has been repeated. */
+    BOOL            xProbe;     /*!< Sent to check if an offline slave is back. */
+    pxMBRequestCallback pxCallback;
+    void           *pvArg;
+    USHORT          usPDULength;
+    UCHAR           aucPDU[MB_PDU_SIZE_MAX];
+} xMBRequest;
+
+/* Round trip time estimation and link state of a slave. The smoothed round
+ * trip time and its variation are scaled by 8 and 4 like in RFC 6298. A
+ * response timeout of 0 means that the slave has not answered yet.
+ */
+typedef struct
+{
+    BOOL            xMeasured;  /*!< At least one round trip time sample. */
+    ULONG           ulSRTT8;
+    ULONG           ulRTTVar4;
+    ULONG           ulRTOMs;
+    BOOL            xRTOBackedOff;      /*!< Backed off since the last sample. */
+    ULONG           ulRTOBackedOffMs;   /*!< Time of the last back off. */
+    BOOL            xOffline;
+    BOOL            xProbing;   /*!< A probe request has been sent. */
+    ULONG           ulProbeMs;  /*!< Time of the next probe. */
+    ULONG           ulBackoffMs;        /*!< Time between two probes. */
+    ULONG           ulTimeouts;
+    ULONG           ulRetries;
+} xMBSlaveLink;
+
 /* ----------------------- Static variables ---------------------------------*/
 
 static UCHAR    ucMBAddress;
@@ -90,6 +148,8 @@ BOOL( *pxMBPortCBTimerExpired ) ( void );
 BOOL( *pxMBFrameCBReceiveFSMCur ) ( void );
 BOOL( *pxMBFrameCBTransmitFSMCur ) ( void );
 
+static pvMBCaptureCB pvMBCaptureCur;
+
 /* An array of Modbus functions handlers which associates Modbus function
  * codes with implementing functions.
  */
@@ -126,6 +186,35 @@ static xMBFunctionHandler xFuncHandlers[MB_FUNC_HANDLERS_MAX] = {
 #endif
 };
 
+static xMBRequest xMBRequests[MB_MASTER_REQUESTS_MAX];
+static ULONG    ulMBRequestSequence;
+
+/* The request which is currently active on a serial line. */
+static USHORT   usMBRequestCur = MB_REQUEST_NONE;
+
+/* Value of ulMBServeCount when a request to a slave has been sent last. */
+static ULONG    ulMBSlaveServed[256];
+static ULONG    ulMBServeCount;
+
+static xMBSchedStats xMBPrioStats[MB_PRIO_CLASSES];
+
+static xMBSlaveLink xMBSlaves[256];
+
+/* ----------------------- Static functions ---------------------------------*/
+static eMBErrorCode prveMBFrameSend( UCHAR ucId, const UCHAR * pucFrame, USHORT usLength );
+static void     prvvMBRequestsTransmit( void );
+static xMBRequest *prvpxMBRequestsSelect( void );
+static BOOL     prvxMBRequestIsWrite( UCHAR ucFunctionCode );
+static void     prvvMBRequestsCheckTimeout( void );
+static xMBRequest *prvpxMBRequestMatch( UCHAR ucRcvAddress );
+static BOOL     prvxMBLegacyResponse( UCHAR ucRcvAddress );
+static USHORT   prvusMBCaptureTID( const UCHAR * pucFrame );
+static ULONG    prvulMBSlaveTimeout( const xMBSlaveLink * pxSlave );
+static BOOL     prvxMBSlaveBlocked( const xMBSlaveLink * pxSlave, ULONG ulNowMs );
+static void     prvvMBSlaveSample( xMBSlaveLink * pxSlave, ULONG ulRTTMs );
+static void     prvvMBRequestComplete( xMBRequest * pxRequest, eMBErrorCode eStatus,
+                                       const UCHAR * pucFrame, USHORT usLength );
+
 /* ----------------------- Start implementation -----------------------------*/
 eMBErrorCode
 eMBInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity )
@@ -192,7 +281,7 @@ eMBTCPInit( USHORT ucTCPPort )
 {
     eMBErrorCode    eStatus = MB_ENOERR;
 
-    if( ( eStatus = eMBTCPDoInit( ucTCPPort ) ) != MB_ENOERR )
+    if( ( eStatus = eMBMasterTCPDoInit( ucTCPPort ) ) != MB_ENOERR )
     {
         eMBState = STATE_DISABLED;
     }
@@ -203,12 +292,13 @@ eMBTCPInit( USHORT ucTCPPort )
     }
     else
     {
-        pvMBFrameStartCur = eMBTCPStart;
-        pvMBFrameStopCur = eMBTCPStop;
-        peMBFrameReceiveCur = eMBTCPReceive;
-        peMBFrameSendCur = eMBTCPSend;
+        pvMBFrameStartCur = eMBMasterTCPStart;
+        pvMBFrameStopCur = eMBMasterTCPStop;
+        peMBFrameReceiveCur = eMBMasterTCPReceive;
+        peMBFrameSendCur = eMBMasterTCPSend;
         pvMBFrameCloseCur = MB_PORT_HAS_CLOSE ? vMBTCPPortClose : NULL;
-        pvMBFrameGetBufferCur = eMBTCPGetBuffer;
+        pvMBFrameGetBufferCur = vMBMasterTCPGetBuffer;
+        pxMBPortCBTimerExpired = xMBMasterTCPTimerExpired;
         ucMBAddress = MB_TCP_PSEUDO_ADDRESS;
         eMBCurrentMode = MB_TCP;
         eMBState = STATE_DISABLED;
@@ -304,6 +394,7 @@ eMBPoll( void )
     int             i;
     eMBErrorCode    eStatus = MB_ENOERR;
     eMBEventType    eEvent;
+    xMBRequest     *pxRequest;
 
     /* Check if the protocol stack is ready. */
     if( eMBState != STATE_ENABLED )
@@ -311,6 +402,18 @@ eMBPoll( void )
         return MB_EILLSTATE;
     }
 
+#if MB_MASTER_WC_ENABLED > 0
+    /* Submit buffered writes whose window has passed. */
+    vMBMasterWritePoll(  );
+#endif
+#if MB_MASTER_SCAN_ENABLED > 0
+    /* Submit the reads of the scan list which are due. */
+    vMBMasterScanPoll(  );
+#endif
+
+    /* Send submitted requests if the bus or the connection is free. */
+    prvvMBRequestsTransmit(  );
+
     /* Check if there is a event available. If not return control to caller.
      * Otherwise we will handle the event. */
     if( xMBPortEventGet( &eEvent ) == TRUE )
@@ -323,37 +426,51 @@ eMBPoll( void )
         case EV_FRAME_RECEIVED:
         case EV_EXECUTE:
             eStatus = peMBFrameReceiveCur( &ucRcvAddress, &ucMBFrame, &usLength );
-            if( eStatus == MB_ENOERR )
+            if( ( eStatus == MB_ENOERR ) && ( pvMBCaptureCur != NULL ) )
             {
-                if( ( ucRcvAddress == ucMBAddress ) )
+                pvMBCaptureCur( eMBCurrentMode, FALSE, ucRcvAddress, prvusMBCaptureTID( ucMBFrame ),
+                                ucMBFrame, usLength );
+            }
+            if( ( eStatus == MB_ENOERR ) &&
+                ( ( pxRequest = prvpxMBRequestMatch( ucRcvAddress ) ) != NULL ) )
+            {
+                prvvMBRequestComplete( pxRequest, MB_ENOERR, ucMBFrame, usLength );
+            }
+            else if( ( eStatus == MB_ENOERR ) && prvxMBLegacyResponse( ucRcvAddress ) )
+            {
+                ucFunctionCode = ucMBFrame[MB_PDU_FUNC_OFF];
+                eException = MB_EX_ILLEGAL_FUNCTION;
+                for( i = 0; i < MB_FUNC_HANDLERS_MAX; i++ )
                 {
-                    ucFunctionCode = ucMBFrame[MB_PDU_FUNC_OFF];
-                    eException = MB_EX_ILLEGAL_FUNCTION;
-                    for( i = 0; i < MB_FUNC_HANDLERS_MAX; i++ )
+                    /* No more function handlers registered. Abort. */
+                    if( xFuncHandlers[i].ucFunctionCode == 0 )
                     {
-                        /* No more function handlers registered. Abort. */
-                        if( xFuncHandlers[i].ucFunctionCode == 0 )
-                        {
-                            break;
-                        }
-                        else if( xFuncHandlers[i].ucFunctionCode == ucFunctionCode )
-                        {
-                            eException = xFuncHandlers[i].pxHandler( ucMBFrame, &usLength );
-                            break;
-                        }
+                        break;
                     }
-                    if( eException != MB_EX_NONE)
+                    else if( xFuncHandlers[i].ucFunctionCode == ucFunctionCode )
                     {
-                        eStatus = MB_EIO;
+                        eException = xFuncHandlers[i].pxHandler( ucMBFrame, &usLength );
+                        break;
                     }
                 }
+                if( eException != MB_EX_NONE)
+                {
+                    eStatus = MB_EIO;
+                }
             }
             break;
 
         case EV_FRAME_SENT:
+            /* A broadcast request on a serial line has no response. */
+            if( ( usMBRequestCur != MB_REQUEST_NONE ) &&
+                ( xMBRequests[usMBRequestCur].ucId == MB_ADDRESS_BROADCAST ) )
+            {
+                prvvMBRequestComplete( &xMBRequests[usMBRequestCur], MB_ENOERR, NULL, 0 );
+            }
             break;
         }
     }
+    prvvMBRequestsCheckTimeout(  );
     return MB_ENOERR;
 }
 
@@ -364,7 +481,9 @@ eMBReadInputReg( UCHAR ucId, USHORT usStartAddr, USHORT usLen )
     UCHAR *pucFrame = NULL, *pucFrameCur = NULL;
     ucMBAddress = ucId;
 
-    if( eMBState != STATE_ENABLED )
+    /* The bus is owned by the queue until all submitted requests have
+     * completed. */
+    if( ( eMBState != STATE_ENABLED ) || ( usMBGetSubmitted(  ) > 0 ) )
     {
         return MB_EILLSTATE;
     }
@@ -382,9 +501,9 @@ eMBReadInputReg( UCHAR ucId, USHORT usStartAddr, USHORT usLen )
     *pucFrameCur++ = ( UCHAR ) ( usStartAddr & 0xFF );
     *pucFrameCur++ = ( UCHAR ) ( usLen >> 8 );
     *pucFrameCur++ = ( UCHAR ) ( usLen & 0xFF );
-    if( peMBFrameSendCur( ucId, pucFrame, pucFrameCur - pucFrame ) != MB_ENOERR )
+    if( ( eStatus = prveMBFrameSend( ucId, pucFrame, pucFrameCur - pucFrame ) ) != MB_ENOERR )
     {
-        return MB_EIO;
+        return eStatus;
     }
 
     eStatus = xMBPortSerialPoll( ) ? MB_ENOERR : MB_EIO ;
@@ -400,7 +519,9 @@ eMBReadOutputReg( UCHAR ucId, USHORT usStartAddr, USHORT usLen )
     UCHAR *pucFrame = NULL, *pucFrameCur = NULL;
     ucMBAddress = ucId;
 
-    if( eMBState != STATE_ENABLED )
+    /* The bus is owned by the queue until all submitted requests have
+     * completed. */
+    if( ( eMBState != STATE_ENABLED ) || ( usMBGetSubmitted(  ) > 0 ) )
     {
         return MB_EILLSTATE;
     }
@@ -418,9 +539,9 @@ eMBReadOutputReg( UCHAR ucId, USHORT usStartAddr, USHORT usLen )
     *pucFrameCur++ = ( UCHAR ) ( usStartAddr & 0xFF );
     *pucFrameCur++ = ( UCHAR ) ( usLen >> 8 );
     *pucFrameCur++ = ( UCHAR ) ( usLen & 0xFF );
-    if( peMBFrameSendCur( ucId, pucFrame, pucFrameCur - pucFrame ) != MB_ENOERR )
+    if( ( eStatus = prveMBFrameSend( ucId, pucFrame, pucFrameCur - pucFrame ) ) != MB_ENOERR )
     {
-        return MB_EIO;
+        return eStatus;
     }
 
     eStatus = xMBPortSerialPoll( ) ? MB_ENOERR : MB_EIO ;
@@ -436,7 +557,9 @@ eMBWriteRegister( UCHAR ucId, USHORT usStartAddr, const USHORT cusData )
     UCHAR *pucFrame = NULL, *pucFrameCur = NULL;
     ucMBAddress = ucId;
 
-    if( eMBState != STATE_ENABLED )
+    /* The bus is owned by the queue until all submitted requests have
+     * completed. */
+    if( ( eMBState != STATE_ENABLED ) || ( usMBGetSubmitted(  ) > 0 ) )
     {
         return MB_EILLSTATE;
     }
@@ -454,9 +577,9 @@ eMBWriteRegister( UCHAR ucId, USHORT usStartAddr, const USHORT cusData )
     *pucFrameCur++ = ( UCHAR ) ( usStartAddr & 0xFF );
     *pucFrameCur++ = ( UCHAR ) ( cusData >> 8 );
     *pucFrameCur++ = ( UCHAR ) ( cusData & 0xFF );
-    if( peMBFrameSendCur( ucId, pucFrame, pucFrameCur - pucFrame ) != MB_ENOERR )
+    if( ( eStatus = prveMBFrameSend( ucId, pucFrame, pucFrameCur - pucFrame ) ) != MB_ENOERR )
     {
-        return MB_EIO;
+        return eStatus;
     }
 
     eStatus = xMBPortSerialPoll( ) ? MB_ENOERR : MB_EIO ;
@@ -470,13 +593,14 @@ eMBWriteMultRegister( UCHAR ucId, USHORT usStartAddr, USHORT usNReg, const USHOR
     eMBErrorCode eStatus = MB_ENOERR;
     UCHAR *pucFrame = NULL, *pucFrameCur = NULL;
     ucMBAddress = ucId;
-    int i;
 
     if( usNReg > 0x7B ) {
         return MB_EINVAL;
     }
 
-    if( eMBState != STATE_ENABLED )
+    /* The bus is owned by the queue until all submitted requests have
+     * completed. */
+    if( ( eMBState != STATE_ENABLED ) || ( usMBGetSubmitted(  ) > 0 ) )
     {
         return MB_EILLSTATE;
     }
@@ -495,14 +619,12 @@ eMBWriteMultRegister( UCHAR ucId, USHORT usStartAddr, USHORT usNReg, const USHOR
     *pucFrameCur++ = ( UCHAR ) ( usNReg >> 8 );
     *pucFrameCur++ = ( UCHAR ) ( usNReg & 0xFF );
     *pucFrameCur++ = ( UCHAR ) ( usNReg * 2 );
-    for ( i = 0; i != usNReg; ++i ) {
-      *pucFrameCur++ = ( UCHAR ) ( cusData[i] >> 8 );
-      *pucFrameCur++ = ( UCHAR ) ( cusData[i] & 0xFF );
-    }
+    vMBUtilRegsFromHost( pucFrameCur, cusData, usNReg );
+    pucFrameCur += usNReg * 2;
 
-    if( peMBFrameSendCur( ucId, pucFrame, pucFrameCur - pucFrame ) != MB_ENOERR )
+    if( ( eStatus = prveMBFrameSend( ucId, pucFrame, pucFrameCur - pucFrame ) ) != MB_ENOERR )
     {
-        return MB_EIO;
+        return eStatus;
     }
 
     eStatus = xMBPortSerialPoll( ) ? MB_ENOERR : MB_EIO ;
@@ -511,4 +633,755 @@ eMBWriteMultRegister( UCHAR ucId, USHORT usStartAddr, USHORT usNReg, const USHOR
     return eStatus;
 }
 
+eMBErrorCode
+eMBSubmit( UCHAR ucId, UCHAR ucFunctionCode, USHORT usStartAddr, USHORT usLen,
+           const USHORT * pusData, pxMBRequestCallback pxCallback, void *pvArg,
+           USHORT * pusHandle )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+    xMBRequest     *pxRequest = NULL;
+    UCHAR          *pucFrameCur;
+    USHORT          usMaxLen;
+    USHORT          i;
+
+    if( eMBState != STATE_ENABLED )
+    {
+        return MB_EILLSTATE;
+    }
+
+    switch ( ucFunctionCode )
+    {
+    case MB_FUNC_READ_COILS:
+    case MB_FUNC_READ_DISCRETE_INPUTS:
+        usMaxLen = 2000;
+        break;
+    case MB_FUNC_READ_HOLDING_REGISTER:
+    case MB_FUNC_READ_INPUT_REGISTER:
+        usMaxLen = 125;
+        break;
+    case MB_FUNC_WRITE_SINGLE_COIL:
+    case MB_FUNC_WRITE_REGISTER:
+        usMaxLen = 1;
+        break;
+    case MB_FUNC_WRITE_MULTIPLE_COILS:
+        usMaxLen = 1968;
+        break;
+    case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+        usMaxLen = 123;
+        break;
+    default:
+        usMaxLen = 0;
+        break;
+    }
+    if( ( usLen == 0 ) || ( usLen > usMaxLen ) || ( usStartAddr == 0 ) ||
+        ( ( ULONG )usStartAddr + usLen - 1 > 0xFFFFUL ) )
+    {
+        return MB_EINVAL;
+    }
+    if( prvxMBRequestIsWrite( ucFunctionCode ) )
+    {
+        if( pusData == NULL )
+        {
+            return MB_EINVAL;
+        }
+    }
+    else if( ucId == MB_ADDRESS_BROADCAST )
+    {
+        /* Read requests can not be broadcasted. */
+        return MB_EINVAL;
+    }
+
+    /* The queue is shared with eMBPoll( ) which may run in another
+     * thread. */
+    ENTER_CRITICAL_SECTION(  );
+    for( i = 0; i < MB_MASTER_REQUESTS_MAX; i++ )
+    {
+        if( xMBRequests[i].eState == REQ_FREE )
+        {
+            pxRequest = &xMBRequests[i];
+            break;
+        }
+    }
+    if( pxRequest == NULL )
+    {
+        EXIT_CRITICAL_SECTION(  );
+        return MB_ENORES;
+    }
+
+    pxRequest->ucId = ucId;
+    pxRequest->ucFunctionCode = ucFunctionCode;
+    pxRequest->usStartAddr = usStartAddr;
+    pxRequest->usLen = usLen;
+    pxRequest->pxCallback = pxCallback;
+    pxRequest->pvArg = pvArg;
+    pxRequest->ePriority = MB_PRIO_NORMAL;
+    pxRequest->xDeadline = FALSE;
+    pxRequest->ulSubmitMs = ulMBPortTimersGetMs(  );
+    pxRequest->ucRetries = 0;
+    pxRequest->xProbe = FALSE;
+
+    /* Encode the PDU. Addresses on the wire start at 0. */
+    pucFrameCur = &pxRequest->aucPDU[MB_PDU_FUNC_OFF];
+    *pucFrameCur++ = ucFunctionCode;
+    *pucFrameCur++ = ( UCHAR )( ( usStartAddr - 1 ) >> 8 );
+    *pucFrameCur++ = ( UCHAR )( ( usStartAddr - 1 ) & 0xFF );
+    switch ( ucFunctionCode )
+    {
+    case MB_FUNC_WRITE_SINGLE_COIL:
+        *pucFrameCur++ = pusData[0] != 0 ? 0xFF : 0x00;
+        *pucFrameCur++ = 0x00;
+        break;
+    case MB_FUNC_WRITE_REGISTER:
+        *pucFrameCur++ = ( UCHAR )( pusData[0] >> 8 );
+        *pucFrameCur++ = ( UCHAR )( pusData[0] & 0xFF );
+        break;
+    case MB_FUNC_WRITE_MULTIPLE_COILS:
+        *pucFrameCur++ = ( UCHAR )( usLen >> 8 );
+        *pucFrameCur++ = ( UCHAR )( usLen & 0xFF );
+        *pucFrameCur++ = ( UCHAR )( ( usLen + 7 ) / 8 );
+        memset( pucFrameCur, 0, ( usLen + 7 ) / 8 );
+        for( i = 0; i < usLen; i++ )
+        {
+            if( pusData[i] != 0 )
+            {
+                pucFrameCur[i / 8] |= ( UCHAR )( 1 << ( i % 8 ) );
+            }
+        }
+        pucFrameCur += ( usLen + 7 ) / 8;
+        break;
+    case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+        *pucFrameCur++ = ( UCHAR )( usLen >> 8 );
+        *pucFrameCur++ = ( UCHAR )( usLen & 0xFF );
+        *pucFrameCur++ = ( UCHAR )( usLen * 2 );
+        vMBUtilRegsFromHost( pucFrameCur, pusData, usLen );
+        pucFrameCur += usLen * 2;
+        break;
+    default:
+        *pucFrameCur++ = ( UCHAR )( usLen >> 8 );
+        *pucFrameCur++ = ( UCHAR )( usLen & 0xFF );
+        break;
+    }
+    pxRequest->usPDULength = ( USHORT )( pucFrameCur - &pxRequest->aucPDU[0] );
+    pxRequest->ulSequence = ulMBRequestSequence++;
+    pxRequest->eState = REQ_QUEUED;
+
+    if( pusHandle != NULL )
+    {
+        *pusHandle = ( USHORT )( ( pxRequest->ucGeneration << 8 ) | ( pxRequest - &xMBRequests[0] ) );
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return eStatus;
+}
+
+eMBErrorCode
+eMBSchedule( USHORT usHandle, eMBPriority ePriority, ULONG ulDeadlineMs )
+{
+    xMBRequest     *pxRequest;
+    eMBErrorCode    eStatus = MB_ENOERR;
+
+    if( ( ( usHandle & 0xFF ) >= MB_MASTER_REQUESTS_MAX ) || ( ePriority >= MB_PRIO_CLASSES ) )
+    {
+        return MB_EINVAL;
+    }
+    pxRequest = &xMBRequests[usHandle & 0xFF];
+    ENTER_CRITICAL_SECTION(  );
+    if( ( pxRequest->eState != REQ_QUEUED ) ||
+        ( pxRequest->ucGeneration != ( UCHAR )( usHandle >> 8 ) ) )
+    {
+        /* Already sent or completed. */
+        eStatus = MB_EINVAL;
+    }
+    else
+    {
+        pxRequest->ePriority = ePriority;
+        pxRequest->xDeadline = ulDeadlineMs > 0 ? TRUE : FALSE;
+        pxRequest->ulDeadlineMs = pxRequest->ulSubmitMs + ulDeadlineMs;
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return eStatus;
+}
+
+eMBErrorCode
+eMBGetSchedStats( eMBPriority ePriority, xMBSchedStats * pxStats )
+{
+    if( ( ePriority >= MB_PRIO_CLASSES ) || ( pxStats == NULL ) )
+    {
+        return MB_EINVAL;
+    }
+    *pxStats = xMBPrioStats[ePriority];
+    return MB_ENOERR;
+}
+
+void
+vMBResetSchedStats( void )
+{
+    memset( xMBPrioStats, 0, sizeof( xMBPrioStats ) );
+}
+
+eMBErrorCode
+eMBGetSlaveStatus( UCHAR ucId, xMBSlaveStatus * pxStatus )
+{
+    const xMBSlaveLink *pxSlave = &xMBSlaves[ucId];
+
+    if( pxStatus == NULL )
+    {
+        return MB_EINVAL;
+    }
+    pxStatus->xOnline = pxSlave->xOffline ? FALSE : TRUE;
+    pxStatus->ulSRTTMs = pxSlave->ulSRTT8 >> 3;
+    pxStatus->ulRTTVarMs = pxSlave->ulRTTVar4 >> 2;
+    pxStatus->ulRTOMs = prvulMBSlaveTimeout( pxSlave );
+    pxStatus->ulTimeouts = pxSlave->ulTimeouts;
+    pxStatus->ulRetries = pxSlave->ulRetries;
+    return MB_ENOERR;
+}
+
+USHORT
+usMBGetSubmitted( void )
+{
+    USHORT          usSubmitted = 0;
+    int             i;
+
+    ENTER_CRITICAL_SECTION(  );
+    for( i = 0; i < MB_MASTER_REQUESTS_MAX; i++ )
+    {
+        if( xMBRequests[i].eState != REQ_FREE )
+        {
+            usSubmitted++;
+        }
+    }
+    EXIT_CRITICAL_SECTION(  );
+    return usSubmitted;
+}
+
+eMBErrorCode
+eMBRegisterCaptureCB( pvMBCaptureCB pvCaptureCB )
+{
+    ENTER_CRITICAL_SECTION(  );
+    pvMBCaptureCur = pvCaptureCB;
+    EXIT_CRITICAL_SECTION(  );
+    return MB_ENOERR;
+}
+
+/* Pass a frame to the transmitter and to the capture callback. */
+static eMBErrorCode
+prveMBFrameSend( UCHAR ucId, const UCHAR * pucFrame, USHORT usLength )
+{
+    eMBErrorCode    eStatus = peMBFrameSendCur( ucId, pucFrame, usLength );
+
+    if( ( eStatus == MB_ENOERR ) && ( pvMBCaptureCur != NULL ) )
+    {
+        pvMBCaptureCur( eMBCurrentMode, TRUE, ucId, prvusMBCaptureTID( pucFrame ), pucFrame, usLength );
+    }
+    return eStatus;
+}
+
+static void
+prvvMBRequestsTransmit( void )
+{
+    xMBRequest     *pxRequest;
+    xMBSlaveLink   *pxSlave;
+    UCHAR          *pucFrame = NULL;
+    ULONG           ulNowMs = ulMBPortTimersGetMs(  );
+    ULONG           ulWaitMs;
+    eMBErrorCode    eStatus;
+    BOOL            xExpired;
+    int             i;
+
+    for( i = 0; i < MB_MASTER_REQUESTS_MAX; i++ )
+    {
+        xMBRequests[i].xSkipped = FALSE;
+
+        /* Requests which can no longer be sent in time are dropped. The
+         * deadline may be changed by eMBSchedule( ) from another thread. */
+        ENTER_CRITICAL_SECTION(  );
+        xExpired = ( xMBRequests[i].eState == REQ_QUEUED ) && xMBRequests[i].xDeadline &&
+            ( ( LONG )( ulNowMs - xMBRequests[i].ulDeadlineMs ) >= 0 ) ? TRUE : FALSE;
+        EXIT_CRITICAL_SECTION(  );
+        if( xExpired )
+        {
+            xMBPrioStats[xMBRequests[i].ePriority].ulExpired++;
+            prvvMBRequestComplete( &xMBRequests[i], MB_ETIMEDOUT, NULL, 0 );
+        }
+        /* Requests to offline slaves fail without using the bus. */
+        else if( ( xMBRequests[i].eState == REQ_QUEUED ) &&
+                 prvxMBSlaveBlocked( &xMBSlaves[xMBRequests[i].ucId], ulNowMs ) )
+        {
+            prvvMBRequestComplete( &xMBRequests[i], MB_ETIMEDOUT, NULL, 0 );
+        }
+    }
+
+    /* Serial lines carry one request at a time. With Modbus TCP requests
+     * are sent until the connection of a request has no free transaction.
+     * Such a request is skipped. */
+    while( usMBRequestCur == MB_REQUEST_NONE )
+    {
+        ENTER_CRITICAL_SECTION(  );
+        pxRequest = prvpxMBRequestsSelect(  );
+        EXIT_CRITICAL_SECTION(  );
+        if( pxRequest == NULL )
+        {
+            break;
+        }
+        pxSlave = &xMBSlaves[pxRequest->ucId];
+        if( prvxMBSlaveBlocked( pxSlave, ulNowMs ) )
+        {
+            /* A probe to this slave has been sent in this pass. */
+            prvvMBRequestComplete( pxRequest, MB_ETIMEDOUT, NULL, 0 );
+            continue;
+        }
+        pvMBFrameGetBufferCur( &pucFrame );
+        memcpy( pucFrame, pxRequest->aucPDU, pxRequest->usPDULength );
+#if MB_TCP_ENABLED > 0
+        if( eMBCurrentMode == MB_TCP )
+        {
+            vMBMasterTCPSetContext( ( USHORT )( ( pxRequest->ucGeneration << 8 ) |
+                                                ( pxRequest - &xMBRequests[0] ) ) );
+        }
+#endif
+        eStatus = prveMBFrameSend( pxRequest->ucId, pucFrame, pxRequest->usPDULength );
+        if( eStatus == MB_ENOERR )
+        {
+            pxRequest->eState = REQ_SENT;
+            pxRequest->ulSentMs = ulMBPortTimersGetMs(  );
+            ulMBSlaveServed[pxRequest->ucId] = ++ulMBServeCount;
+            if( pxSlave->xOffline )
+            {
+                pxRequest->xProbe = TRUE;
+                pxSlave->xProbing = TRUE;
+            }
+
+            ulWaitMs = pxRequest->ulSentMs - pxRequest->ulSubmitMs;
+            xMBPrioStats[pxRequest->ePriority].ulSent++;
+            xMBPrioStats[pxRequest->ePriority].ulQueueWaitTotalMs += ulWaitMs;
+            if( ulWaitMs > xMBPrioStats[pxRequest->ePriority].ulQueueWaitMaxMs )
+            {
+                xMBPrioStats[pxRequest->ePriority].ulQueueWaitMaxMs = ulWaitMs;
+            }
+            if( eMBCurrentMode != MB_TCP )
+            {
+                usMBRequestCur = ( USHORT )( pxRequest - &xMBRequests[0] );
+            }
+        }
+        else if( eMBCurrentMode != MB_TCP )
+        {
+            /* The receiver is busy. Try again on the next poll. */
+            break;
+        }
+        else if( eStatus == MB_ENORES )
+        {
+            pxRequest->xSkipped = TRUE;
+        }
+        else
+        {
+            /* Unknown unit or the server is not connected. */
+            prvvMBRequestComplete( pxRequest, eStatus, NULL, 0 );
+        }
+    }
+}
+
+/* Select the next request for transmission. Requests are ordered by
+ *  - priority class,
+ *  - writes before reads,
+ *  - the slave which has been served least recently,
+ *  - submission order.
+ */
+static xMBRequest *
+prvpxMBRequestsSelect( void )
+{
+    xMBRequest     *pxBest = NULL;
+    xMBRequest     *pxCur;
+    BOOL            xCurWrite, xBestWrite = FALSE;
+    LONG            lDelta;
+    int             i;
+
+    for( i = 0; i < MB_MASTER_REQUESTS_MAX; i++ )
+    {
+        pxCur = &xMBRequests[i];
+        if( ( pxCur->eState != REQ_QUEUED ) || pxCur->xSkipped )
+        {
+            continue;
+        }
+        xCurWrite = prvxMBRequestIsWrite( pxCur->ucFunctionCode );
+        if( pxBest == NULL )
+        {
+            pxBest = pxCur;
+            xBestWrite = xCurWrite;
+            continue;
+        }
+
+        if( pxCur->ePriority != pxBest->ePriority )
+        {
+            lDelta = pxCur->ePriority < pxBest->ePriority ? -1 : 1;
+        }
+        else if( xCurWrite != xBestWrite )
+        {
+            lDelta = xCurWrite ? -1 : 1;
+        }
+        else if( ulMBSlaveServed[pxCur->ucId] != ulMBSlaveServed[pxBest->ucId] )
+        {
+            lDelta = ( LONG )( ulMBSlaveServed[pxCur->ucId] - ulMBSlaveServed[pxBest->ucId] );
+        }
+        else
+        {
+            lDelta = ( LONG )( pxCur->ulSequence - pxBest->ulSequence );
+        }
+        if( lDelta < 0 )
+        {
+            pxBest = pxCur;
+            xBestWrite = xCurWrite;
+        }
+    }
+    return pxBest;
+}
+
+static BOOL
+prvxMBRequestIsWrite( UCHAR ucFunctionCode )
+{
+    return ( ucFunctionCode == MB_FUNC_WRITE_SINGLE_COIL ) ||
+        ( ucFunctionCode == MB_FUNC_WRITE_REGISTER ) ||
+        ( ucFunctionCode == MB_FUNC_WRITE_MULTIPLE_COILS ) ||
+        ( ucFunctionCode == MB_FUNC_WRITE_MULTIPLE_REGISTERS ) ? TRUE : FALSE;
+}
+
+static void
+prvvMBRequestsCheckTimeout( void )
+{
+    ULONG           ulNowMs = ulMBPortTimersGetMs(  );
+    ULONG           ulTimeoutMs;
+    xMBRequest     *pxRequest;
+    xMBSlaveLink   *pxSlave;
+    int             i;
+
+    for( i = 0; i < MB_MASTER_REQUESTS_MAX; i++ )
+    {
+        pxRequest = &xMBRequests[i];
+        pxSlave = &xMBSlaves[pxRequest->ucId];
+        ulTimeoutMs = prvulMBSlaveTimeout( pxSlave );
+        if( pxRequest->eState != REQ_SENT )
+        {
+            continue;
+        }
+#if MB_TCP_ENABLED > 0
+        if( ( eMBCurrentMode == MB_TCP ) &&
+            xMBMasterTCPIsLost( ( USHORT )( ( pxRequest->ucGeneration << 8 ) | i ) ) )
+        {
+            /* The connection has been closed. Don't wait for the timeout. */
+            vMBMasterTCPAbort( ( USHORT )( ( pxRequest->ucGeneration << 8 ) | i ) );
+            prvvMBRequestComplete( pxRequest, MB_EIO, NULL, 0 );
+            continue;
+        }
+#endif
+        if( ( ULONG )( ulNowMs - pxRequest->ulSentMs ) < ulTimeoutMs )
+        {
+            continue;
+        }
+
+#if MB_TCP_ENABLED > 0
+        if( eMBCurrentMode == MB_TCP )
+        {
+            /* Release the transaction slot now. Otherwise it would stay in
+             * use until MB_TCP_MASTER_TIMEOUT_MS has expired. */
+            vMBMasterTCPAbort( ( USHORT )( ( pxRequest->ucGeneration << 8 ) | i ) );
+        }
+#endif
+
+        /* Back off the timeout like TCP does. It is reduced again by the
+         * next round trip time sample. Pipelined requests which were sent
+         * before the last back off expire with it and do not double the
+         * timeout again. */
+        pxSlave->ulTimeouts++;
+        if( !pxSlave->xRTOBackedOff ||
+            ( ( LONG )( pxRequest->ulSentMs - pxSlave->ulRTOBackedOffMs ) >= 0 ) )
+        {
+            pxSlave->xRTOBackedOff = TRUE;
+            pxSlave->ulRTOBackedOffMs = ulNowMs;
+            pxSlave->ulRTOMs = ulTimeoutMs * 2;
+            if( pxSlave->ulRTOMs > prvulMBSlaveTimeout( NULL ) )
+            {
+                pxSlave->ulRTOMs = prvulMBSlaveTimeout( NULL );
+            }
+        }
+
+        if( pxRequest->xProbe )
+        {
+            pxSlave->xProbing = FALSE;
+            pxSlave->ulBackoffMs *= 2;
+            if( pxSlave->ulBackoffMs > MB_MASTER_PROBE_MAX_MS )
+            {
+                pxSlave->ulBackoffMs = MB_MASTER_PROBE_MAX_MS;
+            }
+            pxSlave->ulProbeMs = ulNowMs + pxSlave->ulBackoffMs;
+        }
+        else if( pxRequest->ucRetries < MB_MASTER_RETRIES_MAX )
+        {
+            if( ( eMBCurrentMode == MB_TCP ) && prvxMBRequestIsWrite( pxRequest->ucFunctionCode ) )
+            {
+                /* Later writes to the slave may already be on their way. A
+                 * repeated write would overtake them, so it is reported to
+                 * the caller instead. */
+                prvvMBRequestComplete( pxRequest, MB_ETIMEDOUT, NULL, 0 );
+                continue;
+            }
+            /* Send the request again. */
+            pxSlave->ulRetries++;
+            pxRequest->ucRetries++;
+            pxRequest->eState = REQ_QUEUED;
+            if( usMBRequestCur == ( USHORT ) i )
+            {
+                usMBRequestCur = MB_REQUEST_NONE;
+            }
+            continue;
+        }
+        else
+        {
+            pxSlave->xOffline = TRUE;
+            pxSlave->xProbing = FALSE;
+            pxSlave->ulBackoffMs = MB_MASTER_PROBE_MIN_MS;
+            pxSlave->ulProbeMs = ulNowMs + pxSlave->ulBackoffMs;
+        }
+        prvvMBRequestComplete( pxRequest, MB_ETIMEDOUT, NULL, 0 );
+    }
+}
+
+/* Response timeout of a slave. If pxSlave is NULL the upper bound of
+ * the timeout is returned. */
+static ULONG
+prvulMBSlaveTimeout( const xMBSlaveLink * pxSlave )
+{
+    if( ( pxSlave != NULL ) && ( pxSlave->ulRTOMs != 0 ) )
+    {
+        return pxSlave->ulRTOMs;
+    }
+    return eMBCurrentMode == MB_TCP ? MB_TCP_MASTER_TIMEOUT_MS : MB_MASTER_RESPONSE_TIMEOUT_MS;
+}
+
+/* TRUE if requests to the slave must fail without being sent. */
+static BOOL
+prvxMBSlaveBlocked( const xMBSlaveLink * pxSlave, ULONG ulNowMs )
+{
+    return pxSlave->xOffline &&
+        ( pxSlave->xProbing || ( ( LONG )( ulNowMs - pxSlave->ulProbeMs ) < 0 ) ) ? TRUE : FALSE;
+}
+
+/* Update the round trip time estimation with a new sample (RFC 6298). */
+static void
+prvvMBSlaveSample( xMBSlaveLink * pxSlave, ULONG ulRTTMs )
+{
+    LONG            lErr;
+    ULONG           ulRTOMs;
+
+    if( !pxSlave->xMeasured )
+    {
+        pxSlave->xMeasured = TRUE;
+        pxSlave->ulSRTT8 = ulRTTMs << 3;
+        pxSlave->ulRTTVar4 = ulRTTMs << 1;
+    }
+    else
+    {
+        lErr = ( LONG )( ulRTTMs - ( pxSlave->ulSRTT8 >> 3 ) );
+        pxSlave->ulSRTT8 += lErr;
+        if( lErr < 0 )
+        {
+            lErr = -lErr;
+        }
+        pxSlave->ulRTTVar4 += lErr - ( LONG )( pxSlave->ulRTTVar4 >> 2 );
+    }
+    pxSlave->xRTOBackedOff = FALSE;
+
+    /* SRTT + max( G, 4 * RTTVAR ) with a clock granularity G of 1 ms. */
+    ulRTOMs = ( pxSlave->ulSRTT8 >> 3 ) + ( pxSlave->ulRTTVar4 > 0 ? pxSlave->ulRTTVar4 : 1 );
+    if( ulRTOMs < MB_MASTER_RTO_MIN_MS )
+    {
+        ulRTOMs = MB_MASTER_RTO_MIN_MS;
+    }
+    else if( ulRTOMs > prvulMBSlaveTimeout( NULL ) )
+    {
+        ulRTOMs = prvulMBSlaveTimeout( NULL );
+    }
+    pxSlave->ulRTOMs = ulRTOMs;
+}
+
+static xMBRequest *
+prvpxMBRequestMatch( UCHAR ucRcvAddress )
+{
+    xMBRequest     *pxRequest = NULL;
 
+#if MB_TCP_ENABLED > 0
+    USHORT          usContext;
+
+    if( eMBCurrentMode == MB_TCP )
+    {
+        /* The transport has matched the response to its request. */
+        usContext = usMBMasterTCPGetContext(  );
+        if( ( usContext != MB_HANDLE_INVALID ) &&
+            ( ( usContext & 0xFF ) < MB_MASTER_REQUESTS_MAX ) )
+        {
+            pxRequest = &xMBRequests[usContext & 0xFF];
+            if( ( pxRequest->eState != REQ_SENT ) ||
+                ( pxRequest->ucGeneration != ( UCHAR )( usContext >> 8 ) ) )
+            {
+                /* The request has already timed out. */
+                pxRequest = NULL;
+            }
+        }
+    }
+    else
+#endif
+    if( ( usMBRequestCur != MB_REQUEST_NONE ) &&
+        ( xMBRequests[usMBRequestCur].ucId == ucRcvAddress ) )
+    {
+        pxRequest = &xMBRequests[usMBRequestCur];
+    }
+    return pxRequest;
+}
+
+/* Check if a response without a request belongs to one of the blocking
+ * functions like eMBReadInputReg( ). A Modbus TCP response has already been
+ * matched to its request by the transaction identifier. If it carries the
+ * context of a request which has timed out or was retried it is dropped.
+ */
+static BOOL
+prvxMBLegacyResponse( UCHAR ucRcvAddress )
+{
+#if MB_TCP_ENABLED > 0
+    if( eMBCurrentMode == MB_TCP )
+    {
+        return usMBMasterTCPGetContext(  ) == MB_HANDLE_INVALID ? TRUE : FALSE;
+    }
+#endif
+    return ucRcvAddress == ucMBAddress ? TRUE : FALSE;
+}
+
+/* Transaction identifier of a frame for the capture callback. */
+static USHORT
+prvusMBCaptureTID( const UCHAR * pucFrame )
+{
+#if MB_TCP_ENABLED > 0
+    if( eMBCurrentMode == MB_TCP )
+    {
+        return usMBMasterTCPGetTID( pucFrame );
+    }
+#endif
+    ( void )pucFrame;
+    return 0;
+}
+
+static void
+prvvMBRequestComplete( xMBRequest * pxRequest, eMBErrorCode eStatus,
+                       const UCHAR * pucFrame, USHORT usLength )
+{
+    xMBRequestResult xResult;
+    pxMBRequestCallback pxCallback = pxRequest->pxCallback;
+    void           *pvArg = pxRequest->pvArg;
+    xMBSchedStats  *pxStats = &xMBPrioStats[pxRequest->ePriority];
+    xMBSlaveLink   *pxSlave;
+    ULONG           ulBusMs;
+    USHORT          usBytes;
+
+    xResult.usHandle = ( USHORT )( ( pxRequest->ucGeneration << 8 ) | ( pxRequest - &xMBRequests[0] ) );
+    xResult.ucId = pxRequest->ucId;
+    xResult.ucFunctionCode = pxRequest->ucFunctionCode;
+    xResult.usStartAddr = pxRequest->usStartAddr;
+    xResult.usLen = pxRequest->usLen;
+    xResult.pucData = NULL;
+    xResult.eStatus = eStatus;
+    xResult.eException = MB_EX_NONE;
+
+    if( pucFrame != NULL )
+    {
+        switch ( pxRequest->ucFunctionCode )
+        {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS:
+            usBytes = ( USHORT )( ( pxRequest->usLen + 7 ) / 8 );
+            break;
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER:
+            usBytes = ( USHORT )( pxRequest->usLen * 2 );
+            break;
+        default:
+            usBytes = 0;
+            break;
+        }
+
+        if( ( usLength == 2 ) && ( pucFrame[MB_PDU_FUNC_OFF] == ( pxRequest->ucFunctionCode | MB_FUNC_ERROR ) ) )
+        {
+            xResult.eStatus = MB_EIO;
+            xResult.eException = ( eMBException ) pucFrame[MB_PDU_DATA_OFF];
+        }
+        else if( pucFrame[MB_PDU_FUNC_OFF] != pxRequest->ucFunctionCode )
+        {
+            xResult.eStatus = MB_EIO;
+        }
+        else if( usBytes > 0 )
+        {
+            /* Function code, byte count and data. */
+            if( ( usLength == usBytes + 2 ) && ( pucFrame[MB_PDU_DATA_OFF] == usBytes ) )
+            {
+                xResult.pucData = &pucFrame[MB_PDU_DATA_OFF + 1];
+            }
+            else
+            {
+                xResult.eStatus = MB_EIO;
+            }
+        }
+        else if( usLength != 5 )
+        {
+            /* Write requests are answered with function code, address and
+             * value or quantity. */
+            xResult.eStatus = MB_EIO;
+        }
+    }
+
+    if( ( pxRequest->eState == REQ_SENT ) && ( pucFrame != NULL ) )
+    {
+        /* The slave is alive. Responses to repeated requests are ambiguous
+         * and not used for the round trip time (Karn's algorithm). */
+        pxSlave = &xMBSlaves[pxRequest->ucId];
+        if( pxRequest->ucRetries == 0 )
+        {
+            prvvMBSlaveSample( pxSlave, ulMBPortTimersGetMs(  ) - pxRequest->ulSentMs );
+        }
+        pxSlave->xOffline = FALSE;
+        pxSlave->xProbing = FALSE;
+    }
+
+    if( pxRequest->eState == REQ_SENT )
+    {
+        ulBusMs = ulMBPortTimersGetMs(  ) - pxRequest->ulSentMs;
+        pxStats->ulBusTimeTotalMs += ulBusMs;
+        if( ulBusMs > pxStats->ulBusTimeMaxMs )
+        {
+            pxStats->ulBusTimeMaxMs = ulBusMs;
+        }
+        if( xResult.eStatus == MB_ENOERR )
+        {
+            pxStats->ulCompleted++;
+        }
+        else if( xResult.eStatus == MB_ETIMEDOUT )
+        {
+            pxStats->ulTimeouts++;
+        }
+        else
+        {
+            pxStats->ulFailed++;
+        }
+    }
+
+    /* Free the entry before calling the callback. This allows the callback
+     * to submit new requests. */
+    if( usMBRequestCur == ( USHORT )( pxRequest - &xMBRequests[0] ) )
+    {
+        usMBRequestCur = MB_REQUEST_NONE;
+    }
+    ENTER_CRITICAL_SECTION(  );
+    pxRequest->eState = REQ_FREE;
+    pxRequest->ucGeneration++;
+    EXIT_CRITICAL_SECTION(  );
+
+    if( pxCallback != NULL )
+    {
+        pxCallback( &xResult, pvArg );
+    }
+}
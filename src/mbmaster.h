@@ -72,6 +72,31 @@ eMBErrorCode    eMBInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParit
 
 eMBErrorCode    eMBTCPInit( USHORT usTCPPort );
 
+/*! \brief Map a unit identifier to a Modbus TCP server.
+ *
+ * Requests for the unit \c ucId are sent to the server at \c szHostAddress.
+ * Units which are located on the same server share one connection. The
+ * connection is established in the background and reestablished if it is
+ * lost. Until the connection is up requests for the unit fail with
+ * eMBErrorCode::MB_EIO.
+ *
+ * \param ucId The unit identifier.
+ * \param szHostAddress Host name or IP address of the server.
+ * \param usTCPPort The TCP port of the server. If MB_TCP_PORT_USE_DEFAULT
+ *   the port passed to eMBTCPInit( ) is used.
+ */
+eMBErrorCode    eMBTCPAddTarget( UCHAR ucId, const CHAR * szHostAddress, USHORT usTCPPort );
+
+/*! \brief Number of Modbus TCP requests waiting for a response.
+ *
+ * In Modbus TCP mode the request functions return as soon as the request
+ * has been sent. Up to MB_TCP_MASTER_PIPELINE_DEPTH requests are kept in
+ * flight per server and further requests fail with
+ * eMBErrorCode::MB_ENORES until a response has been received or a request
+ * has timed out. The responses are processed by eMBPoll( ).
+ */
+USHORT          usMBTCPGetPending( void );
+
 eMBErrorCode    eMBClose( void );
 
 eMBErrorCode    eMBEnable( void );
@@ -88,9 +113,419 @@ eMBErrorCode    eMBWriteRegister ( UCHAR ucId, USHORT usAddr, const USHORT usDat
 
 eMBErrorCode    eMBWriteMultRegister ( UCHAR ucId, USHORT usStartAddr, USHORT usLen, const USHORT *cusData );
 
-void            vMBReadInputRegCallback ( const UCHAR *cpucBuffer, USHORT usLen );
+/*! \brief Called with the input registers read by eMBReadInputReg( ).
+ *
+ * \param pusRegs Register values in host byte order.
+ * \param usLen Number of registers.
+ */
+void            vMBReadInputRegCallback ( const USHORT *pusRegs, USHORT usLen );
+
+/*! \brief Called with the holding registers read by eMBReadOutputReg( ). */
+void            vMBReadHoldingRegCallback ( const USHORT *pusRegs, USHORT usLen );
+
+/* ----------------------- Asynchronous requests ----------------------------*/
+
+/*! \brief Handle which is never returned by eMBSubmit( ). */
+#define MB_HANDLE_INVALID       ( 0xFFFF )
+
+/*! \brief Result of a request submitted with eMBSubmit( ).
+ *
+ * The result is only valid during the call of the completion callback.
+ * For read requests \c pucData points to the data of the response in the
+ * format of the Modbus PDU, i.e. registers in big endian byte order and
+ * coils packed into bytes starting with the least significant bit.
+ */
+typedef struct
+{
+    USHORT          usHandle;   /*!< Handle returned by eMBSubmit( ). */
+    UCHAR           ucId;       /*!< Slave address or unit identifier. */
+    UCHAR           ucFunctionCode;     /*!< Function code of the request. */
+    USHORT          usStartAddr;        /*!< First register or coil. */
+    USHORT          usLen;      /*!< Number of registers or coils. */
+    const UCHAR    *pucData;    /*!< Response data of a read request or NULL. */
+    eMBErrorCode    eStatus;    /*!< Status of the request. */
+    eMBException    eException; /*!< Exception returned by the slave. */
+} xMBRequestResult;
+
+typedef void    ( *pxMBRequestCallback ) ( const xMBRequestResult * pxResult, void *pvArg );
+
+/*! \brief Priority classes of submitted requests.
+ *
+ * A request of a higher class is always sent before a request of a lower
+ * class. Within a class write requests are sent before read requests and
+ * slaves are served round robin. Requests for the same slave are sent in
+ * the order they were submitted.
+ */
+typedef enum
+{
+    MB_PRIO_HIGH,               /*!< E.g. alarm relevant reads. */
+    MB_PRIO_NORMAL,             /*!< Default for eMBSubmit( ). */
+    MB_PRIO_LOW,                /*!< E.g. bulk reads for a historian. */
+    MB_PRIO_CLASSES
+} eMBPriority;
+
+/*! \brief Statistics of the request scheduler for a priority class.
+ *
+ * The queue wait is the time from submission to transmission. The bus
+ * time is the time from transmission to completion. All times are in
+ * milliseconds.
+ */
+typedef struct
+{
+    ULONG           ulSent;     /*!< Requests sent. */
+    ULONG           ulCompleted;        /*!< Requests with a valid response. */
+    ULONG           ulFailed;   /*!< Exceptions, invalid responses. */
+    ULONG           ulTimeouts; /*!< Requests without a response. */
+    ULONG           ulExpired;  /*!< Deadline passed before transmission. */
+    ULONG           ulQueueWaitTotalMs;
+    ULONG           ulQueueWaitMaxMs;
+    ULONG           ulBusTimeTotalMs;
+    ULONG           ulBusTimeMaxMs;
+} xMBSchedStats;
+
+/*! \brief Queue a request and return immediately.
+ *
+ * The request is sent by eMBPoll( ) as soon as the bus is free (RTU and
+ * ASCII) or the connection to the server has room for another transaction
+ * (TCP). When the response has been received or the request has failed
+ * the callback is invoked from eMBPoll( ). The status is
+ * eMBErrorCode::MB_ENOERR on success, eMBErrorCode::MB_ETIMEDOUT if the
+ * slave did not answer and eMBErrorCode::MB_EIO if the slave returned an
+ * exception (stored in xMBRequestResult::eException), an invalid
+ * response or if the connection to the server was lost. A broadcast
+ * request on a serial line completes after it has been sent.
+ *
+ * The response timeout adapts to the round trip time of the slave. A
+ * request without a response is repeated up to MB_MASTER_RETRIES_MAX
+ * times. If it still fails the slave is considered offline and requests
+ * to it fail with eMBErrorCode::MB_ETIMEDOUT without being sent until a
+ * probe request has been answered (see MB_MASTER_PROBE_MIN_MS).
+ *
+ * Supported function codes are MB_FUNC_READ_COILS,
+ * MB_FUNC_READ_DISCRETE_INPUTS, MB_FUNC_READ_HOLDING_REGISTER,
+ * MB_FUNC_READ_INPUT_REGISTER, MB_FUNC_WRITE_SINGLE_COIL,
+ * MB_FUNC_WRITE_REGISTER, MB_FUNC_WRITE_MULTIPLE_COILS and
+ * MB_FUNC_WRITE_MULTIPLE_REGISTERS. Write requests take the values from
+ * \c pusData, one element per register or coil. A coil is switched on if
+ * its element is not zero. The data is copied.
+ *
+ * The blocking request functions return eMBErrorCode::MB_EILLSTATE while
+ * submitted requests have not completed. eMBSubmit( ), eMBSchedule( ) and
+ * usMBGetSubmitted( ) may be called from another thread than eMBPoll( ).
+ * They protect the queue with ENTER_CRITICAL_SECTION( ). All other
+ * functions must be called from the thread which calls eMBPoll( ).
+ *
+ * \param ucId Slave address or unit identifier.
+ * \param ucFunctionCode Modbus function code.
+ * \param usStartAddr First register or coil. Starts at 1 like in the
+ *   other request functions.
+ * \param usLen Number of registers or coils.
+ * \param pusData Values for write requests. Ignored for read requests.
+ * \param pxCallback Completion callback. Can be NULL.
+ * \param pvArg Passed to the callback.
+ * \param pusHandle If not NULL the handle of the request is stored here.
+ *
+ * \return eMBErrorCode::MB_ENORES if MB_MASTER_REQUESTS_MAX requests are
+ *   already waiting for completion and eMBErrorCode::MB_EINVAL if the
+ *   request is not valid.
+ */
+eMBErrorCode    eMBSubmit( UCHAR ucId, UCHAR ucFunctionCode, USHORT usStartAddr, USHORT usLen,
+                           const USHORT * pusData, pxMBRequestCallback pxCallback, void *pvArg,
+                           USHORT * pusHandle );
+
+/*! \brief Change the scheduling of a request which has not been sent.
+ *
+ * \param usHandle Handle returned by eMBSubmit( ).
+ * \param ePriority Priority class of the request.
+ * \param ulDeadlineMs If not 0 the request must be sent within this number
+ *   of milliseconds after its submission. Otherwise it is completed with
+ *   eMBErrorCode::MB_ETIMEDOUT without being sent.
+ *
+ * \return eMBErrorCode::MB_EINVAL if the request has already been sent.
+ */
+eMBErrorCode    eMBSchedule( USHORT usHandle, eMBPriority ePriority, ULONG ulDeadlineMs );
+
+/*! \brief Return the scheduler statistics of a priority class. */
+eMBErrorCode    eMBGetSchedStats( eMBPriority ePriority, xMBSchedStats * pxStats );
+
+/*! \brief Clear the scheduler statistics of all priority classes. */
+void            vMBResetSchedStats( void );
+
+/*! \brief Number of submitted requests which have not completed yet. */
+USHORT          usMBGetSubmitted( void );
+
+/*! \brief Callback which receives a copy of every frame.
+ *
+ * It is called from eMBPoll( ) for every frame received by the protocol
+ * stack and for every frame which has been passed to the transmitter.
+ * \c pucPDU points to the Modbus PDU and is only valid during the call.
+ * The address is the slave address, the unit identifier or
+ * MB_TCP_PSEUDO_ADDRESS if the unit identifier is not known. \c usTID is
+ * the transaction identifier of the MBAP header of a Modbus TCP frame and
+ * 0 for serial frames.
+ */
+typedef void    ( *pvMBCaptureCB ) ( eMBMode eMode, BOOL xSent, UCHAR ucAddress, USHORT usTID,
+                                     const UCHAR * pucPDU, USHORT usLength );
+
+/*! \brief Install a callback for capturing frames, e.g. into a file.
+ *
+ * \param pvCaptureCB The capture callback or \c NULL to stop capturing.
+ */
+eMBErrorCode    eMBRegisterCaptureCB( pvMBCaptureCB pvCaptureCB );
+
+/*! \brief Link state of a slave.
+ *
+ * The round trip times are estimated from the responses of the slave,
+ * excluding responses to repeated requests. All times are in milliseconds.
+ */
+typedef struct
+{
+    BOOL            xOnline;    /*!< FALSE if a request got no answer after all retries. */
+    ULONG           ulSRTTMs;   /*!< Smoothed round trip time. */
+    ULONG           ulRTTVarMs; /*!< Variation of the round trip time. */
+    ULONG           ulRTOMs;    /*!< Current response timeout. */
+    ULONG           ulTimeouts; /*!< Transmissions without a response. */
+    ULONG           ulRetries;  /*!< Repeated transmissions. */
+} xMBSlaveStatus;
+
+/*! \brief Return the link state of a slave. */
+eMBErrorCode    eMBGetSlaveStatus( UCHAR ucId, xMBSlaveStatus * pxStatus );
+
+/* ----------------------- Scan engine --------------------------------------*/
+
+/*! \brief Modbus data tables. */
+typedef enum
+{
+    MB_TABLE_COILS,             /*!< Read with MB_FUNC_READ_COILS. */
+    MB_TABLE_DISCRETE_INPUTS,   /*!< Read with MB_FUNC_READ_DISCRETE_INPUTS. */
+    MB_TABLE_INPUT_REGISTERS,   /*!< Read with MB_FUNC_READ_INPUT_REGISTER. */
+    MB_TABLE_HOLDING_REGISTERS  /*!< Read with MB_FUNC_READ_HOLDING_REGISTER. */
+} eMBTable;
+
+/*! \brief Quality flags of the values in the scan image. */
+#define MB_SCAN_QUALITY_VALID       ( 0x01 )    /*!< Values have been read at least once. */
+#define MB_SCAN_QUALITY_STALE       ( 0x02 )    /*!< The last read failed. Values are older. */
+#define MB_SCAN_QUALITY_TIMEOUT     ( 0x04 )    /*!< The last read timed out. */
+#define MB_SCAN_QUALITY_EXCEPTION   ( 0x08 )    /*!< The last read returned an exception. */
+
+/*! \brief State of a block in the scan list. */
+typedef struct
+{
+    UCHAR           ucQuality;  /*!< MB_SCAN_QUALITY_* flags. */
+    ULONG           ulTimestampMs;      /*!< ulMBPortTimersGetMs( ) of the last good read. */
+    eMBException    eException; /*!< Exception of the last read. */
+    ULONG           ulCycles;   /*!< Number of reads. */
+    ULONG           ulErrors;   /*!< Failed reads. */
+    ULONG           ulOverruns; /*!< Cycles skipped because the last read was still busy. */
+    ULONG           ulJitterMaxMs;      /*!< Largest delay of a read after its due time. */
+} xMBScanStatus;
+
+/*! \brief Add a block of registers or coils to the scan list.
+ *
+ * The scan engine reads the block every \c ulPeriodMs milliseconds and
+ * stores the values in its local image. The engine is driven by eMBPoll( )
+ * and uses eMBSubmit( ). The read requests are due on a fixed time grid
+ * and get a deadline of one period. A read which can not be sent in time
+ * is dropped instead of delaying the following cycles.
+ *
+ * \param ucId Slave address or unit identifier.
+ * \param eTable Table of the block.
+ * \param usStartAddr First register or coil. Starts at 1.
+ * \param usLen Number of registers (at most 125) or coils (at most 2000).
+ * \param ulPeriodMs Scan period in milliseconds.
+ * \param ePriority Priority class of the read requests.
+ * \param pucScan If not NULL the index of the block is stored here.
+ *
+ * \return eMBErrorCode::MB_ENORES if the scan list or the image is full.
+ */
+eMBErrorCode    eMBScanAdd( UCHAR ucId, eMBTable eTable, USHORT usStartAddr, USHORT usLen,
+                            ULONG ulPeriodMs, eMBPriority ePriority, UCHAR * pucScan );
+
+/*! \brief Suspend or resume scanning of a block. */
+eMBErrorCode    eMBScanEnable( UCHAR ucScan, BOOL xEnable );
+
+/*! \brief Return the state of a block in the scan list. */
+eMBErrorCode    eMBScanGetStatus( UCHAR ucScan, xMBScanStatus * pxStatus );
+
+/*! \brief Read values from the scan image.
+ *
+ * The values must be located within a single block of the scan list.
+ * Coils and discrete inputs are returned as 0 or 1.
+ *
+ * \param pxStatus If not NULL the state of the block is stored here.
+ *
+ * \return eMBErrorCode::MB_ENOREG if no block contains the values.
+ */
+eMBErrorCode    eMBScanRead( UCHAR ucId, eMBTable eTable, USHORT usAddr, USHORT usNValues,
+                             USHORT * pusValues, xMBScanStatus * pxStatus );
+
+/* ----------------------- Read planner -------------------------------------*/
+
+/*! \brief A value or a group of values read by a read plan.
+ *
+ * The tags are owned by the application and must stay valid as long as
+ * the plan exists. Registers are stored as host values, coils and
+ * discrete inputs as 0 or 1.
+ */
+typedef struct
+{
+    UCHAR           ucId;       /*!< Slave address or unit identifier. */
+    eMBTable        eTable;     /*!< Table of the values. */
+    USHORT          usAddr;     /*!< First register or coil. Starts at 1. */
+    USHORT          usLen;      /*!< Number of registers or coils. */
+    USHORT         *pusValues;  /*!< Destination with room for usLen values. */
+    eMBErrorCode    eStatus;    /*!< Result of the last execution. */
+    eMBException    eException; /*!< Exception of the last execution. */
+} xMBTag;
+
+typedef void    ( *pxMBPlanCallback ) ( xMBTag * pxTags, USHORT usNTags, void *pvArg );
+
+/*! \brief Create a plan which reads a set of tags with few requests.
+ *
+ * Tags of the same slave and table are merged into one read request if
+ * the number of unused addresses between them is at most
+ * \c usGapTolerance, the request does not exceed 125 registers or 2000
+ * coils and does not touch an address range which has been learned as
+ * forbidden.
+ *
+ * \param pxTags The tags. They are not reordered.
+ * \param usNTags Number of tags. At most MB_MASTER_PLAN_TAGS_MAX.
+ * \param usGapTolerance Maximum number of unused addresses read to merge
+ *   two tags.
+ * \param pucPlan The index of the plan is stored here.
+ *
+ * \return eMBErrorCode::MB_ENORES if there is no free plan or the tags
+ *   need more than MB_MASTER_PLAN_READS_MAX requests.
+ */
+eMBErrorCode    eMBPlanCreate( xMBTag * pxTags, USHORT usNTags, USHORT usGapTolerance,
+                               UCHAR * pucPlan );
+
+/*! \brief Submit the read requests of a plan.
+ *
+ * When all requests have completed the values have been scattered to the
+ * tags and the callback is invoked from eMBPoll( ). The status of every
+ * tag is set. If a slave reports an illegal data address for a merged
+ * read, the unused addresses of this read are remembered as forbidden and
+ * the plan is rebuilt before its next execution.
+ *
+ * \return eMBErrorCode::MB_EILLSTATE if the plan is still executing.
+ */
+eMBErrorCode    eMBPlanExecute( UCHAR ucPlan, eMBPriority ePriority,
+                                pxMBPlanCallback pxCallback, void *pvArg );
+
+/*! \brief Number of read requests of a plan. */
+USHORT          usMBPlanGetReads( UCHAR ucPlan );
+
+/*! \brief Release a plan which is not executing. */
+eMBErrorCode    eMBPlanDelete( UCHAR ucPlan );
+
+/*! \brief Forget all address ranges learned as forbidden. */
+void            vMBPlanClearForbidden( void );
+
+/* ----------------------- Write combining ----------------------------------*/
+
+typedef void    ( *pxMBWriteCallback ) ( UCHAR ucId, eMBTable eTable, USHORT usAddr,
+                                         eMBErrorCode eStatus, eMBException eException,
+                                         void *pvArg );
+
+/*! \brief Buffer a write of a single holding register or coil.
+ *
+ * Buffered writes of a slave are sent in the order they were buffered.
+ * Writes which follow each other and go to ascending adjacent addresses
+ * are sent as one MB_FUNC_WRITE_MULTIPLE_REGISTERS or
+ * MB_FUNC_WRITE_MULTIPLE_COILS request, single values with
+ * MB_FUNC_WRITE_REGISTER or MB_FUNC_WRITE_SINGLE_COIL. Every value is
+ * sent even if an address is written more than once. The requests are
+ * sent when the oldest buffered write of the slave has waited
+ * MB_MASTER_WC_WINDOW_MS or on eMBWriteFlush( ). Writes which are sent
+ * later are always sent after writes which have been sent before. In
+ * Modbus TCP mode a write which times out is therefore not repeated but
+ * reported with eMBErrorCode::MB_ETIMEDOUT. Reads do not see buffered
+ * values.
+ *
+ * \param ucId Slave address or unit identifier.
+ * \param eTable MB_TABLE_HOLDING_REGISTERS or MB_TABLE_COILS.
+ * \param usAddr Register or coil. Starts at 1.
+ * \param usValue Register value. A coil is switched on if not 0.
+ * \param pxCallback Invoked from eMBPoll( ) with the status of the request
+ *   which carried the write. Can be NULL.
+ * \param pvArg Passed to the callback.
+ *
+ * \return eMBErrorCode::MB_ENORES if the buffer is full.
+ */
+eMBErrorCode    eMBWriteBuffered( UCHAR ucId, eMBTable eTable, USHORT usAddr, USHORT usValue,
+                                  pxMBWriteCallback pxCallback, void *pvArg );
+
+/*! \brief Send all buffered writes now.
+ *
+ * \return eMBErrorCode::MB_ENORES if not all writes could be submitted.
+ *   The remaining writes stay in the buffer.
+ */
+eMBErrorCode    eMBWriteFlush( void );
+
+/* ----------------------- Bus monitor --------------------------------------*/
+
+/*! \brief Flags of a frame recorded by the bus monitor. */
+#define MB_MONITOR_REQUEST      ( 0x01 )        /*!< Frame is a request. */
+#define MB_MONITOR_RESPONSE     ( 0x02 )        /*!< Frame is the response to the last request. */
+#define MB_MONITOR_EXCEPTION    ( 0x04 )        /*!< Response is an exception. */
+#define MB_MONITOR_INVALID      ( 0x08 )        /*!< CRC or LRC error. No data is recorded. */
+
+/*! \brief Size of the header of a record in the monitor buffer. */
+#define MB_MONITOR_HEADER_SIZE  ( 13 )
+
+/*! \brief Statistics of the bus monitor. */
+typedef struct
+{
+    ULONG           ulFrames;   /*!< Frames received including invalid ones. */
+    ULONG           ulRequests;
+    ULONG           ulResponses;
+    ULONG           ulExceptions;
+    ULONG           ulInvalid;  /*!< Frames with a CRC or LRC error. */
+    ULONG           ulUnanswered;       /*!< Requests without a response. */
+    ULONG           ulDropped;  /*!< Records lost because the buffer was full. */
+} xMBMonitorStats;
+
+/*! \brief Listen to a RTU or ASCII bus without sending anything.
+ *
+ * The monitor is used instead of eMBInit( ). It receives all frames on the
+ * bus, decides if they are requests or responses and records them in a
+ * buffer of MB_MONITOR_BUFFER_SIZE bytes. A response gets the transaction
+ * number of its request. The framer takes the time when the first
+ * character of a frame was received from vMBPortTimersGetTimestamp( ). It
+ * is zero if the frame was lost before it could be recorded.
+ *
+ * Every record starts with a header of MB_MONITOR_HEADER_SIZE bytes. All
+ * fields are in little endian byte order:
+ *  - seconds (4 bytes) and nanoseconds (4 bytes) of the timestamp,
+ *  - transaction number (2 bytes),
+ *  - flags (1 byte, see MB_MONITOR_REQUEST),
+ *  - number of data bytes (2 bytes).
+ * The data is the address and the PDU of the frame without the checksum.
+ */
+eMBErrorCode    eMBMonitorInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity );
+
+eMBErrorCode    eMBMonitorEnable( void );
+
+eMBErrorCode    eMBMonitorDisable( void );
+
+/*! \brief Record the received frames. Must be called periodically. */
+eMBErrorCode    eMBMonitorPoll( void );
+
+/*! \brief Remove complete records from the monitor buffer.
+ *
+ * It may be called from a different thread than eMBMonitorPoll( ) but
+ * only from one thread at a time.
+ *
+ * \param pucBuffer Records are copied to this buffer.
+ * \param usBufferLen Size of the buffer. Records which do not fit stay in
+ *   the monitor buffer.
+ * \param pusRead Number of bytes copied.
+ */
+eMBErrorCode    eMBMonitorRead( UCHAR * pucBuffer, USHORT usBufferLen, USHORT * pusRead );
 
-void            vMBReadOutputRegCallback ( USHORT usStartAddr, const UCHAR *cucBuffer, USHORT usLen );
+/*! \brief Return the statistics of the bus monitor. */
+eMBErrorCode    eMBMonitorGetStats( xMBMonitorStats * pxStats );
 
 #ifdef __cplusplus
 PR_END_EXTERN_C
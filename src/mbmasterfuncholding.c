@@ -36,6 +36,7 @@
 #include "mbconfig.h"
 #include "mbframe.h"
 #include "mbproto.h"
+#include "mbutils.h"
 
 #define MB_PDU_FUNC_READ_DATA_OFF               ( MB_PDU_DATA_OFF + 1 )
 #define MB_PDU_FUNC_READ_REGCNT_OFF             ( MB_PDU_DATA_OFF )
@@ -68,6 +69,7 @@ eMBException
 eMBFuncReadHoldingRegisterRespHandler( UCHAR * pucFrame, USHORT * usLen )
 {
     USHORT          usRegCnt;
+    USHORT          usRegs[MB_PDU_FUNC_READ_REGCNT_MAX];
     eMBException    eExStatus = MB_EX_NONE;
 
     usRegCnt = ( USHORT ) ( pucFrame[MB_PDU_FUNC_READ_REGCNT_OFF] / 2 );
@@ -76,7 +78,8 @@ eMBFuncReadHoldingRegisterRespHandler( UCHAR * pucFrame, USHORT * usLen )
     {
         if ( pucFrame[MB_PDU_FUNC_OFF] != MB_READ_HOLDING_REG_EXCEPTION )
         {
-            vMBReadHoldingRegCallback ( &pucFrame[MB_PDU_FUNC_READ_DATA_OFF], usRegCnt );
+            vMBUtilRegsToHost( usRegs, &pucFrame[MB_PDU_FUNC_READ_DATA_OFF], usRegCnt );
+            vMBReadHoldingRegCallback( usRegs, usRegCnt );
         }
         else
         {
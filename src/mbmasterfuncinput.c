@@ -35,6 +35,7 @@
 #include "mbframe.h"
 #include "mbconfig.h"
 #include "mbproto.h"
+#include "mbutils.h"
 
 #define MB_PDU_FUNC_READ_DATA_OFF            ( MB_PDU_DATA_OFF + 1 )
 #define MB_PDU_FUNC_READ_REGCNT_OFF          ( MB_PDU_DATA_OFF )
@@ -47,6 +48,7 @@ eMBException
 eMBFuncReadInputRegisterRespHandler( UCHAR * pucFrame, USHORT * usLen )
 {
     USHORT          usRegCnt;
+    USHORT          usRegs[MB_PDU_FUNC_READ_REGCNT_MAX];
     eMBException    eExStatus = MB_EX_NONE;
 
     usRegCnt = ( USHORT ) ( pucFrame[MB_PDU_FUNC_READ_REGCNT_OFF] / 2 );
@@ -55,7 +57,8 @@ eMBFuncReadInputRegisterRespHandler( UCHAR * pucFrame, USHORT * usLen )
     {
         if ( pucFrame[MB_PDU_FUNC_OFF] != MB_READ_INPUT_REG_EXCEPTION )
         {
-            vMBReadInputRegCallback ( &pucFrame[MB_PDU_FUNC_READ_DATA_OFF], usRegCnt );
+            vMBUtilRegsToHost( usRegs, &pucFrame[MB_PDU_FUNC_READ_DATA_OFF], usRegCnt );
+            vMBReadInputRegCallback( usRegs, usRegCnt );
         }
         else
         {
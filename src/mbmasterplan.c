@@ -0,0 +1,431 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbconfig.h"
+#include "mbproto.h"
+#include "mbutils.h"
+
+#if MB_MASTER_PLAN_ENABLED > 0
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_PLAN_REGISTERS_MAX   ( 125 )
+#define MB_PLAN_BITS_MAX        ( 2000 )
+
+#define MB_PLAN_IS_BITS( eTable ) \
+    ( ( ( eTable ) == MB_TABLE_COILS ) || ( ( eTable ) == MB_TABLE_DISCRETE_INPUTS ) )
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef struct
+{
+    UCHAR           ucId;
+    eMBTable        eTable;
+    USHORT          usStartAddr;
+    USHORT          usLen;
+    USHORT          usFirstTag; /*!< First tag of the read in ausOrder. */
+    USHORT          usNTags;
+} xMBPlanRead;
+
+typedef struct
+{
+    BOOL            xUsed;
+    xMBTag         *pxTags;
+    USHORT          usNTags;
+    USHORT          usGapTolerance;
+    ULONG           ulForbiddenGen;     /*!< Forbidden ranges the reads are based on. */
+    USHORT          ausOrder[MB_MASTER_PLAN_TAGS_MAX];  /*!< Tags sorted by slave, table and address. */
+    xMBPlanRead     xReads[MB_MASTER_PLAN_READS_MAX];
+    USHORT          usNReads;
+    USHORT          usOutstanding;      /*!< Reads of the current execution. */
+    pxMBPlanCallback pxCallback;
+    void           *pvArg;
+} xMBPlan;
+
+typedef struct
+{
+    BOOL            xUsed;
+    UCHAR           ucId;
+    eMBTable        eTable;
+    USHORT          usStartAddr;
+    USHORT          usLen;
+} xMBPlanForbidden;
+
+/* ----------------------- Static variables ---------------------------------*/
+static xMBPlan  xMBPlans[MB_MASTER_PLANS_MAX];
+static xMBPlanForbidden xMBForbidden[MB_MASTER_PLAN_FORBIDDEN_MAX];
+static ULONG    ulMBForbiddenGen;
+
+/* ----------------------- Static functions ---------------------------------*/
+static eMBErrorCode prveMBPlanBuild( xMBPlan * pxPlan );
+static BOOL     prvxMBPlanIsForbidden( UCHAR ucId, eMBTable eTable, ULONG ulStart, ULONG ulEnd );
+static void     prvvMBPlanLearnForbidden( xMBPlan * pxPlan, xMBPlanRead * pxRead );
+static void     prvvMBPlanComplete( const xMBRequestResult * pxResult, void *pvArg );
+static void     prvvMBPlanFinishRead( xMBPlan * pxPlan, xMBPlanRead * pxRead,
+                                      eMBErrorCode eStatus, eMBException eException );
+
+/* ----------------------- Start implementation -----------------------------*/
+eMBErrorCode
+eMBPlanCreate( xMBTag * pxTags, USHORT usNTags, USHORT usGapTolerance, UCHAR * pucPlan )
+{
+    eMBErrorCode    eStatus;
+    xMBPlan        *pxPlan = NULL;
+    USHORT          i, j, usTag;
+
+    if( ( pxTags == NULL ) || ( usNTags == 0 ) || ( usNTags > MB_MASTER_PLAN_TAGS_MAX ) ||
+        ( pucPlan == NULL ) )
+    {
+        return MB_EINVAL;
+    }
+    for( i = 0; i < usNTags; i++ )
+    {
+        if( ( pxTags[i].eTable > MB_TABLE_HOLDING_REGISTERS ) || ( pxTags[i].usAddr == 0 ) ||
+            ( pxTags[i].usLen == 0 ) || ( pxTags[i].pusValues == NULL ) ||
+            ( pxTags[i].ucId == MB_ADDRESS_BROADCAST ) ||
+            ( pxTags[i].usLen > ( MB_PLAN_IS_BITS( pxTags[i].eTable ) ? MB_PLAN_BITS_MAX : MB_PLAN_REGISTERS_MAX ) ) ||
+            ( ( ULONG )pxTags[i].usAddr + pxTags[i].usLen - 1 > 0xFFFFUL ) )
+        {
+            return MB_EINVAL;
+        }
+    }
+    for( i = 0; i < MB_MASTER_PLANS_MAX; i++ )
+    {
+        if( !xMBPlans[i].xUsed )
+        {
+            pxPlan = &xMBPlans[i];
+            break;
+        }
+    }
+    if( pxPlan == NULL )
+    {
+        return MB_ENORES;
+    }
+
+    pxPlan->pxTags = pxTags;
+    pxPlan->usNTags = usNTags;
+    pxPlan->usGapTolerance = usGapTolerance;
+    pxPlan->usOutstanding = 0;
+
+    /* Sort the tags by slave, table and address (insertion sort). */
+    for( i = 0; i < usNTags; i++ )
+    {
+        usTag = i;
+        for( j = i; j > 0; j-- )
+        {
+            xMBTag         *pxA = &pxTags[pxPlan->ausOrder[j - 1]];
+            xMBTag         *pxB = &pxTags[usTag];
+
+            if( ( pxA->ucId < pxB->ucId ) ||
+                ( ( pxA->ucId == pxB->ucId ) && ( pxA->eTable < pxB->eTable ) ) ||
+                ( ( pxA->ucId == pxB->ucId ) && ( pxA->eTable == pxB->eTable ) &&
+                  ( pxA->usAddr <= pxB->usAddr ) ) )
+            {
+                break;
+            }
+            pxPlan->ausOrder[j] = pxPlan->ausOrder[j - 1];
+        }
+        pxPlan->ausOrder[j] = usTag;
+    }
+
+    if( ( eStatus = prveMBPlanBuild( pxPlan ) ) == MB_ENOERR )
+    {
+        pxPlan->xUsed = TRUE;
+        *pucPlan = ( UCHAR )( pxPlan - &xMBPlans[0] );
+    }
+    return eStatus;
+}
+
+eMBErrorCode
+eMBPlanExecute( UCHAR ucPlan, eMBPriority ePriority, pxMBPlanCallback pxCallback, void *pvArg )
+{
+    eMBErrorCode    eStatus;
+    xMBPlan        *pxPlan;
+    xMBPlanRead    *pxRead;
+    USHORT          usHandle;
+    USHORT          i;
+    static const UCHAR ucFunctionCodes[] = {
+        MB_FUNC_READ_COILS, MB_FUNC_READ_DISCRETE_INPUTS,
+        MB_FUNC_READ_INPUT_REGISTER, MB_FUNC_READ_HOLDING_REGISTER
+    };
+
+    if( ( ucPlan >= MB_MASTER_PLANS_MAX ) || !xMBPlans[ucPlan].xUsed )
+    {
+        return MB_EINVAL;
+    }
+    pxPlan = &xMBPlans[ucPlan];
+    if( pxPlan->usOutstanding > 0 )
+    {
+        return MB_EILLSTATE;
+    }
+    if( ( pxPlan->ulForbiddenGen != ulMBForbiddenGen ) &&
+        ( ( eStatus = prveMBPlanBuild( pxPlan ) ) != MB_ENOERR ) )
+    {
+        return eStatus;
+    }
+
+    pxPlan->pxCallback = pxCallback;
+    pxPlan->pvArg = pvArg;
+
+    /* Count the reads first. A read which completes immediately must not
+     * finish the execution early. */
+    pxPlan->usOutstanding = ( USHORT )( pxPlan->usNReads + 1 );
+    for( i = 0; i < pxPlan->usNReads; i++ )
+    {
+        pxRead = &pxPlan->xReads[i];
+        eStatus = eMBSubmit( pxRead->ucId, ucFunctionCodes[pxRead->eTable], pxRead->usStartAddr,
+                             pxRead->usLen, NULL, prvvMBPlanComplete, pxRead, &usHandle );
+        if( eStatus == MB_ENOERR )
+        {
+            ( void )eMBSchedule( usHandle, ePriority, 0 );
+        }
+        else
+        {
+            prvvMBPlanFinishRead( pxPlan, pxRead, eStatus, MB_EX_NONE );
+        }
+    }
+    prvvMBPlanFinishRead( pxPlan, NULL, MB_ENOERR, MB_EX_NONE );
+    return MB_ENOERR;
+}
+
+USHORT
+usMBPlanGetReads( UCHAR ucPlan )
+{
+    if( ( ucPlan >= MB_MASTER_PLANS_MAX ) || !xMBPlans[ucPlan].xUsed )
+    {
+        return 0;
+    }
+    return xMBPlans[ucPlan].usNReads;
+}
+
+eMBErrorCode
+eMBPlanDelete( UCHAR ucPlan )
+{
+    if( ( ucPlan >= MB_MASTER_PLANS_MAX ) || !xMBPlans[ucPlan].xUsed )
+    {
+        return MB_EINVAL;
+    }
+    if( xMBPlans[ucPlan].usOutstanding > 0 )
+    {
+        return MB_EILLSTATE;
+    }
+    xMBPlans[ucPlan].xUsed = FALSE;
+    return MB_ENOERR;
+}
+
+void
+vMBPlanClearForbidden( void )
+{
+    memset( xMBForbidden, 0, sizeof( xMBForbidden ) );
+    ulMBForbiddenGen++;
+}
+
+/* Merge the sorted tags into reads. Walking the tags in address order and
+ * extending the current read as long as possible gives the minimum number
+ * of reads for the given limits. */
+static eMBErrorCode
+prveMBPlanBuild( xMBPlan * pxPlan )
+{
+    xMBPlanRead    *pxRead = NULL;
+    xMBTag         *pxTag;
+    ULONG           ulEnd = 0;  /* One past the last address of the read. */
+    ULONG           ulTagEnd;
+    USHORT          usMaxLen;
+    USHORT          i;
+
+    pxPlan->usNReads = 0;
+    for( i = 0; i < pxPlan->usNTags; i++ )
+    {
+        pxTag = &pxPlan->pxTags[pxPlan->ausOrder[i]];
+        ulTagEnd = ( ULONG )pxTag->usAddr + pxTag->usLen;
+        usMaxLen = MB_PLAN_IS_BITS( pxTag->eTable ) ? MB_PLAN_BITS_MAX : MB_PLAN_REGISTERS_MAX;
+
+        if( ( pxRead != NULL ) && ( pxRead->ucId == pxTag->ucId ) && ( pxRead->eTable == pxTag->eTable ) &&
+            ( ( ULONG )pxTag->usAddr <= ulEnd + pxPlan->usGapTolerance ) &&
+            ( ( ulTagEnd > ulEnd ? ulTagEnd : ulEnd ) - pxRead->usStartAddr <= usMaxLen ) &&
+            ( ( ( ULONG )pxTag->usAddr <= ulEnd ) ||
+              !prvxMBPlanIsForbidden( pxTag->ucId, pxTag->eTable, ulEnd, pxTag->usAddr ) ) )
+        {
+            /* Extend the current read. */
+            if( ulTagEnd > ulEnd )
+            {
+                ulEnd = ulTagEnd;
+            }
+            pxRead->usLen = ( USHORT )( ulEnd - pxRead->usStartAddr );
+            pxRead->usNTags++;
+        }
+        else if( pxPlan->usNReads < MB_MASTER_PLAN_READS_MAX )
+        {
+            pxRead = &pxPlan->xReads[pxPlan->usNReads++];
+            pxRead->ucId = pxTag->ucId;
+            pxRead->eTable = pxTag->eTable;
+            pxRead->usStartAddr = pxTag->usAddr;
+            pxRead->usLen = pxTag->usLen;
+            pxRead->usFirstTag = i;
+            pxRead->usNTags = 1;
+            ulEnd = ulTagEnd;
+        }
+        else
+        {
+            return MB_ENORES;
+        }
+    }
+    pxPlan->ulForbiddenGen = ulMBForbiddenGen;
+    return MB_ENOERR;
+}
+
+/* Check if a part of the addresses [ulStart, ulEnd) is forbidden. */
+static BOOL
+prvxMBPlanIsForbidden( UCHAR ucId, eMBTable eTable, ULONG ulStart, ULONG ulEnd )
+{
+    int             i;
+
+    for( i = 0; i < MB_MASTER_PLAN_FORBIDDEN_MAX; i++ )
+    {
+        if( xMBForbidden[i].xUsed && ( xMBForbidden[i].ucId == ucId ) &&
+            ( xMBForbidden[i].eTable == eTable ) &&
+            ( ulStart < ( ULONG )xMBForbidden[i].usStartAddr + xMBForbidden[i].usLen ) &&
+            ( ( ULONG )xMBForbidden[i].usStartAddr < ulEnd ) )
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Remember the unused addresses of a read as forbidden. */
+static void
+prvvMBPlanLearnForbidden( xMBPlan * pxPlan, xMBPlanRead * pxRead )
+{
+    xMBTag         *pxTag;
+    ULONG           ulCovered = pxRead->usStartAddr;
+    USHORT          i;
+    int             j;
+
+    for( i = pxRead->usFirstTag; i < pxRead->usFirstTag + pxRead->usNTags; i++ )
+    {
+        pxTag = &pxPlan->pxTags[pxPlan->ausOrder[i]];
+        if( pxTag->usAddr > ulCovered )
+        {
+            for( j = 0; j < MB_MASTER_PLAN_FORBIDDEN_MAX; j++ )
+            {
+                if( !xMBForbidden[j].xUsed )
+                {
+                    xMBForbidden[j].xUsed = TRUE;
+                    xMBForbidden[j].ucId = pxRead->ucId;
+                    xMBForbidden[j].eTable = pxRead->eTable;
+                    xMBForbidden[j].usStartAddr = ( USHORT )ulCovered;
+                    xMBForbidden[j].usLen = ( USHORT )( pxTag->usAddr - ulCovered );
+                    ulMBForbiddenGen++;
+                    break;
+                }
+            }
+        }
+        if( ( ULONG )pxTag->usAddr + pxTag->usLen > ulCovered )
+        {
+            ulCovered = ( ULONG )pxTag->usAddr + pxTag->usLen;
+        }
+    }
+}
+
+static void
+prvvMBPlanComplete( const xMBRequestResult * pxResult, void *pvArg )
+{
+    xMBPlanRead    *pxRead = ( xMBPlanRead * ) pvArg;
+    xMBPlan        *pxPlan;
+    xMBTag         *pxTag;
+    USHORT          i, j, usOff;
+
+    /* Find the plan which owns the read. */
+    for( i = 0; i < MB_MASTER_PLANS_MAX; i++ )
+    {
+        if( ( pxRead >= &xMBPlans[i].xReads[0] ) &&
+            ( pxRead < &xMBPlans[i].xReads[MB_MASTER_PLAN_READS_MAX] ) )
+        {
+            break;
+        }
+    }
+    pxPlan = &xMBPlans[i];
+
+    if( pxResult->eStatus == MB_ENOERR )
+    {
+        /* Scatter the values to the tags. */
+        for( i = pxRead->usFirstTag; i < pxRead->usFirstTag + pxRead->usNTags; i++ )
+        {
+            pxTag = &pxPlan->pxTags[pxPlan->ausOrder[i]];
+            usOff = ( USHORT )( pxTag->usAddr - pxRead->usStartAddr );
+            if( MB_PLAN_IS_BITS( pxRead->eTable ) )
+            {
+                for( j = 0; j < pxTag->usLen; j++, usOff++ )
+                {
+                    pxTag->pusValues[j] = ( USHORT )( ( pxResult->pucData[usOff / 8] >> ( usOff % 8 ) ) & 0x01 );
+                }
+            }
+            else
+            {
+                vMBUtilRegsToHost( pxTag->pusValues, &pxResult->pucData[2 * usOff], pxTag->usLen );
+            }
+        }
+    }
+    else if( ( pxResult->eException == MB_EX_ILLEGAL_DATA_ADDRESS ) && ( pxRead->usNTags > 1 ) )
+    {
+        prvvMBPlanLearnForbidden( pxPlan, pxRead );
+    }
+    prvvMBPlanFinishRead( pxPlan, pxRead, pxResult->eStatus, pxResult->eException );
+}
+
+/* Set the status of the tags of a read and invoke the callback after the
+ * last read. pxRead is NULL for the reference held during submission. */
+static void
+prvvMBPlanFinishRead( xMBPlan * pxPlan, xMBPlanRead * pxRead,
+                      eMBErrorCode eStatus, eMBException eException )
+{
+    xMBTag         *pxTag;
+    USHORT          i;
+
+    for( i = 0; ( pxRead != NULL ) && ( i < pxRead->usNTags ); i++ )
+    {
+        pxTag = &pxPlan->pxTags[pxPlan->ausOrder[pxRead->usFirstTag + i]];
+        pxTag->eStatus = eStatus;
+        pxTag->eException = eException;
+    }
+    if( ( --pxPlan->usOutstanding == 0 ) && ( pxPlan->pxCallback != NULL ) )
+    {
+        pxPlan->pxCallback( pxPlan->pxTags, pxPlan->usNTags, pxPlan->pvArg );
+    }
+}
+
+#endif
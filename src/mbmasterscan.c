@@ -0,0 +1,273 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbconfig.h"
+#include "mbproto.h"
+#include "mbmasterscan.h"
+#include "mbutils.h"
+
+#if MB_MASTER_SCAN_ENABLED > 0
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef struct
+{
+    BOOL            xUsed;
+    BOOL            xEnabled;
+    BOOL            xBusy;      /*!< A read request has been submitted. */
+    UCHAR           ucId;
+    eMBTable        eTable;
+    USHORT          usStartAddr;
+    USHORT          usLen;
+    USHORT          usImageOff; /*!< First value in the image. */
+    ULONG           ulPeriodMs;
+    ULONG           ulDueMs;    /*!< Time of the next read. */
+    eMBPriority     ePriority;
+    xMBScanStatus   xStatus;
+} xMBScanEntry;
+
+/* ----------------------- Static variables ---------------------------------*/
+static xMBScanEntry xMBScanList[MB_MASTER_SCAN_MAX];
+static USHORT   usMBScanImage[MB_MASTER_SCAN_IMAGE_SIZE];
+static USHORT   usMBScanImageUsed;
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvMBScanComplete( const xMBRequestResult * pxResult, void *pvArg );
+
+/* ----------------------- Start implementation -----------------------------*/
+eMBErrorCode
+eMBScanAdd( UCHAR ucId, eMBTable eTable, USHORT usStartAddr, USHORT usLen,
+            ULONG ulPeriodMs, eMBPriority ePriority, UCHAR * pucScan )
+{
+    xMBScanEntry   *pxEntry = NULL;
+    USHORT          usMaxLen;
+    int             i;
+
+    usMaxLen = ( eTable == MB_TABLE_COILS ) || ( eTable == MB_TABLE_DISCRETE_INPUTS ) ? 2000 : 125;
+    if( ( eTable > MB_TABLE_HOLDING_REGISTERS ) || ( ePriority >= MB_PRIO_CLASSES ) ||
+        ( ucId == MB_ADDRESS_BROADCAST ) || ( usStartAddr == 0 ) || ( usLen == 0 ) ||
+        ( usLen > usMaxLen ) || ( ( ULONG )usStartAddr + usLen - 1 > 0xFFFFUL ) || ( ulPeriodMs == 0 ) )
+    {
+        return MB_EINVAL;
+    }
+    for( i = 0; i < MB_MASTER_SCAN_MAX; i++ )
+    {
+        if( !xMBScanList[i].xUsed )
+        {
+            pxEntry = &xMBScanList[i];
+            break;
+        }
+    }
+    if( ( pxEntry == NULL ) || ( usMBScanImageUsed + usLen > MB_MASTER_SCAN_IMAGE_SIZE ) )
+    {
+        return MB_ENORES;
+    }
+
+    memset( pxEntry, 0, sizeof( xMBScanEntry ) );
+    pxEntry->xUsed = TRUE;
+    pxEntry->xEnabled = TRUE;
+    pxEntry->ucId = ucId;
+    pxEntry->eTable = eTable;
+    pxEntry->usStartAddr = usStartAddr;
+    pxEntry->usLen = usLen;
+    pxEntry->usImageOff = usMBScanImageUsed;
+    pxEntry->ulPeriodMs = ulPeriodMs;
+    pxEntry->ulDueMs = ulMBPortTimersGetMs(  );
+    pxEntry->ePriority = ePriority;
+    usMBScanImageUsed += usLen;
+
+    if( pucScan != NULL )
+    {
+        *pucScan = ( UCHAR )i;
+    }
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBScanEnable( UCHAR ucScan, BOOL xEnable )
+{
+    if( ( ucScan >= MB_MASTER_SCAN_MAX ) || !xMBScanList[ucScan].xUsed )
+    {
+        return MB_EINVAL;
+    }
+    if( xEnable && !xMBScanList[ucScan].xEnabled )
+    {
+        xMBScanList[ucScan].ulDueMs = ulMBPortTimersGetMs(  );
+    }
+    xMBScanList[ucScan].xEnabled = xEnable;
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBScanGetStatus( UCHAR ucScan, xMBScanStatus * pxStatus )
+{
+    if( ( ucScan >= MB_MASTER_SCAN_MAX ) || !xMBScanList[ucScan].xUsed || ( pxStatus == NULL ) )
+    {
+        return MB_EINVAL;
+    }
+    *pxStatus = xMBScanList[ucScan].xStatus;
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBScanRead( UCHAR ucId, eMBTable eTable, USHORT usAddr, USHORT usNValues,
+             USHORT * pusValues, xMBScanStatus * pxStatus )
+{
+    xMBScanEntry   *pxEntry;
+    int             i;
+
+    for( i = 0; i < MB_MASTER_SCAN_MAX; i++ )
+    {
+        pxEntry = &xMBScanList[i];
+        if( pxEntry->xUsed && ( pxEntry->ucId == ucId ) && ( pxEntry->eTable == eTable ) &&
+            ( usAddr >= pxEntry->usStartAddr ) &&
+            ( ( ULONG )usAddr + usNValues <= ( ULONG )pxEntry->usStartAddr + pxEntry->usLen ) )
+        {
+            memcpy( pusValues, &usMBScanImage[pxEntry->usImageOff + usAddr - pxEntry->usStartAddr],
+                    usNValues * sizeof( USHORT ) );
+            if( pxStatus != NULL )
+            {
+                *pxStatus = pxEntry->xStatus;
+            }
+            return MB_ENOERR;
+        }
+    }
+    return MB_ENOREG;
+}
+
+void
+vMBMasterScanPoll( void )
+{
+    static const UCHAR ucFunctionCodes[] = {
+        MB_FUNC_READ_COILS, MB_FUNC_READ_DISCRETE_INPUTS,
+        MB_FUNC_READ_INPUT_REGISTER, MB_FUNC_READ_HOLDING_REGISTER
+    };
+    xMBScanEntry   *pxEntry;
+    ULONG           ulNowMs = ulMBPortTimersGetMs(  );
+    ULONG           ulLateMs;
+    USHORT          usHandle;
+    int             i;
+
+    for( i = 0; i < MB_MASTER_SCAN_MAX; i++ )
+    {
+        pxEntry = &xMBScanList[i];
+        if( !pxEntry->xUsed || !pxEntry->xEnabled ||
+            ( ( LONG )( ulNowMs - pxEntry->ulDueMs ) < 0 ) )
+        {
+            continue;
+        }
+
+        /* The next read is due one period after this one and not one
+         * period after now. Otherwise the delays would add up. If we are
+         * more than a period late the grid is moved. */
+        ulLateMs = ulNowMs - pxEntry->ulDueMs;
+        pxEntry->ulDueMs += pxEntry->ulPeriodMs;
+        if( ulLateMs >= pxEntry->ulPeriodMs )
+        {
+            pxEntry->ulDueMs = ulNowMs + pxEntry->ulPeriodMs;
+        }
+
+        if( pxEntry->xBusy )
+        {
+            pxEntry->xStatus.ulOverruns++;
+        }
+        else if( eMBSubmit( pxEntry->ucId, ucFunctionCodes[pxEntry->eTable], pxEntry->usStartAddr,
+                            pxEntry->usLen, NULL, prvvMBScanComplete, pxEntry,
+                            &usHandle ) == MB_ENOERR )
+        {
+            ( void )eMBSchedule( usHandle, pxEntry->ePriority, pxEntry->ulPeriodMs );
+            pxEntry->xBusy = TRUE;
+            if( ulLateMs > pxEntry->xStatus.ulJitterMaxMs )
+            {
+                pxEntry->xStatus.ulJitterMaxMs = ulLateMs;
+            }
+        }
+        else
+        {
+            /* No free request. Counted like a cycle where the last read
+             * was still busy. */
+            pxEntry->xStatus.ulOverruns++;
+        }
+    }
+}
+
+static void
+prvvMBScanComplete( const xMBRequestResult * pxResult, void *pvArg )
+{
+    xMBScanEntry   *pxEntry = ( xMBScanEntry * ) pvArg;
+    xMBScanStatus  *pxStatus = &pxEntry->xStatus;
+    USHORT         *pusValue = &usMBScanImage[pxEntry->usImageOff];
+    USHORT          i;
+
+    pxEntry->xBusy = FALSE;
+    pxStatus->ulCycles++;
+    pxStatus->eException = pxResult->eException;
+    if( pxResult->eStatus == MB_ENOERR )
+    {
+        if( ( pxEntry->eTable == MB_TABLE_COILS ) || ( pxEntry->eTable == MB_TABLE_DISCRETE_INPUTS ) )
+        {
+            for( i = 0; i < pxEntry->usLen; i++ )
+            {
+                pusValue[i] = ( USHORT )( ( pxResult->pucData[i / 8] >> ( i % 8 ) ) & 0x01 );
+            }
+        }
+        else
+        {
+            vMBUtilRegsToHost( pusValue, pxResult->pucData, pxEntry->usLen );
+        }
+        pxStatus->ulTimestampMs = ulMBPortTimersGetMs(  );
+        pxStatus->ucQuality = MB_SCAN_QUALITY_VALID;
+    }
+    else
+    {
+        /* Keep the old values but mark them. */
+        pxStatus->ulErrors++;
+        pxStatus->ucQuality &= MB_SCAN_QUALITY_VALID;
+        pxStatus->ucQuality |= MB_SCAN_QUALITY_STALE;
+        if( pxResult->eStatus == MB_ETIMEDOUT )
+        {
+            pxStatus->ucQuality |= MB_SCAN_QUALITY_TIMEOUT;
+        }
+        else if( pxResult->eException != MB_EX_NONE )
+        {
+            pxStatus->ucQuality |= MB_SCAN_QUALITY_EXCEPTION;
+        }
+    }
+}
+
+#endif
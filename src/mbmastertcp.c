@@ -0,0 +1,459 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbconfig.h"
+#include "mbframe.h"
+#include "mbport.h"
+#include "mbmastertcp.h"
+
+#if MB_TCP_ENABLED > 0
+
+/* ----------------------- Defines ------------------------------------------*/
+
+/* ----------------------- MBAP Header --------------------------------------*/
+/* The layout of the MBAP header is described in mbtcp.c. A master fills in
+ * every field of the header itself. The transaction identifier is taken
+ * from a per connection counter. Up to MB_TCP_MASTER_PIPELINE_DEPTH
+ * requests can be outstanding on a connection and a response is matched
+ * to its request by the transaction identifier. Servers are allowed to
+ * answer requests in any order.
+ */
+#define MB_TCP_TID          0
+#define MB_TCP_PID          2
+#define MB_TCP_LEN          4
+#define MB_TCP_UID          6
+#define MB_TCP_FUNC         7
+
+#define MB_TCP_PROTOCOL_ID  0   /* 0 = Modbus Protocol */
+
+#define MB_TCP_BUF_SIZE     ( MB_TCP_FUNC + MB_PDU_SIZE_MAX )
+#define MB_TCP_NO_CONNECTION    ( 0xFF )
+
+/* Period of the timer which checks the outstanding transactions. */
+#define MB_TCP_TIMER_TICK_MS    ( 50 )
+
+/* ----------------------- Type definitions ---------------------------------*/
+typedef struct
+{
+    BOOL            xUsed;      /*!< The request is waiting for its response. */
+    BOOL            xLost;      /*!< The connection has been lost. */
+    USHORT          usTID;      /*!< Transaction identifier of the request. */
+    UCHAR           ucUnitId;   /*!< Unit identifier of the request. */
+    ULONG           ulSentMs;   /*!< Time when the request has been sent. */
+    USHORT          usContext;  /*!< Passed from the sender to the receiver. */
+} xMBMasterTCPTransaction;
+
+typedef struct
+{
+    xMBMasterTCPTransaction xTransactions[MB_TCP_MASTER_PIPELINE_DEPTH];
+    USHORT          usInFlight; /*!< Number of used transaction slots. */
+    USHORT          usNextTID;  /*!< Transaction identifier for the next request. */
+} xMBMasterTCPConnection;
+
+/* ----------------------- Static variables ---------------------------------*/
+static USHORT   usMBTCPDefaultPort;
+
+/* Maps a unit identifier to the connection of the server which hosts it. */
+static UCHAR    ucMBTCPUnitConnection[256];
+static xMBMasterTCPConnection xMBTCPConnections[MB_TCP_MASTER_CONNECTIONS_MAX];
+
+static UCHAR    aucMBTCPSndBuf[MB_TCP_BUF_SIZE];
+
+/* Context of the next request and of the last received response. */
+static USHORT   usMBTCPSendContext = MB_HANDLE_INVALID;
+static USHORT   usMBTCPRcvContext = MB_HANDLE_INVALID;
+
+/* Number of transactions whose connection has been lost. They keep their
+ * slot until the master has failed the request. */
+static USHORT   usMBTCPLost;
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvMBMasterTCPResetTransactions( void );
+static void     prvvMBMasterTCPFree( xMBMasterTCPConnection * pxConnection,
+                                     xMBMasterTCPTransaction * pxTransaction );
+
+/* ----------------------- Start implementation -----------------------------*/
+eMBErrorCode
+eMBMasterTCPDoInit( USHORT usTCPPort )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+    int             i;
+
+    usMBTCPDefaultPort = usTCPPort;
+    memset( ucMBTCPUnitConnection, MB_TCP_NO_CONNECTION, sizeof( ucMBTCPUnitConnection ) );
+    prvvMBMasterTCPResetTransactions(  );
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        xMBTCPConnections[i].usNextTID = 0;
+    }
+
+    if( xMBTCPPortInit( usTCPPort ) == FALSE )
+    {
+        eStatus = MB_EPORTERR;
+    }
+    /* The timer is used as a periodic tick for the response timeouts. */
+    else if( xMBPortTimersInit( MB_TCP_TIMER_TICK_MS * 20 ) == FALSE )
+    {
+        eStatus = MB_EPORTERR;
+    }
+    return eStatus;
+}
+
+void
+eMBMasterTCPStart( void )
+{
+    /* Connections are established by the porting layer in the background.
+     * A request to a server which is not connected simply fails. */
+    vMBPortTimersEnable(  );
+    ( void )xMBPortEventPost( EV_READY );
+}
+
+void
+eMBMasterTCPStop( void )
+{
+    vMBPortTimersDisable(  );
+    vMBTCPPortDisable(  );
+    prvvMBMasterTCPResetTransactions(  );
+}
+
+eMBErrorCode
+eMBTCPAddTarget( UCHAR ucId, const CHAR * szHostAddress, USHORT usTCPPort )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+    UCHAR           ucConnection;
+
+    if( szHostAddress == NULL )
+    {
+        eStatus = MB_EINVAL;
+    }
+    else if( xMBTCPPortConnect( szHostAddress,
+                                usTCPPort == MB_TCP_PORT_USE_DEFAULT ? usMBTCPDefaultPort : usTCPPort,
+                                &ucConnection ) == FALSE )
+    {
+        eStatus = MB_EPORTERR;
+    }
+    else if( ucConnection >= MB_TCP_MASTER_CONNECTIONS_MAX )
+    {
+        eStatus = MB_ENORES;
+    }
+    else
+    {
+        ucMBTCPUnitConnection[ucId] = ucConnection;
+    }
+    return eStatus;
+}
+
+void
+vMBMasterTCPGetBuffer( UCHAR ** ppucFrame )
+{
+    *ppucFrame = &aucMBTCPSndBuf[MB_TCP_FUNC];
+}
+
+eMBErrorCode
+eMBMasterTCPSend( UCHAR ucUnitId, const UCHAR * pucFrame, USHORT usLength )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+    UCHAR          *pucMBTCPFrame = ( UCHAR * ) pucFrame - MB_TCP_FUNC;
+    USHORT          usTCPLength = usLength + MB_TCP_FUNC;
+    UCHAR           ucConnection = ucMBTCPUnitConnection[ucUnitId];
+    xMBMasterTCPConnection *pxConnection = NULL;
+    xMBMasterTCPTransaction *pxTransaction = NULL;
+    USHORT          usContext = usMBTCPSendContext;
+    int             i;
+
+    /* The context is only used for a single request. */
+    usMBTCPSendContext = MB_HANDLE_INVALID;
+
+    if( ucConnection == MB_TCP_NO_CONNECTION )
+    {
+        /* No server has been configured for this unit. */
+        eStatus = MB_EINVAL;
+    }
+    else if( !xMBTCPPortIsConnected( ucConnection ) )
+    {
+        /* Still connecting or reconnecting. Don't wait for it. */
+        eStatus = MB_EIO;
+    }
+    else
+    {
+        pxConnection = &xMBTCPConnections[ucConnection];
+        for( i = 0; i < MB_TCP_MASTER_PIPELINE_DEPTH; i++ )
+        {
+            if( !pxConnection->xTransactions[i].xUsed )
+            {
+                pxTransaction = &pxConnection->xTransactions[i];
+                break;
+            }
+        }
+        if( pxTransaction == NULL )
+        {
+            /* All transactions on this connection are in flight. */
+            eStatus = MB_ENORES;
+        }
+    }
+
+    if( eStatus == MB_ENOERR )
+    {
+        /* The length field counts the unit identifier and the Modbus PDU. */
+        pucMBTCPFrame[MB_TCP_TID] = ( UCHAR )( pxConnection->usNextTID >> 8U );
+        pucMBTCPFrame[MB_TCP_TID + 1] = ( UCHAR )( pxConnection->usNextTID & 0xFF );
+        pucMBTCPFrame[MB_TCP_PID] = MB_TCP_PROTOCOL_ID >> 8U;
+        pucMBTCPFrame[MB_TCP_PID + 1] = MB_TCP_PROTOCOL_ID & 0xFF;
+        pucMBTCPFrame[MB_TCP_LEN] = ( UCHAR )( ( usLength + 1 ) >> 8U );
+        pucMBTCPFrame[MB_TCP_LEN + 1] = ( UCHAR )( ( usLength + 1 ) & 0xFF );
+        pucMBTCPFrame[MB_TCP_UID] = ucUnitId;
+
+        if( xMBTCPPortSendRequest( ucConnection, pucMBTCPFrame, usTCPLength ) == FALSE )
+        {
+            eStatus = MB_EIO;
+        }
+        else
+        {
+            /* A late response to a request which has timed out is dropped
+             * because no transaction with its identifier is in flight. */
+            pxTransaction->xUsed = TRUE;
+            pxTransaction->xLost = FALSE;
+            pxTransaction->usTID = pxConnection->usNextTID++;
+            pxTransaction->ucUnitId = ucUnitId;
+            pxTransaction->ulSentMs = ulMBPortTimersGetMs(  );
+            pxTransaction->usContext = usContext;
+            pxConnection->usInFlight++;
+            ( void )xMBPortEventPost( EV_FRAME_SENT );
+        }
+    }
+    return eStatus;
+}
+
+eMBErrorCode
+eMBMasterTCPReceive( UCHAR * pucRcvAddress, UCHAR ** ppucFrame, USHORT * pusLength )
+{
+    eMBErrorCode    eStatus = MB_EIO;
+    UCHAR          *pucMBTCPFrame;
+    UCHAR           ucConnection;
+    USHORT          usLength;
+    USHORT          usTID;
+    USHORT          usPID;
+    xMBMasterTCPConnection *pxConnection;
+    xMBMasterTCPTransaction *pxTransaction;
+    int             i;
+
+    usMBTCPRcvContext = MB_HANDLE_INVALID;
+    if( ( xMBTCPPortGetResponse( &ucConnection, &pucMBTCPFrame, &usLength ) != FALSE ) &&
+        ( ucConnection < MB_TCP_MASTER_CONNECTIONS_MAX ) && ( usLength > MB_TCP_FUNC ) )
+    {
+        pxConnection = &xMBTCPConnections[ucConnection];
+
+        usTID = ( USHORT )( pucMBTCPFrame[MB_TCP_TID] << 8U );
+        usTID |= ( USHORT )( pucMBTCPFrame[MB_TCP_TID + 1] );
+        usPID = ( USHORT )( pucMBTCPFrame[MB_TCP_PID] << 8U );
+        usPID |= ( USHORT )( pucMBTCPFrame[MB_TCP_PID + 1] );
+
+        for( i = 0; ( usPID == MB_TCP_PROTOCOL_ID ) && ( i < MB_TCP_MASTER_PIPELINE_DEPTH ); i++ )
+        {
+            pxTransaction = &pxConnection->xTransactions[i];
+            if( pxTransaction->xUsed && !pxTransaction->xLost && ( pxTransaction->usTID == usTID ) &&
+                ( pxTransaction->ucUnitId == pucMBTCPFrame[MB_TCP_UID] ) )
+            {
+                prvvMBMasterTCPFree( pxConnection, pxTransaction );
+                usMBTCPRcvContext = pxTransaction->usContext;
+
+                /* Unlike a server the master uses the unit identifier as the
+                 * address of the response. */
+                *pucRcvAddress = pucMBTCPFrame[MB_TCP_UID];
+                *ppucFrame = &pucMBTCPFrame[MB_TCP_FUNC];
+                *pusLength = usLength - MB_TCP_FUNC;
+                eStatus = MB_ENOERR;
+                break;
+            }
+        }
+    }
+    return eStatus;
+}
+
+BOOL
+xMBMasterTCPTimerExpired( void )
+{
+    xMBMasterTCPTransaction *pxTransaction;
+    ULONG           ulNowMs = ulMBPortTimersGetMs(  );
+    int             i, j;
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        for( j = 0; ( xMBTCPConnections[i].usInFlight > 0 ) && ( j < MB_TCP_MASTER_PIPELINE_DEPTH ); j++ )
+        {
+            pxTransaction = &xMBTCPConnections[i].xTransactions[j];
+            if( pxTransaction->xUsed &&
+                ( ( ULONG )( ulNowMs - pxTransaction->ulSentMs ) >= MB_TCP_MASTER_TIMEOUT_MS ) )
+            {
+                /* No response within MB_TCP_MASTER_TIMEOUT_MS. Free the slot
+                 * for the next request. */
+                prvvMBMasterTCPFree( &xMBTCPConnections[i], pxTransaction );
+            }
+        }
+    }
+    vMBPortTimersEnable(  );
+    return FALSE;
+}
+
+void
+vMBMasterTCPSetContext( USHORT usContext )
+{
+    usMBTCPSendContext = usContext;
+}
+
+USHORT
+usMBMasterTCPGetContext( void )
+{
+    return usMBTCPRcvContext;
+}
+
+/* Drop the transaction of a request which has timed out in the master.
+ * A late response to it is discarded like any other unknown response. */
+void
+vMBMasterTCPAbort( USHORT usContext )
+{
+    xMBMasterTCPTransaction *pxTransaction;
+    int             i, j;
+
+    for( i = 0; ( usContext != MB_HANDLE_INVALID ) && ( i < MB_TCP_MASTER_CONNECTIONS_MAX ); i++ )
+    {
+        for( j = 0; j < MB_TCP_MASTER_PIPELINE_DEPTH; j++ )
+        {
+            pxTransaction = &xMBTCPConnections[i].xTransactions[j];
+            if( pxTransaction->xUsed && ( pxTransaction->usContext == usContext ) )
+            {
+                prvvMBMasterTCPFree( &xMBTCPConnections[i], pxTransaction );
+                return;
+            }
+        }
+    }
+}
+
+/* Called by the porting layer when a connection has been closed. Its
+ * requests will never be answered. */
+void
+vMBMasterTCPConnectionLost( UCHAR ucConnection )
+{
+    xMBMasterTCPTransaction *pxTransaction;
+    int             j;
+
+    for( j = 0; ( ucConnection < MB_TCP_MASTER_CONNECTIONS_MAX ) && ( j < MB_TCP_MASTER_PIPELINE_DEPTH ); j++ )
+    {
+        pxTransaction = &xMBTCPConnections[ucConnection].xTransactions[j];
+        if( pxTransaction->xUsed && !pxTransaction->xLost )
+        {
+            pxTransaction->xLost = TRUE;
+            usMBTCPLost++;
+        }
+    }
+}
+
+/* Return TRUE if the connection of a request has been lost. */
+BOOL
+xMBMasterTCPIsLost( USHORT usContext )
+{
+    xMBMasterTCPTransaction *pxTransaction;
+    int             i, j;
+
+    for( i = 0; ( usMBTCPLost > 0 ) && ( i < MB_TCP_MASTER_CONNECTIONS_MAX ); i++ )
+    {
+        for( j = 0; j < MB_TCP_MASTER_PIPELINE_DEPTH; j++ )
+        {
+            pxTransaction = &xMBTCPConnections[i].xTransactions[j];
+            if( pxTransaction->xUsed && ( pxTransaction->usContext == usContext ) )
+            {
+                return pxTransaction->xLost;
+            }
+        }
+    }
+    return FALSE;
+}
+
+/* Transaction identifier of a frame returned by eMBMasterTCPReceive( ) or
+ * sent with eMBMasterTCPSend( ). The MBAP header is stored in front of the
+ * PDU. */
+USHORT
+usMBMasterTCPGetTID( const UCHAR * pucFrame )
+{
+    const UCHAR    *pucMBTCPFrame = pucFrame - MB_TCP_FUNC;
+
+    return ( USHORT )( ( pucMBTCPFrame[MB_TCP_TID] << 8U ) | pucMBTCPFrame[MB_TCP_TID + 1] );
+}
+
+USHORT
+usMBTCPGetPending( void )
+{
+    USHORT          usPending = 0;
+    int             i;
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        usPending += xMBTCPConnections[i].usInFlight;
+    }
+    return usPending;
+}
+
+static void
+prvvMBMasterTCPResetTransactions( void )
+{
+    int             i, j;
+
+    for( i = 0; i < MB_TCP_MASTER_CONNECTIONS_MAX; i++ )
+    {
+        for( j = 0; j < MB_TCP_MASTER_PIPELINE_DEPTH; j++ )
+        {
+            xMBTCPConnections[i].xTransactions[j].xUsed = FALSE;
+        }
+        xMBTCPConnections[i].usInFlight = 0;
+    }
+    usMBTCPLost = 0;
+}
+
+static void
+prvvMBMasterTCPFree( xMBMasterTCPConnection * pxConnection, xMBMasterTCPTransaction * pxTransaction )
+{
+    if( pxTransaction->xLost )
+    {
+        usMBTCPLost--;
+    }
+    pxTransaction->xUsed = FALSE;
+    pxConnection->usInFlight--;
+}
+
+#endif
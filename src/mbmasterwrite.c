@@ -0,0 +1,311 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbconfig.h"
+#include "mbproto.h"
+#include "mbmasterwrite.h"
+
+#if MB_MASTER_WC_ENABLED > 0
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_WC_REGISTERS_MAX     ( 123 )
+#define MB_WC_COILS_MAX         ( 1968 )
+
+/* ----------------------- Type definitions ---------------------------------*/
+
+/* Writes which have been combined into one request. */
+typedef struct
+{
+    BOOL            xUsed;
+} xMBWriteBatch;
+
+typedef struct
+{
+    enum
+    {
+        WR_FREE,                /*!< Entry is not used. */
+        WR_PENDING,             /*!< Waiting in the buffer. */
+        WR_SENT                 /*!< Part of a submitted request. */
+    } eState;
+    UCHAR           ucId;
+    eMBTable        eTable;
+    USHORT          usAddr;
+    USHORT          usValue;
+    ULONG           ulSequence;
+    ULONG           ulQueuedMs;
+    xMBWriteBatch  *pxBatch;
+    pxMBWriteCallback pxCallback;
+    void           *pvArg;
+} xMBWrite;
+
+/* ----------------------- Static variables ---------------------------------*/
+static xMBWrite xMBWrites[MB_MASTER_WC_WRITES_MAX];
+static xMBWriteBatch xMBWriteBatches[MB_MASTER_REQUESTS_MAX];
+static ULONG    ulMBWriteSequence;
+
+static USHORT   ausMBWriteOrder[MB_MASTER_WC_WRITES_MAX];
+static USHORT   ausMBWriteValues[MB_WC_COILS_MAX];
+
+/* ----------------------- Static functions ---------------------------------*/
+static xMBWrite *prvpxMBWriteOldest( void );
+static eMBErrorCode prveMBWriteFlushSlave( UCHAR ucId );
+static eMBErrorCode prveMBWriteSubmit( UCHAR ucId, eMBTable eTable, USHORT usFirst, USHORT usLast,
+                                       USHORT usStartAddr, USHORT usLen );
+static void     prvvMBWriteComplete( const xMBRequestResult * pxResult, void *pvArg );
+
+/* ----------------------- Start implementation -----------------------------*/
+eMBErrorCode
+eMBWriteBuffered( UCHAR ucId, eMBTable eTable, USHORT usAddr, USHORT usValue,
+                  pxMBWriteCallback pxCallback, void *pvArg )
+{
+    xMBWrite       *pxWrite = NULL;
+    int             i;
+
+    if( ( ( eTable != MB_TABLE_HOLDING_REGISTERS ) && ( eTable != MB_TABLE_COILS ) ) || ( usAddr == 0 ) )
+    {
+        return MB_EINVAL;
+    }
+    for( i = 0; i < MB_MASTER_WC_WRITES_MAX; i++ )
+    {
+        if( xMBWrites[i].eState == WR_FREE )
+        {
+            pxWrite = &xMBWrites[i];
+            break;
+        }
+    }
+    if( pxWrite == NULL )
+    {
+        return MB_ENORES;
+    }
+    pxWrite->eState = WR_PENDING;
+    pxWrite->ucId = ucId;
+    pxWrite->eTable = eTable;
+    pxWrite->usAddr = usAddr;
+    pxWrite->usValue = eTable == MB_TABLE_COILS ? ( usValue != 0 ) : usValue;
+    pxWrite->ulSequence = ulMBWriteSequence++;
+    pxWrite->ulQueuedMs = ulMBPortTimersGetMs(  );
+    pxWrite->pxBatch = NULL;
+    pxWrite->pxCallback = pxCallback;
+    pxWrite->pvArg = pvArg;
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBWriteFlush( void )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+    xMBWrite       *pxWrite;
+
+    while( ( eStatus == MB_ENOERR ) && ( ( pxWrite = prvpxMBWriteOldest(  ) ) != NULL ) )
+    {
+        eStatus = prveMBWriteFlushSlave( pxWrite->ucId );
+    }
+    return eStatus;
+}
+
+void
+vMBMasterWritePoll( void )
+{
+#if MB_MASTER_WC_WINDOW_MS > 0
+    ULONG           ulNowMs = ulMBPortTimersGetMs(  );
+    xMBWrite       *pxWrite;
+
+    /* Slaves are flushed in the order of their oldest write. */
+    while( ( ( pxWrite = prvpxMBWriteOldest(  ) ) != NULL ) &&
+           ( ( ULONG )( ulNowMs - pxWrite->ulQueuedMs ) >= MB_MASTER_WC_WINDOW_MS ) )
+    {
+        if( prveMBWriteFlushSlave( pxWrite->ucId ) != MB_ENOERR )
+        {
+            /* Out of requests. Try again on the next poll. */
+            break;
+        }
+    }
+#endif
+}
+
+static xMBWrite *
+prvpxMBWriteOldest( void )
+{
+    xMBWrite       *pxOldest = NULL;
+    int             i;
+
+    for( i = 0; i < MB_MASTER_WC_WRITES_MAX; i++ )
+    {
+        if( ( xMBWrites[i].eState == WR_PENDING ) &&
+            ( ( pxOldest == NULL ) || ( ( LONG )( xMBWrites[i].ulSequence - pxOldest->ulSequence ) < 0 ) ) )
+        {
+            pxOldest = &xMBWrites[i];
+        }
+    }
+    return pxOldest;
+}
+
+/* Send the buffered writes of a slave in the order they were buffered.
+ * Writes which follow each other and go to the next address of the same
+ * table are sent as one request. Anything else, including a second write
+ * to an address, starts a new request so that the slave sees the writes
+ * in the same order as the application. */
+static eMBErrorCode
+prveMBWriteFlushSlave( UCHAR ucId )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+    xMBWrite       *pxA, *pxB;
+    USHORT          usN = 0, usFirst = 0, usLen = 0;
+    USHORT          usMaxLen;
+    USHORT          i, j, usIdx;
+
+    /* Sort by the order the writes were buffered. */
+    for( i = 0; i < MB_MASTER_WC_WRITES_MAX; i++ )
+    {
+        if( ( xMBWrites[i].eState != WR_PENDING ) || ( xMBWrites[i].ucId != ucId ) )
+        {
+            continue;
+        }
+        for( j = usN; j > 0; j-- )
+        {
+            pxA = &xMBWrites[ausMBWriteOrder[j - 1]];
+            pxB = &xMBWrites[i];
+            if( ( LONG )( pxA->ulSequence - pxB->ulSequence ) < 0 )
+            {
+                break;
+            }
+            ausMBWriteOrder[j] = ausMBWriteOrder[j - 1];
+        }
+        ausMBWriteOrder[j] = i;
+        usN++;
+    }
+
+    for( i = 0; ( eStatus == MB_ENOERR ) && ( i < usN ); i++ )
+    {
+        usIdx = ausMBWriteOrder[i];
+        pxB = &xMBWrites[usIdx];
+        if( i > 0 )
+        {
+            pxA = &xMBWrites[ausMBWriteOrder[i - 1]];
+            usMaxLen = pxA->eTable == MB_TABLE_COILS ? MB_WC_COILS_MAX : MB_WC_REGISTERS_MAX;
+            if( ( pxB->eTable != pxA->eTable ) || ( pxB->usAddr != pxA->usAddr + 1 ) ||
+                ( usLen == usMaxLen ) )
+            {
+                eStatus = prveMBWriteSubmit( ucId, pxA->eTable, usFirst, i,
+                                             xMBWrites[ausMBWriteOrder[usFirst]].usAddr, usLen );
+                usFirst = i;
+                usLen = 0;
+            }
+        }
+        ausMBWriteValues[usLen++] = pxB->usValue;
+    }
+    if( ( eStatus == MB_ENOERR ) && ( usN > 0 ) )
+    {
+        eStatus = prveMBWriteSubmit( ucId, xMBWrites[ausMBWriteOrder[usFirst]].eTable, usFirst, usN,
+                                     xMBWrites[ausMBWriteOrder[usFirst]].usAddr, usLen );
+    }
+    return eStatus;
+}
+
+/* Submit the writes ausMBWriteOrder[usFirst] to ausMBWriteOrder[usLast - 1]
+ * with the values in ausMBWriteValues. */
+static eMBErrorCode
+prveMBWriteSubmit( UCHAR ucId, eMBTable eTable, USHORT usFirst, USHORT usLast,
+                   USHORT usStartAddr, USHORT usLen )
+{
+    eMBErrorCode    eStatus;
+    xMBWriteBatch  *pxBatch = NULL;
+    UCHAR           ucFunctionCode;
+    USHORT          i;
+
+    for( i = 0; i < MB_MASTER_REQUESTS_MAX; i++ )
+    {
+        if( !xMBWriteBatches[i].xUsed )
+        {
+            pxBatch = &xMBWriteBatches[i];
+            break;
+        }
+    }
+    if( pxBatch == NULL )
+    {
+        return MB_ENORES;
+    }
+
+    if( eTable == MB_TABLE_COILS )
+    {
+        ucFunctionCode = usLen > 1 ? MB_FUNC_WRITE_MULTIPLE_COILS : MB_FUNC_WRITE_SINGLE_COIL;
+    }
+    else
+    {
+        ucFunctionCode = usLen > 1 ? MB_FUNC_WRITE_MULTIPLE_REGISTERS : MB_FUNC_WRITE_REGISTER;
+    }
+    eStatus = eMBSubmit( ucId, ucFunctionCode, usStartAddr, usLen, ausMBWriteValues,
+                         prvvMBWriteComplete, pxBatch, NULL );
+    if( eStatus == MB_ENOERR )
+    {
+        pxBatch->xUsed = TRUE;
+        for( i = usFirst; i < usLast; i++ )
+        {
+            xMBWrites[ausMBWriteOrder[i]].eState = WR_SENT;
+            xMBWrites[ausMBWriteOrder[i]].pxBatch = pxBatch;
+        }
+    }
+    return eStatus;
+}
+
+static void
+prvvMBWriteComplete( const xMBRequestResult * pxResult, void *pvArg )
+{
+    xMBWriteBatch  *pxBatch = ( xMBWriteBatch * ) pvArg;
+    xMBWrite       *pxWrite;
+    int             i;
+
+    pxBatch->xUsed = FALSE;
+    for( i = 0; i < MB_MASTER_WC_WRITES_MAX; i++ )
+    {
+        pxWrite = &xMBWrites[i];
+        if( ( pxWrite->eState == WR_SENT ) && ( pxWrite->pxBatch == pxBatch ) )
+        {
+            /* Free the entry first. The callback may buffer a new write. */
+            pxWrite->eState = WR_FREE;
+            if( pxWrite->pxCallback != NULL )
+            {
+                pxWrite->pxCallback( pxWrite->ucId, pxWrite->eTable, pxWrite->usAddr,
+                                     pxResult->eStatus, pxResult->eException, pxWrite->pvArg );
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,413 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mbmaster.h"
+#include "mbconfig.h"
+#include "mbframe.h"
+#include "mbproto.h"
+#include "mbport.h"
+
+#if MB_RTU_ENABLED == 1
+#include "mbrtu.h"
+#endif
+#if MB_ASCII_ENABLED == 1
+#include "mbascii.h"
+#endif
+
+#if MB_MONITOR_ENABLED > 0
+
+#ifndef MB_PORT_BARRIER
+#error "The port must define MB_PORT_BARRIER( ) in port.h"
+#endif
+
+#if ( MB_MONITOR_BUFFER_SIZE & ( MB_MONITOR_BUFFER_SIZE - 1 ) ) != 0
+#error "MB_MONITOR_BUFFER_SIZE must be a power of two"
+#endif
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_MONITOR_MASK         ( MB_MONITOR_BUFFER_SIZE - 1 )
+
+/* ----------------------- Static variables ---------------------------------*/
+static enum
+{
+    STATE_ENABLED,
+    STATE_DISABLED,
+    STATE_NOT_INITIALIZED
+} eMBMonitorState = STATE_NOT_INITIALIZED;
+
+static pvMBFrameStart pvMBMonitorStart;
+static pvMBFrameStop pvMBMonitorStop;
+static peMBFrameReceive peMBMonitorReceive;
+static pvMBFrameGetTimes pvMBMonitorGetTimes;
+
+/* The last request. A frame from the same slave with the same function
+ * code is its response. */
+static BOOL     xRequestOpen;
+static UCHAR    ucRequestAddress;
+static UCHAR    ucRequestFunction;
+static USHORT   usRequestTransaction;
+static USHORT   usNextTransaction;
+
+/* Records are written by eMBMonitorPoll( ) and read by eMBMonitorRead( ),
+ * possibly from another thread. The producer only writes ulMonitorHead and
+ * the consumer only writes ulMonitorTail. Both are free running and the
+ * difference is the number of bytes in the buffer.
+ */
+static UCHAR    ucMonitorBuf[MB_MONITOR_BUFFER_SIZE];
+static volatile ULONG ulMonitorHead;
+static volatile ULONG ulMonitorTail;
+
+static xMBMonitorStats xMonitorStats;
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvMBMonitorRecord( const xMBFrameTimes * pxTimes, USHORT usTransaction, UCHAR ucFlags,
+                                     const UCHAR * pucData, USHORT usLength );
+static ULONG    prvulMBMonitorPut( ULONG ulHead, const UCHAR * pucData, USHORT usLength );
+static USHORT   prvusMBMonitorRequestLength( const UCHAR * pucPDU, USHORT usLength );
+static USHORT   prvusMBMonitorResponseLength( const UCHAR * pucPDU, USHORT usLength );
+
+/* ----------------------- Start implementation -----------------------------*/
+eMBErrorCode
+eMBMonitorInit( eMBMode eMode, UCHAR ucPort, ULONG ulBaudRate, eMBParity eParity )
+{
+    eMBErrorCode    eStatus = MB_ENOERR;
+
+    switch ( eMode )
+    {
+#if MB_RTU_ENABLED > 0
+    case MB_RTU:
+        pvMBMonitorStart = eMBRTUStart;
+        pvMBMonitorStop = eMBRTUStop;
+        peMBMonitorReceive = eMBRTUReceive;
+        pvMBMonitorGetTimes = vMBRTUGetTimes;
+        pxMBFrameCBByteReceived = xMBRTUReceiveFSM;
+        pxMBPortCBTimerExpired = xMBRTUTimerT35Expired;
+        pxMBFrameCBTransmitterEmpty = xMBRTUTransmitFSM;
+
+        eStatus = eMBRTUInit( MB_ADDRESS_BROADCAST, ucPort, ulBaudRate, eParity );
+        break;
+#endif
+#if MB_ASCII_ENABLED > 0
+    case MB_ASCII:
+        pvMBMonitorStart = eMBASCIIStart;
+        pvMBMonitorStop = eMBASCIIStop;
+        peMBMonitorReceive = eMBASCIIReceive;
+        pvMBMonitorGetTimes = vMBASCIIGetTimes;
+        pxMBFrameCBByteReceived = xMBASCIIReceiveFSM;
+        pxMBPortCBTimerExpired = xMBASCIITimerT1SExpired;
+        pxMBFrameCBTransmitterEmpty = xMBASCIITransmitFSM;
+
+        eStatus = eMBASCIIInit( MB_ADDRESS_BROADCAST, ucPort, ulBaudRate, eParity );
+        break;
+#endif
+    default:
+        eStatus = MB_EINVAL;
+    }
+
+    if( eStatus == MB_ENOERR )
+    {
+        if( !xMBPortEventInit(  ) )
+        {
+            eStatus = MB_EPORTERR;
+        }
+        else
+        {
+            eMBMonitorState = STATE_DISABLED;
+        }
+    }
+    return eStatus;
+}
+
+eMBErrorCode
+eMBMonitorEnable( void )
+{
+    if( eMBMonitorState != STATE_DISABLED )
+    {
+        return MB_EILLSTATE;
+    }
+    xRequestOpen = FALSE;
+    pvMBMonitorStart(  );
+    eMBMonitorState = STATE_ENABLED;
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBMonitorDisable( void )
+{
+    if( eMBMonitorState == STATE_ENABLED )
+    {
+        pvMBMonitorStop(  );
+        eMBMonitorState = STATE_DISABLED;
+    }
+    return eMBMonitorState == STATE_DISABLED ? MB_ENOERR : MB_EILLSTATE;
+}
+
+eMBErrorCode
+eMBMonitorPoll( void )
+{
+    eMBEventType    eEvent;
+    eMBErrorCode    eStatus;
+    UCHAR           ucAddress;
+    UCHAR          *pucFrame;
+    USHORT          usLength;
+    xMBFrameTimes   xTimes;
+    UCHAR           ucFunctionCode;
+    UCHAR           ucFlags;
+    USHORT          usTransaction;
+
+    if( eMBMonitorState != STATE_ENABLED )
+    {
+        return MB_EILLSTATE;
+    }
+    if( !xMBPortEventGet( &eEvent ) || ( eEvent != EV_FRAME_RECEIVED ) )
+    {
+        return MB_ENOERR;
+    }
+
+    xMonitorStats.ulFrames++;
+    eStatus = peMBMonitorReceive( &ucAddress, &pucFrame, &usLength );
+    pvMBMonitorGetTimes( &xTimes );
+    if( eStatus != MB_ENOERR )
+    {
+        xMonitorStats.ulInvalid++;
+        prvvMBMonitorRecord( &xTimes, 0, MB_MONITOR_INVALID, NULL, 0 );
+        return MB_ENOERR;
+    }
+
+    /* A frame is the response to the last request if it comes from the
+     * same slave and has the same function code. If the frame has the
+     * length of a request but not of a response it is a new request,
+     * e.g. because the slave did not answer. */
+    ucFunctionCode = pucFrame[MB_PDU_FUNC_OFF];
+    ucFlags = MB_MONITOR_REQUEST;
+    if( xRequestOpen && ( ucAddress == ucRequestAddress ) &&
+        ( ( ucFunctionCode & ~MB_FUNC_ERROR ) == ucRequestFunction ) )
+    {
+        if( ucFunctionCode & MB_FUNC_ERROR )
+        {
+            ucFlags = MB_MONITOR_RESPONSE | MB_MONITOR_EXCEPTION;
+        }
+        else if( ( prvusMBMonitorRequestLength( pucFrame, usLength ) != usLength ) ||
+                 ( prvusMBMonitorResponseLength( pucFrame, usLength ) == usLength ) )
+        {
+            ucFlags = MB_MONITOR_RESPONSE;
+        }
+    }
+
+    if( ucFlags & MB_MONITOR_RESPONSE )
+    {
+        xRequestOpen = FALSE;
+        usTransaction = usRequestTransaction;
+        xMonitorStats.ulResponses++;
+        if( ucFlags & MB_MONITOR_EXCEPTION )
+        {
+            xMonitorStats.ulExceptions++;
+        }
+    }
+    else
+    {
+        if( xRequestOpen )
+        {
+            xMonitorStats.ulUnanswered++;
+        }
+        usTransaction = usNextTransaction++;
+        xMonitorStats.ulRequests++;
+
+        /* Broadcast requests are not answered. */
+        xRequestOpen = ucAddress != MB_ADDRESS_BROADCAST ? TRUE : FALSE;
+        ucRequestAddress = ucAddress;
+        ucRequestFunction = ucFunctionCode;
+        usRequestTransaction = usTransaction;
+    }
+
+    /* The address is stored in front of the PDU. */
+    prvvMBMonitorRecord( &xTimes, usTransaction, ucFlags, pucFrame - 1, ( USHORT )( usLength + 1 ) );
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBMonitorRead( UCHAR * pucBuffer, USHORT usBufferLen, USHORT * pusRead )
+{
+    ULONG           ulHead = ulMonitorHead;
+    ULONG           ulTail = ulMonitorTail;
+    ULONG           ulLenPos;
+    USHORT          usRecord;
+    USHORT          usRead = 0;
+
+    if( ( pucBuffer == NULL ) || ( pusRead == NULL ) )
+    {
+        return MB_EINVAL;
+    }
+
+    /* Read the records only after the head which published them. */
+    MB_PORT_BARRIER(  );
+    while( ulTail != ulHead )
+    {
+        /* The length of the data is the last field of the header. */
+        ulLenPos = ulTail + MB_MONITOR_HEADER_SIZE - 2;
+        usRecord = ( USHORT )( ucMonitorBuf[ulLenPos & MB_MONITOR_MASK] |
+                               ( ucMonitorBuf[( ulLenPos + 1 ) & MB_MONITOR_MASK] << 8 ) );
+        usRecord += MB_MONITOR_HEADER_SIZE;
+        if( usRecord > usBufferLen - usRead )
+        {
+            break;
+        }
+        for( ; usRecord > 0; usRecord-- )
+        {
+            pucBuffer[usRead++] = ucMonitorBuf[ulTail++ & MB_MONITOR_MASK];
+        }
+    }
+
+    /* Free the space after the records were copied. */
+    MB_PORT_BARRIER(  );
+    ulMonitorTail = ulTail;
+    *pusRead = usRead;
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBMonitorGetStats( xMBMonitorStats * pxStats )
+{
+    if( pxStats == NULL )
+    {
+        return MB_EINVAL;
+    }
+    *pxStats = xMonitorStats;
+    return MB_ENOERR;
+}
+
+static void
+prvvMBMonitorRecord( const xMBFrameTimes * pxTimes, USHORT usTransaction, UCHAR ucFlags,
+                     const UCHAR * pucData, USHORT usLength )
+{
+    ULONG           ulSec = pxTimes->ulStartSec;
+    ULONG           ulNSec = pxTimes->ulStartNSec;
+    UCHAR           aucHeader[MB_MONITOR_HEADER_SIZE];
+    ULONG           ulHead = ulMonitorHead;
+
+    if( MB_MONITOR_BUFFER_SIZE - ( ulHead - ulMonitorTail ) < ( ULONG )( MB_MONITOR_HEADER_SIZE + usLength ) )
+    {
+        xMonitorStats.ulDropped++;
+        return;
+    }
+    aucHeader[0] = ( UCHAR )( ulSec & 0xFF );
+    aucHeader[1] = ( UCHAR )( ( ulSec >> 8 ) & 0xFF );
+    aucHeader[2] = ( UCHAR )( ( ulSec >> 16 ) & 0xFF );
+    aucHeader[3] = ( UCHAR )( ( ulSec >> 24 ) & 0xFF );
+    aucHeader[4] = ( UCHAR )( ulNSec & 0xFF );
+    aucHeader[5] = ( UCHAR )( ( ulNSec >> 8 ) & 0xFF );
+    aucHeader[6] = ( UCHAR )( ( ulNSec >> 16 ) & 0xFF );
+    aucHeader[7] = ( UCHAR )( ( ulNSec >> 24 ) & 0xFF );
+    aucHeader[8] = ( UCHAR )( usTransaction & 0xFF );
+    aucHeader[9] = ( UCHAR )( usTransaction >> 8 );
+    aucHeader[10] = ucFlags;
+    aucHeader[11] = ( UCHAR )( usLength & 0xFF );
+    aucHeader[12] = ( UCHAR )( usLength >> 8 );
+    ulHead = prvulMBMonitorPut( ulHead, aucHeader, MB_MONITOR_HEADER_SIZE );
+    ulHead = prvulMBMonitorPut( ulHead, pucData, usLength );
+
+    /* Publish the record after it is complete. */
+    MB_PORT_BARRIER(  );
+    ulMonitorHead = ulHead;
+}
+
+/* Copy data to the buffer at ulHead and return the new head. */
+static ULONG
+prvulMBMonitorPut( ULONG ulHead, const UCHAR * pucData, USHORT usLength )
+{
+    USHORT          usChunk;
+
+    while( usLength > 0 )
+    {
+        usChunk = usLength;
+        if( usChunk > MB_MONITOR_BUFFER_SIZE - ( ulHead & MB_MONITOR_MASK ) )
+        {
+            usChunk = ( USHORT )( MB_MONITOR_BUFFER_SIZE - ( ulHead & MB_MONITOR_MASK ) );
+        }
+        memcpy( &ucMonitorBuf[ulHead & MB_MONITOR_MASK], pucData, usChunk );
+        ulHead += usChunk;
+        pucData += usChunk;
+        usLength -= usChunk;
+    }
+    return ulHead;
+}
+
+/* Expected length of a request PDU or 0 if it is not known. */
+static USHORT
+prvusMBMonitorRequestLength( const UCHAR * pucPDU, USHORT usLength )
+{
+    switch ( pucPDU[MB_PDU_FUNC_OFF] )
+    {
+    case MB_FUNC_READ_COILS:
+    case MB_FUNC_READ_DISCRETE_INPUTS:
+    case MB_FUNC_READ_HOLDING_REGISTER:
+    case MB_FUNC_READ_INPUT_REGISTER:
+    case MB_FUNC_WRITE_SINGLE_COIL:
+    case MB_FUNC_WRITE_REGISTER:
+        return 5;
+    case MB_FUNC_WRITE_MULTIPLE_COILS:
+    case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+        return usLength > 5 ? ( USHORT )( 6 + pucPDU[5] ) : 0;
+    case MB_FUNC_READWRITE_MULTIPLE_REGISTERS:
+        return usLength > 9 ? ( USHORT )( 10 + pucPDU[9] ) : 0;
+    }
+    return 0;
+}
+
+/* Expected length of a response PDU or 0 if it is not known. */
+static USHORT
+prvusMBMonitorResponseLength( const UCHAR * pucPDU, USHORT usLength )
+{
+    switch ( pucPDU[MB_PDU_FUNC_OFF] )
+    {
+    case MB_FUNC_READ_COILS:
+    case MB_FUNC_READ_DISCRETE_INPUTS:
+    case MB_FUNC_READ_HOLDING_REGISTER:
+    case MB_FUNC_READ_INPUT_REGISTER:
+    case MB_FUNC_READWRITE_MULTIPLE_REGISTERS:
+        return usLength > 1 ? ( USHORT )( 2 + pucPDU[1] ) : 0;
+    case MB_FUNC_WRITE_SINGLE_COIL:
+    case MB_FUNC_WRITE_REGISTER:
+    case MB_FUNC_WRITE_MULTIPLE_COILS:
+    case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+        return 5;
+    }
+    return 0;
+}
+
+#endif
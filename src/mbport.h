@@ -59,6 +59,28 @@ typedef enum
     MB_PAR_EVEN                 /*!< Even parity. */
 } eMBParity;
 
+/* ----------------------- Memory barrier -----------------------------------*/
+
+/*! \brief Orders memory accesses between the protocol stack and other
+ *   threads.
+ *
+ * It is used by the lock free parts of the stack, i.e. the journal, the
+ * bus monitor and the sequence lock of the register store. A port can
+ * define its own barrier in port.h. The default is a full barrier on GCC
+ * compatible compilers and C11 compilers with atomics. Other compilers
+ * must define it if one of these parts is enabled. On a single core target
+ * a barrier which keeps the compiler from reordering memory accesses is
+ * sufficient. An empty definition is never correct.
+ */
+#ifndef MB_PORT_BARRIER
+#if defined( __GNUC__ )
+#define MB_PORT_BARRIER( )      __sync_synchronize( )
+#elif defined( __STDC_VERSION__ ) && ( __STDC_VERSION__ >= 201112L ) && !defined( __STDC_NO_ATOMICS__ )
+#include <stdatomic.h>
+#define MB_PORT_BARRIER( )      atomic_thread_fence( memory_order_seq_cst )
+#endif
+#endif
+
 /* ----------------------- Supporting functions -----------------------------*/
 BOOL            xMBPortEventInit( void );
 
@@ -92,6 +114,33 @@ void            vMBPortTimersDisable( void );
 
 void            vMBPortTimersDelay( USHORT usTimeOutMS );
 
+/*!
+ * \brief Return the time since the timer has been enabled last.
+ *
+ * The time is in units of 50us and saturates at the timeout passed to
+ * xMBPortTimersInit( ). It is only required by the RTU receiver if
+ * MB_RTU_T15_ENABLED is set. The receiver calls it from the character
+ * received callback before it restarts the timer.
+ */
+USHORT          usMBPortTimersGetElapsed( void );
+
+/*!
+ * \brief Return the value of a free running millisecond counter.
+ *
+ * The counter is allowed to wrap around. It is only required by the
+ * master which uses it to time out outstanding requests.
+ */
+ULONG           ulMBPortTimersGetMs( void );
+
+/*!
+ * \brief Return a monotonic timestamp with a resolution of up to 1ns.
+ *
+ * It is only required by the bus monitor which calls it from the
+ * character received callback and by the slave if MB_STATS_TIMING_ENABLED
+ * is set.
+ */
+void            vMBPortTimersGetTimestamp( ULONG * pulSec, ULONG * pulNSec );
+
 /* ----------------------- Callback for the protocol stack ------------------*/
 
 /*!
@@ -123,6 +172,57 @@ BOOL            xMBTCPPortGetRequest( UCHAR **ppucMBTCPFrame, USHORT * usTCPLeng
 
 BOOL            xMBTCPPortSendResponse( const UCHAR *pucMBTCPFrame, USHORT usTCPLength );
 
+/*! \ingroup modbus
+ * \brief Return an identifier of the connected client.
+ *
+ * Every accepted connection gets a new identifier. 0 is returned if no
+ * client is connected. Deferred requests use it to drop a response when
+ * the client which sent the request is gone. A port which implements this
+ * function must define the macro MB_PORT_HAS_TCP_CONNECTION to 1.
+ */
+ULONG           ulMBTCPPortGetConnection( void );
+
+/* ----------------------- TCP client port functions (master) ---------------*/
+
+/*!
+ * \brief Register a Modbus TCP server and start connecting to it.
+ *
+ * The connection must be established without blocking the caller. If the
+ * connection can not be established or is lost later the porting layer
+ * retries in the background. Registering a server which is already known
+ * returns the existing connection.
+ *
+ * \param szHostAddress Host name or IP address of the server.
+ * \param usTCPPort TCP port of the server or MB_TCP_PORT_USE_DEFAULT.
+ * \param pucConnection Index of the connection. Must be smaller than
+ *   MB_TCP_MASTER_CONNECTIONS_MAX.
+ */
+BOOL            xMBTCPPortConnect( const CHAR * szHostAddress, USHORT usTCPPort,
+                                   UCHAR * pucConnection );
+
+BOOL            xMBTCPPortIsConnected( UCHAR ucConnection );
+
+BOOL            xMBTCPPortSendRequest( UCHAR ucConnection, const UCHAR * pucMBTCPFrame,
+                                       USHORT usTCPLength );
+
+/*!
+ * \brief Return a complete Modbus TCP frame received from one of the servers.
+ *
+ * The porting layer posts an EV_FRAME_RECEIVED event whenever a complete
+ * frame is available. The frame buffer remains valid until the next call.
+ */
+BOOL            xMBTCPPortGetResponse( UCHAR * pucConnection, UCHAR ** ppucMBTCPFrame,
+                                       USHORT * usTCPLength );
+
+/*!
+ * \brief Called by the porting layer when a connection to a server has
+ *   been closed.
+ *
+ * It is implemented by the protocol stack. Requests which are waiting for
+ * a response on this connection fail with the next call of eMBPoll( ).
+ */
+void            vMBMasterTCPConnectionLost( UCHAR ucConnection );
+
 #ifdef __cplusplus
 PR_END_EXTERN_C
 #endif
@@ -66,7 +66,8 @@ PR_BEGIN_EXTERN_C
     MB_EX_SLAVE_BUSY = 0x06,
     MB_EX_MEMORY_PARITY_ERROR = 0x08,
     MB_EX_GATEWAY_PATH_FAILED = 0x0A,
-    MB_EX_GATEWAY_TGT_FAILED = 0x0B
+    MB_EX_GATEWAY_TGT_FAILED = 0x0B,
+    MB_EX_PENDING = 0xFF        /* Internal. The response is sent later. */
 } eMBException;
 
 typedef         eMBException( *pxMBFunctionHandler ) ( UCHAR * pucFrame, USHORT * pusLength );
@@ -0,0 +1,606 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+/* ----------------------- System includes ----------------------------------*/
+#include "stdlib.h"
+#include "string.h"
+
+/* ----------------------- Platform includes --------------------------------*/
+#include "port.h"
+
+/* ----------------------- Modbus includes ----------------------------------*/
+#include "mb.h"
+#include "mbconfig.h"
+#include "mbport.h"
+#include "mbregstore.h"
+#include "mbutils.h"
+
+#if MB_REGSTORE_ENABLED > 0
+
+#if ( MB_REGSTORE_SEQLOCK_ENABLED > 0 ) && !defined( MB_PORT_BARRIER )
+#error "The port must define MB_PORT_BARRIER( ) in port.h"
+#endif
+
+/* ----------------------- Defines ------------------------------------------*/
+#define MB_REGSTORE_TABLES      ( 4 )
+#define MB_REGSTORE_PAGE_SIZE   ( 1U << MB_REGSTORE_PAGE_SHIFT )
+#define MB_REGSTORE_PAGE_BYTES  ( 2U * MB_REGSTORE_PAGE_SIZE )
+#define MB_REGSTORE_BIT_SHIFT   ( MB_REGSTORE_PAGE_SHIFT + 4 )
+#define MB_REGSTORE_PAGE_BITS   ( 1U << MB_REGSTORE_BIT_SHIFT )
+
+/* A page table maps 2^MB_REGSTORE_MAP_SHIFT pages. The directory of a
+ * table has one entry per page table. Bit tables only use the first few
+ * entries because a page holds 16 times as many bits as registers.
+ */
+#define MB_REGSTORE_MAP_SHIFT   ( 6 )
+#define MB_REGSTORE_MAP_SIZE    ( 1U << MB_REGSTORE_MAP_SHIFT )
+#define MB_REGSTORE_DIR_SIZE    ( 0x10000UL >> ( MB_REGSTORE_PAGE_SHIFT + MB_REGSTORE_MAP_SHIFT ) )
+
+/* Attempts of a reader to find the store without a writer before it gives
+ * up. A retry after an overlapping write counts as an attempt too.
+ */
+#define MB_REGSTORE_ATTEMPTS_MAX ( 1000 )
+
+#define MB_REGSTORE_IS_BITS( eTable ) \
+    ( ( ( eTable ) == MB_REGSTORE_COILS ) || ( ( eTable ) == MB_REGSTORE_DISCRETE ) )
+
+/* ----------------------- Type definitions ---------------------------------*/
+
+/* Set of banks. Bit i stands for xBanks[i]. */
+#if MB_REGSTORE_BANKS_MAX <= 8
+typedef UCHAR   xMBRegStoreBankSet;
+#elif MB_REGSTORE_BANKS_MAX <= 16
+typedef USHORT  xMBRegStoreBankSet;
+#elif MB_REGSTORE_BANKS_MAX <= 32
+typedef ULONG   xMBRegStoreBankSet;
+#else
+#error "MB_REGSTORE_BANKS_MAX must not be larger than 32"
+#endif
+
+typedef struct
+{
+    UCHAR           ucTable;
+    USHORT          usFirst;
+    USHORT          usLast;
+} xMBRegStoreBank;
+
+/* ----------------------- Static variables ---------------------------------*/
+
+/* Pages hold registers in Modbus byte order, i.e. high byte first, and
+ * bits packed like in a PDU. Requests are copied to and from the pages
+ * without conversion. Page tables hold the index of a page plus one and
+ * the directories the index of a page table plus one. Zero means unused.
+ * Next to every page the page tables hold the set of banks which overlap
+ * it. A range is checked against these banks only.
+ */
+static UCHAR    ucPages[MB_REGSTORE_PAGES_MAX][MB_REGSTORE_PAGE_BYTES];
+static USHORT   usPagesUsed;
+static USHORT   usMaps[MB_REGSTORE_MAPS_MAX][MB_REGSTORE_MAP_SIZE];
+static xMBRegStoreBankSet xMapBanks[MB_REGSTORE_MAPS_MAX][MB_REGSTORE_MAP_SIZE];
+static UCHAR    ucMapsUsed;
+static UCHAR    ucDirectory[MB_REGSTORE_TABLES][MB_REGSTORE_DIR_SIZE];
+
+static xMBRegStoreBank xBanks[MB_REGSTORE_BANKS_MAX];
+static UCHAR    ucBanksUsed;
+
+#if MB_REGSTORE_SEQLOCK_ENABLED > 0
+/* Incremented before and after every write. It is odd while a writer
+ * modifies the pages.
+ */
+static volatile ULONG ulSequence;
+#endif
+
+/* ----------------------- Static functions ---------------------------------*/
+static UCHAR   *prvpucMBRegStorePage( eMBRegStoreTable eTable, USHORT usPage, BOOL xAlloc );
+static UCHAR   *prvpucMBRegStoreReg( eMBRegStoreTable eTable, USHORT usAddress );
+static USHORT   prvusMBRegStorePageOf( eMBRegStoreTable eTable, USHORT usAddress );
+static USHORT   prvusMBRegStoreRun( USHORT usAddress, USHORT usCount );
+static BOOL     prvxMBRegStoreValid( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount );
+static BOOL     prvxMBRegStoreReadBegin( ULONG * pulSeq, USHORT * pusAttempts );
+static BOOL     prvxMBRegStoreReadRetry( ULONG ulSeq );
+static void     prvvMBRegStoreWriteBegin( void );
+static void     prvvMBRegStoreWriteEnd( void );
+static eMBErrorCode prveMBRegStoreAccess( eMBRegStoreTable eTable, USHORT usAddress,
+                                          USHORT usCount, UCHAR * pucBuffer,
+                                          eMBRegisterMode eMode );
+static void     prvvMBRegStoreRegs( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                                    UCHAR * pucRegBuffer, eMBRegisterMode eMode );
+static void     prvvMBRegStoreBits( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                                    UCHAR * pucBits, eMBRegisterMode eMode );
+
+/* ----------------------- Start implementation -----------------------------*/
+eMBErrorCode
+eMBRegStoreAddBank( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount )
+{
+    xMBRegStoreBank *pxBank;
+    USHORT          usLast = ( USHORT )( usAddress + usCount - 1 );
+    USHORT          usPage;
+    USHORT          usLastPage;
+    UCHAR           ucMap;
+    UCHAR           i;
+
+    if( ( ( UCHAR )eTable >= MB_REGSTORE_TABLES ) || ( usCount == 0 ) ||
+        ( ( ULONG )usAddress + usCount > 0x10000UL ) )
+    {
+        return MB_EINVAL;
+    }
+    for( i = 0; i < ucBanksUsed; i++ )
+    {
+        pxBank = &xBanks[i];
+        if( ( pxBank->ucTable == ( UCHAR )eTable ) &&
+            ( usAddress <= pxBank->usLast ) && ( usLast >= pxBank->usFirst ) )
+        {
+            return MB_EINVAL;
+        }
+    }
+    if( ucBanksUsed >= MB_REGSTORE_BANKS_MAX )
+    {
+        return MB_ENORES;
+    }
+
+    /* Map all pages of the bank. */
+    usLastPage = prvusMBRegStorePageOf( eTable, usLast );
+    for( usPage = prvusMBRegStorePageOf( eTable, usAddress ); usPage <= usLastPage; usPage++ )
+    {
+        if( prvpucMBRegStorePage( eTable, usPage, TRUE ) == NULL )
+        {
+            return MB_ENORES;
+        }
+    }
+    for( usPage = prvusMBRegStorePageOf( eTable, usAddress ); usPage <= usLastPage; usPage++ )
+    {
+        ucMap = ucDirectory[eTable][usPage >> MB_REGSTORE_MAP_SHIFT];
+        xMapBanks[ucMap - 1][usPage & ( MB_REGSTORE_MAP_SIZE - 1 )] |=
+            ( xMBRegStoreBankSet )( 1UL << ucBanksUsed );
+    }
+
+    pxBank = &xBanks[ucBanksUsed++];
+    pxBank->ucTable = ( UCHAR )eTable;
+    pxBank->usFirst = usAddress;
+    pxBank->usLast = usLast;
+    return MB_ENOERR;
+}
+
+void
+vMBRegStoreClear( void )
+{
+    prvvMBRegStoreWriteBegin(  );
+    ucBanksUsed = 0;
+    memset( ucDirectory, 0, sizeof( ucDirectory ) );
+    memset( usMaps, 0, sizeof( usMaps ) );
+    memset( xMapBanks, 0, sizeof( xMapBanks ) );
+    memset( ucPages, 0, sizeof( ucPages ) );
+    usPagesUsed = 0;
+    ucMapsUsed = 0;
+    prvvMBRegStoreWriteEnd(  );
+}
+
+eMBErrorCode
+eMBRegStoreRead( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount, USHORT * pusValues )
+{
+    USHORT          usRun;
+    USHORT          usLeft;
+    USHORT          i;
+    USHORT          usAttempts = 0;
+    ULONG           ulSeq;
+
+    if( MB_REGSTORE_IS_BITS( eTable ) || !prvxMBRegStoreValid( eTable, usAddress, usCount ) )
+    {
+        return MB_ENOREG;
+    }
+    do
+    {
+        if( !prvxMBRegStoreReadBegin( &ulSeq, &usAttempts ) )
+        {
+            return MB_ETIMEDOUT;
+        }
+        for( i = 0, usLeft = usCount; usLeft > 0; usLeft -= usRun, i += usRun )
+        {
+            usRun = prvusMBRegStoreRun( ( USHORT )( usAddress + i ), usLeft );
+            vMBUtilRegsToHost( &pusValues[i], prvpucMBRegStoreReg( eTable, ( USHORT )( usAddress + i ) ),
+                               usRun );
+        }
+    }
+    while( prvxMBRegStoreReadRetry( ulSeq ) );
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBRegStoreWrite( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                  const USHORT * pusValues )
+{
+    USHORT          usRun;
+
+    if( MB_REGSTORE_IS_BITS( eTable ) || !prvxMBRegStoreValid( eTable, usAddress, usCount ) )
+    {
+        return MB_ENOREG;
+    }
+    prvvMBRegStoreWriteBegin(  );
+    for( ; usCount > 0; usCount -= usRun )
+    {
+        usRun = prvusMBRegStoreRun( usAddress, usCount );
+        vMBUtilRegsFromHost( prvpucMBRegStoreReg( eTable, usAddress ), pusValues, usRun );
+        pusValues += usRun;
+        usAddress += usRun;
+    }
+    prvvMBRegStoreWriteEnd(  );
+    return MB_ENOERR;
+}
+
+eMBErrorCode
+eMBRegStoreGetBits( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount, UCHAR * pucBits )
+{
+    if( !MB_REGSTORE_IS_BITS( eTable ) || !prvxMBRegStoreValid( eTable, usAddress, usCount ) )
+    {
+        return MB_ENOREG;
+    }
+    return prveMBRegStoreAccess( eTable, usAddress, usCount, pucBits, MB_REG_READ );
+}
+
+eMBErrorCode
+eMBRegStoreSetBits( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                    const UCHAR * pucBits )
+{
+    if( !MB_REGSTORE_IS_BITS( eTable ) || !prvxMBRegStoreValid( eTable, usAddress, usCount ) )
+    {
+        return MB_ENOREG;
+    }
+    return prveMBRegStoreAccess( eTable, usAddress, usCount, ( UCHAR * ) pucBits, MB_REG_WRITE );
+}
+
+/* ----------------------- Callbacks of the protocol stack ------------------*/
+
+/* The protocol stack passes the register address plus one. */
+eMBErrorCode
+eMBRegInputCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs )
+{
+    usAddress--;
+    if( !prvxMBRegStoreValid( MB_REGSTORE_INPUT, usAddress, usNRegs ) )
+    {
+        return MB_ENOREG;
+    }
+    return prveMBRegStoreAccess( MB_REGSTORE_INPUT, usAddress, usNRegs, pucRegBuffer, MB_REG_READ );
+}
+
+eMBErrorCode
+eMBRegHoldingCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNRegs, eMBRegisterMode eMode )
+{
+    usAddress--;
+    if( !prvxMBRegStoreValid( MB_REGSTORE_HOLDING, usAddress, usNRegs ) )
+    {
+        return MB_ENOREG;
+    }
+    return prveMBRegStoreAccess( MB_REGSTORE_HOLDING, usAddress, usNRegs, pucRegBuffer, eMode );
+}
+
+eMBErrorCode
+eMBRegCoilsCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNCoils, eMBRegisterMode eMode )
+{
+    usAddress--;
+    if( !prvxMBRegStoreValid( MB_REGSTORE_COILS, usAddress, usNCoils ) )
+    {
+        return MB_ENOREG;
+    }
+    return prveMBRegStoreAccess( MB_REGSTORE_COILS, usAddress, usNCoils, pucRegBuffer, eMode );
+}
+
+eMBErrorCode
+eMBRegDiscreteCB( UCHAR * pucRegBuffer, USHORT usAddress, USHORT usNDiscrete )
+{
+    usAddress--;
+    if( !prvxMBRegStoreValid( MB_REGSTORE_DISCRETE, usAddress, usNDiscrete ) )
+    {
+        return MB_ENOREG;
+    }
+    return prveMBRegStoreAccess( MB_REGSTORE_DISCRETE, usAddress, usNDiscrete, pucRegBuffer,
+                                 MB_REG_READ );
+}
+
+/* ----------------------- Static functions ---------------------------------*/
+
+/* Return a page of a table. If xAlloc is set missing pages and page tables
+ * are allocated.
+ */
+static UCHAR   *
+prvpucMBRegStorePage( eMBRegStoreTable eTable, USHORT usPage, BOOL xAlloc )
+{
+    UCHAR          *pucDirEntry = &ucDirectory[eTable][usPage >> MB_REGSTORE_MAP_SHIFT];
+    USHORT         *pusMapEntry;
+
+    if( *pucDirEntry == 0 )
+    {
+        if( !xAlloc || ( ucMapsUsed >= MB_REGSTORE_MAPS_MAX ) )
+        {
+            return NULL;
+        }
+        *pucDirEntry = ++ucMapsUsed;
+    }
+    pusMapEntry = &usMaps[*pucDirEntry - 1][usPage & ( MB_REGSTORE_MAP_SIZE - 1 )];
+    if( *pusMapEntry == 0 )
+    {
+        if( !xAlloc || ( usPagesUsed >= MB_REGSTORE_PAGES_MAX ) )
+        {
+            return NULL;
+        }
+        *pusMapEntry = ++usPagesUsed;
+    }
+    return ucPages[*pusMapEntry - 1];
+}
+
+/* Return the two bytes of a register which must be within a bank. */
+static UCHAR   *
+prvpucMBRegStoreReg( eMBRegStoreTable eTable, USHORT usAddress )
+{
+    return prvpucMBRegStorePage( eTable, ( USHORT )( usAddress >> MB_REGSTORE_PAGE_SHIFT ), FALSE ) +
+        2U * ( usAddress & ( MB_REGSTORE_PAGE_SIZE - 1 ) );
+}
+
+/* Return the page which holds a register or bit. */
+static USHORT
+prvusMBRegStorePageOf( eMBRegStoreTable eTable, USHORT usAddress )
+{
+    if( MB_REGSTORE_IS_BITS( eTable ) )
+    {
+        return ( USHORT )( usAddress >> MB_REGSTORE_BIT_SHIFT );
+    }
+    return ( USHORT )( usAddress >> MB_REGSTORE_PAGE_SHIFT );
+}
+
+/* Return the number of registers up to the end of the page but at most
+ * usCount. */
+static USHORT
+prvusMBRegStoreRun( USHORT usAddress, USHORT usCount )
+{
+    USHORT          usRun = ( USHORT )( MB_REGSTORE_PAGE_SIZE - ( usAddress & ( MB_REGSTORE_PAGE_SIZE - 1 ) ) );
+
+    return usRun < usCount ? usRun : usCount;
+}
+
+/* Check if a range lies completely within one bank of a table. Only the
+ * banks which overlap every page of the range are candidates. These are
+ * usually one or two. Every page of the range must be mapped, so the
+ * copies never see a missing page.
+ */
+static BOOL
+prvxMBRegStoreValid( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount )
+{
+    USHORT          usPage;
+    USHORT          usLastPage;
+    UCHAR           ucMap;
+    xMBRegStoreBankSet xSet = ( xMBRegStoreBankSet ) ~0UL;
+    xMBRegStoreBank *pxBank;
+    UCHAR           i;
+
+    if( ( usCount == 0 ) || ( ( UCHAR )eTable >= MB_REGSTORE_TABLES ) ||
+        ( ( ULONG )usAddress + usCount > 0x10000UL ) )
+    {
+        return FALSE;
+    }
+    usLastPage = prvusMBRegStorePageOf( eTable, ( USHORT )( usAddress + usCount - 1 ) );
+    for( usPage = prvusMBRegStorePageOf( eTable, usAddress ); usPage <= usLastPage; usPage++ )
+    {
+        if( ( ucMap = ucDirectory[eTable][usPage >> MB_REGSTORE_MAP_SHIFT] ) == 0 )
+        {
+            return FALSE;
+        }
+        xSet &= xMapBanks[ucMap - 1][usPage & ( MB_REGSTORE_MAP_SIZE - 1 )];
+    }
+    for( i = 0; xSet != 0; i++, xSet >>= 1 )
+    {
+        pxBank = &xBanks[i];
+        if( ( xSet & 1 ) && ( usAddress >= pxBank->usFirst ) &&
+            ( ( ULONG )usAddress + usCount - 1 <= pxBank->usLast ) )
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Return the sequence counter at the start of a read in *pulSeq. Waits
+ * while a writer is active. Returns FALSE if *pusAttempts reached
+ * MB_REGSTORE_ATTEMPTS_MAX, e.g. because a writer stopped in the middle
+ * of a write. */
+static BOOL
+prvxMBRegStoreReadBegin( ULONG * pulSeq, USHORT * pusAttempts )
+{
+#if MB_REGSTORE_SEQLOCK_ENABLED > 0
+    ULONG           ulSeq;
+
+    do
+    {
+        if( ++*pusAttempts > MB_REGSTORE_ATTEMPTS_MAX )
+        {
+            return FALSE;
+        }
+        ulSeq = ulSequence;
+    }
+    while( ulSeq & 1 );
+    MB_PORT_BARRIER(  );
+    *pulSeq = ulSeq;
+#else
+    ( void )pusAttempts;
+    *pulSeq = 0;
+#endif
+    return TRUE;
+}
+
+/* Check if a writer modified the store since prvxMBRegStoreReadBegin( ).
+ * The copied values are torn and the read must be repeated then. */
+static BOOL
+prvxMBRegStoreReadRetry( ULONG ulSeq )
+{
+#if MB_REGSTORE_SEQLOCK_ENABLED > 0
+    MB_PORT_BARRIER(  );
+    return ulSequence != ulSeq ? TRUE : FALSE;
+#else
+    ( void )ulSeq;
+    return FALSE;
+#endif
+}
+
+static void
+prvvMBRegStoreWriteBegin( void )
+{
+    ENTER_CRITICAL_SECTION(  );
+#if MB_REGSTORE_SEQLOCK_ENABLED > 0
+    ulSequence++;
+    MB_PORT_BARRIER(  );
+#endif
+}
+
+static void
+prvvMBRegStoreWriteEnd( void )
+{
+#if MB_REGSTORE_SEQLOCK_ENABLED > 0
+    MB_PORT_BARRIER(  );
+    ulSequence++;
+#endif
+    EXIT_CRITICAL_SECTION(  );
+}
+
+/* Copy values between the store and a buffer in PDU format. A write is
+ * published as a whole and a read is repeated until it did not overlap
+ * with a write. A read which does not succeed within
+ * MB_REGSTORE_ATTEMPTS_MAX attempts returns MB_ETIMEDOUT and the slave
+ * answers with a slave busy exception.
+ */
+static eMBErrorCode
+prveMBRegStoreAccess( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                      UCHAR * pucBuffer, eMBRegisterMode eMode )
+{
+    USHORT          usAttempts = 0;
+    ULONG           ulSeq;
+
+    if( eMode == MB_REG_WRITE )
+    {
+        prvvMBRegStoreWriteBegin(  );
+        if( MB_REGSTORE_IS_BITS( eTable ) )
+        {
+            prvvMBRegStoreBits( eTable, usAddress, usCount, pucBuffer, eMode );
+        }
+        else
+        {
+            prvvMBRegStoreRegs( eTable, usAddress, usCount, pucBuffer, eMode );
+        }
+        prvvMBRegStoreWriteEnd(  );
+    }
+    else
+    {
+        do
+        {
+            if( !prvxMBRegStoreReadBegin( &ulSeq, &usAttempts ) )
+            {
+                return MB_ETIMEDOUT;
+            }
+            if( MB_REGSTORE_IS_BITS( eTable ) )
+            {
+                prvvMBRegStoreBits( eTable, usAddress, usCount, pucBuffer, eMode );
+            }
+            else
+            {
+                prvvMBRegStoreRegs( eTable, usAddress, usCount, pucBuffer, eMode );
+            }
+        }
+        while( prvxMBRegStoreReadRetry( ulSeq ) );
+    }
+    return MB_ENOERR;
+}
+
+/* Copy registers between the store and a buffer in Modbus byte order. Both
+ * are in the same byte order and every run of registers within a page is
+ * a single copy.
+ */
+static void
+prvvMBRegStoreRegs( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                    UCHAR * pucRegBuffer, eMBRegisterMode eMode )
+{
+    UCHAR          *pucReg;
+    USHORT          usRun;
+
+    while( usCount > 0 )
+    {
+        pucReg = prvpucMBRegStoreReg( eTable, usAddress );
+        usRun = prvusMBRegStoreRun( usAddress, usCount );
+        if( eMode == MB_REG_READ )
+        {
+            memcpy( pucRegBuffer, pucReg, 2U * usRun );
+        }
+        else
+        {
+            memcpy( pucReg, pucRegBuffer, 2U * usRun );
+        }
+        pucRegBuffer += 2U * usRun;
+        usAddress += usRun;
+        usCount -= usRun;
+    }
+}
+
+/* Copy bits between the store and a buffer packed like a Modbus PDU. The
+ * pages are bitfields in the same format, so every run within a page is a
+ * single bit range copy. Unused bits of the last byte of a read are zero.
+ */
+static void
+prvvMBRegStoreBits( eMBRegStoreTable eTable, USHORT usAddress, USHORT usCount,
+                    UCHAR * pucBits, eMBRegisterMode eMode )
+{
+    UCHAR          *pucPage;
+    USHORT          usBit;
+    USHORT          usRun;
+    USHORT          usIndex = 0;
+
+    if( eMode == MB_REG_READ )
+    {
+        pucBits[( usCount - 1 ) >> 3] = 0;
+    }
+    while( usCount > 0 )
+    {
+        pucPage = prvpucMBRegStorePage( eTable, ( USHORT )( usAddress >> MB_REGSTORE_BIT_SHIFT ), FALSE );
+        usBit = ( USHORT )( usAddress & ( MB_REGSTORE_PAGE_BITS - 1 ) );
+        usRun = ( USHORT )( MB_REGSTORE_PAGE_BITS - usBit );
+        if( usRun > usCount )
+        {
+            usRun = usCount;
+        }
+        if( eMode == MB_REG_READ )
+        {
+            vMBUtilCopyBits( pucBits, usIndex, pucPage, usBit, usRun );
+        }
+        else
+        {
+            vMBUtilCopyBits( pucPage, usBit, pucBits, usIndex, usRun );
+        }
+        usIndex += usRun;
+        usAddress += usRun;
+        usCount -= usRun;
+    }
+}
+
+#endif
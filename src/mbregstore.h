@@ -0,0 +1,137 @@
+/* 
+ * FreeModbus Libary: A portable Modbus implementation for Modbus ASCII/RTU.
+ * Copyright (c) 2006 Christian Walter <wolti@sil.at>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * File: $Id$
+ */
+
+#ifndef _MB_REGSTORE_H
+#define _MB_REGSTORE_H
+
+#ifdef __cplusplus
+PR_BEGIN_EXTERN_C
+#endif
+/*! \defgroup modbus_regstore Register Store
+ * \code #include "mbregstore.h" \endcode
+ *
+ * An optional store for the four Modbus tables which implements the
+ * callbacks eMBRegInputCB( ), eMBRegHoldingCB( ), eMBRegCoilsCB( ) and
+ * eMBRegDiscreteCB( ). It is enabled with MB_REGSTORE_ENABLED and the
+ * application must not define these callbacks itself then.
+ *
+ * The application declares the valid address ranges (banks) of each table
+ * with eMBRegStoreAddBank( ). A request is only answered if it lies
+ * completely within one bank. Otherwise the store returns
+ * eMBErrorCode::MB_ENOREG and the slave answers with an illegal data
+ * address exception.
+ *
+ * The values are kept in pages of 2^MB_REGSTORE_PAGE_SHIFT registers or 16
+ * times as many bits. Registers are stored in Modbus byte order and bits
+ * are packed like in a PDU, so a request is answered with one copy per
+ * page. A two level page table maps an address to its page
+ * in constant time. Pages and page tables are taken from static pools
+ * when a bank is added and only the pages which are covered by a bank are
+ * used. All addresses are protocol addresses starting at 0.
+ *
+ * The store can be shared between the thread which calls eMBPoll( ) and
+ * the application. Every write, either by the application or by a Modbus
+ * request, is published as a whole. If MB_REGSTORE_SEQLOCK_ENABLED is set
+ * reads do not take a lock. They are repeated if they overlapped with a
+ * write, so a request for 125 registers never returns a partial update.
+ * A read which still overlaps with writes after a bounded number of
+ * attempts fails with eMBErrorCode::MB_ETIMEDOUT and the slave answers
+ * with a slave busy exception.
+ *
+ * \code
+ * // Holding registers 0 - 99 and 40000 - 40009, coils 0 - 31.
+ * eMBRegStoreAddBank( MB_REGSTORE_HOLDING, 0, 100 );
+ * eMBRegStoreAddBank( MB_REGSTORE_HOLDING, 40000, 10 );
+ * eMBRegStoreAddBank( MB_REGSTORE_COILS, 0, 32 );
+ *
+ * eMBRegStoreWrite( MB_REGSTORE_HOLDING, 40000, 4, usSetpoints );
+ * \endcode
+ */
+/*! \addtogroup modbus_regstore
+ *  @{
+ */
+/* ----------------------- Type definitions ---------------------------------*/
+
+/*! \brief The Modbus tables of the store. */
+typedef enum
+{
+    MB_REGSTORE_INPUT,          /*!< Input registers. */
+    MB_REGSTORE_HOLDING,        /*!< Holding registers. */
+    MB_REGSTORE_COILS,          /*!< Coils. */
+    MB_REGSTORE_DISCRETE        /*!< Discrete inputs. */
+} eMBRegStoreTable;
+
+/* ----------------------- Function prototypes ------------------------------*/
+
+/*! \brief Add a range of valid addresses to a table.
+ *
+ * The values of a new bank are zero. Banks of the same table must not
+ * overlap. Pages which are already used by another bank are shared.
+ *
+ * \return eMBErrorCode::MB_EINVAL if the range is empty, exceeds the
+ *   address space or overlaps another bank. eMBErrorCode::MB_ENORES if there
+ *   are not enough banks, pages or page tables. Pages allocated before
+ *   the failure remain allocated.
+ */
+eMBErrorCode    eMBRegStoreAddBank( eMBRegStoreTable eTable, USHORT usAddress,
+                                    USHORT usCount );
+
+/*! \brief Remove all banks and return all pages to the pool. */
+void            vMBRegStoreClear( void );
+
+/*! \brief Read registers of an input or holding register table. */
+eMBErrorCode    eMBRegStoreRead( eMBRegStoreTable eTable, USHORT usAddress,
+                                 USHORT usCount, USHORT * pusValues );
+
+/*! \brief Write registers of an input or holding register table.
+ *
+ * Readers see either none or all of the new values.
+ */
+eMBErrorCode    eMBRegStoreWrite( eMBRegStoreTable eTable, USHORT usAddress,
+                                  USHORT usCount, const USHORT * pusValues );
+
+/*! \brief Read bits of a coil or discrete input table.
+ *
+ * The bits are packed like in a Modbus PDU. The first bit is the LSB of
+ * the first byte.
+ */
+eMBErrorCode    eMBRegStoreGetBits( eMBRegStoreTable eTable, USHORT usAddress,
+                                    USHORT usCount, UCHAR * pucBits );
+
+/*! \brief Write bits of a coil or discrete input table. */
+eMBErrorCode    eMBRegStoreSetBits( eMBRegStoreTable eTable, USHORT usAddress,
+                                    USHORT usCount, const UCHAR * pucBits );
+
+/*! @} */
+
+#ifdef __cplusplus
+PR_END_EXTERN_C
+#endif
+#endif
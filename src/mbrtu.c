@@ -37,8 +37,9 @@
 
 /* ----------------------- Modbus includes ----------------------------------*/
 #include "mb.h"
-#include "mbrtu.h"
+#include "mbconfig.h"
 #include "mbframe.h"
+#include "mbrtu.h"
 
 #include "mbcrc.h"
 #include "mbport.h"
@@ -49,6 +50,13 @@
 #define MB_SER_PDU_SIZE_CRC     2       /*!< Size of CRC field in PDU. */
 #define MB_SER_PDU_ADDR_OFF     0       /*!< Offset of slave address in Ser-PDU. */
 #define MB_SER_PDU_PDU_OFF      1       /*!< Offset of Modbus-PDU in Ser-PDU. */
+#define MB_SER_BUF_NONE         2       /*!< No receive buffer. */
+#if MB_SER_DOUBLE_BUFFER_ENABLED > 0
+#define MB_SER_RCV_BUFS         2       /*!< Number of receive buffers. */
+#else
+#define MB_SER_RCV_BUFS         1
+#define ucRTUSndBuf             ( ucRTURcvBuf[0] )
+#endif
 
 /* ----------------------- Type definitions ---------------------------------*/
 typedef enum
@@ -69,12 +77,47 @@ typedef enum
 static volatile eMBSndState eSndState;
 static volatile eMBRcvState eRcvState;
 
-volatile UCHAR  ucRTUBuf[MB_SER_PDU_SIZE_MAX];
+/* With MB_SER_DOUBLE_BUFFER_ENABLED received frames are stored alternately
+ * in two buffers. The receiver can start with the next frame while the
+ * protocol stack still works on the last one. Frames are sent from a
+ * separate buffer. Otherwise all frames share one buffer. The buffers are
+ * shared with the ASCII framer because only one of them is active.
+ */
+volatile UCHAR  ucRTURcvBuf[MB_SER_RCV_BUFS][MB_SER_PDU_SIZE_MAX];
+#if MB_SER_DOUBLE_BUFFER_ENABLED > 0
+volatile UCHAR  ucRTUSndBuf[MB_SER_PDU_SIZE_MAX];
+#endif
+volatile xMBFrameCounters xMBSerCounters;
+#if MB_SER_TIMES_ENABLED > 0
+/* Times of the frame in each receive buffer. */
+volatile xMBFrameTimes xRTURcvTimes[MB_SER_RCV_BUFS];
+#endif
 
 static volatile UCHAR *pucSndBufferCur;
 static volatile USHORT usSndBufferCount;
 
 static volatile USHORT usRcvBufferPos;
+static volatile UCHAR ucRcvBufCur;      /*!< Buffer filled by the receiver. */
+static volatile UCHAR ucRcvBufDone = MB_SER_BUF_NONE;   /*!< Last complete frame. */
+static volatile UCHAR ucRcvBufUser = MB_SER_BUF_NONE;   /*!< Returned by eMBRTUReceive( ). */
+static volatile USHORT usRcvFrameLength;        /*!< Length of the last complete frame. */
+
+#if MB_RTU_T15_ENABLED > 0
+/* Maximum time between two characters of a frame, i.e. the character time
+ * plus t1.5. */
+static USHORT   usTimerT15_50us;
+#endif
+
+#if MB_RTU_EARLY_EOF_ENABLED > 0
+/* The master receives responses and a slave receives requests. */
+static BOOL     xRcvResponses;
+#endif
+
+/* ----------------------- Static functions ---------------------------------*/
+static void     prvvMBRTUFrameDone( void );
+#if MB_RTU_EARLY_EOF_ENABLED > 0
+static USHORT   prvusMBRTUFrameLength( void );
+#endif
 
 /* ----------------------- Start implementation -----------------------------*/
 eMBErrorCode
@@ -83,8 +126,14 @@ eMBRTUInit( UCHAR ucSlaveAddress, UCHAR ucPort, ULONG ulBaudRate, eMBParity ePar
     eMBErrorCode    eStatus = MB_ENOERR;
     ULONG           usTimerT35_50us;
 
-    ( void )ucSlaveAddress;
     ENTER_CRITICAL_SECTION(  );
+#if MB_RTU_EARLY_EOF_ENABLED > 0
+    /* The master initializes the framer with address 0 which is not a
+     * valid slave address. */
+    xRcvResponses = ucSlaveAddress == MB_ADDRESS_BROADCAST ? TRUE : FALSE;
+#else
+    ( void )ucSlaveAddress;
+#endif
 
     /* Modbus RTU uses 8 Databits. */
     if( xMBPortSerialInit( ucPort, ulBaudRate, 8, eParity ) != TRUE )
@@ -99,6 +148,10 @@ eMBRTUInit( UCHAR ucSlaveAddress, UCHAR ucPort, ULONG ulBaudRate, eMBParity ePar
         if( ulBaudRate > 19200 )
         {
             usTimerT35_50us = 35;       /* 1800us. */
+#if MB_RTU_T15_ENABLED > 0
+            /* Fixed t1.5 = 750us plus the character time rounded up. */
+            usTimerT15_50us = ( USHORT )( 15 + ( 220000UL + ulBaudRate - 1 ) / ulBaudRate );
+#endif
         }
         else
         {
@@ -111,6 +164,11 @@ eMBRTUInit( UCHAR ucSlaveAddress, UCHAR ucPort, ULONG ulBaudRate, eMBParity ePar
              * for t3.5.
              */
             usTimerT35_50us = ( 7UL * 220000UL ) / ( 2UL * ulBaudRate );
+#if MB_RTU_T15_ENABLED > 0
+            /* The time between two characters is the character time plus
+             * the gap. Hence the limit is 2.5 times the character time. */
+            usTimerT15_50us = ( USHORT )( ( 5UL * 220000UL ) / ( 2UL * ulBaudRate ) );
+#endif
         }
         if( xMBPortTimersInit( ( USHORT ) usTimerT35_50us ) != TRUE )
         {
@@ -147,9 +205,11 @@ eMBRTUStop( void )
     EXIT_CRITICAL_SECTION(  );
 }
 
+/* Return the send buffer. A frame built there is not copied by
+ * eMBRTUSend( ). */
 void
 vMBRTUGetBuffer( UCHAR ** ppucFrame ) {
-    *ppucFrame = ( UCHAR * ) & ucRTUBuf[MB_SER_PDU_PDU_OFF];
+    *ppucFrame = ( UCHAR * ) & ucRTUSndBuf[MB_SER_PDU_PDU_OFF];
 }
 
 eMBErrorCode
@@ -157,37 +217,80 @@ eMBRTUReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame, USHORT * pusLength )
 {
     BOOL            xFrameReceived = FALSE;
     eMBErrorCode    eStatus = MB_ENOERR;
+    volatile UCHAR *pucRcvBuf;
 
     ENTER_CRITICAL_SECTION(  );
-    assert( usRcvBufferPos < MB_SER_PDU_SIZE_MAX );
+    assert( usRcvFrameLength < MB_SER_PDU_SIZE_MAX );
 
-    /* Length and CRC check */
-    if( ( usRcvBufferPos >= MB_SER_PDU_SIZE_MIN )
-        && ( usMBCRC16( ( UCHAR * ) ucRTUBuf, usRcvBufferPos ) == 0 ) )
+    if( ucRcvBufDone == MB_SER_BUF_NONE )
     {
-        /* Save the address field. All frames are passed to the upper layed
-         * and the decision if a frame is used is done there.
-         */
-        *pucRcvAddress = ucRTUBuf[MB_SER_PDU_ADDR_OFF];
-
-        /* Total length of Modbus-PDU is Modbus-Serial-Line-PDU minus
-         * size of address field and CRC checksum.
-         */
-        *pusLength = ( USHORT )( usRcvBufferPos - MB_SER_PDU_PDU_OFF - MB_SER_PDU_SIZE_CRC );
-
-        /* Return the start of the Modbus PDU to the caller. */
-        *pucFrame = ( UCHAR * ) & ucRTUBuf[MB_SER_PDU_PDU_OFF];
-        xFrameReceived = TRUE;
+        /* The frame has already been overwritten by the next one. */
+        ucRcvBufUser = MB_SER_BUF_NONE;
+        eStatus = MB_EIO;
     }
     else
     {
-        eStatus = MB_EIO;
+        /* The caller owns the buffer until the next call. The buffer of
+         * the previous frame can be used by the receiver again. */
+        ucRcvBufUser = ucRcvBufDone;
+        ucRcvBufDone = MB_SER_BUF_NONE;
+        if( ucRcvBufCur == ucRcvBufUser )
+        {
+            ucRcvBufCur = ( UCHAR )( ( ucRcvBufUser + 1 ) % MB_SER_RCV_BUFS );
+        }
+        pucRcvBuf = ucRTURcvBuf[ucRcvBufUser];
+
+        /* Length and CRC check */
+        if( ( usRcvFrameLength >= MB_SER_PDU_SIZE_MIN )
+            && ( usMBCRC16( ( UCHAR * ) pucRcvBuf, usRcvFrameLength ) == 0 ) )
+        {
+            /* Save the address field. All frames are passed to the upper layed
+             * and the decision if a frame is used is done there.
+             */
+            *pucRcvAddress = pucRcvBuf[MB_SER_PDU_ADDR_OFF];
+
+            /* Total length of Modbus-PDU is Modbus-Serial-Line-PDU minus
+             * size of address field and CRC checksum.
+             */
+            *pusLength = ( USHORT )( usRcvFrameLength - MB_SER_PDU_PDU_OFF - MB_SER_PDU_SIZE_CRC );
+
+            /* Return the start of the Modbus PDU to the caller. */
+            *pucFrame = ( UCHAR * ) & pucRcvBuf[MB_SER_PDU_PDU_OFF];
+            xFrameReceived = TRUE;
+        }
+        else
+        {
+            xMBSerCounters.ulChecksumErrors++;
+            eStatus = MB_EIO;
+        }
     }
 
     EXIT_CRITICAL_SECTION(  );
     return eStatus;
 }
 
+/* Return the times of the frame returned by the last call of
+ * eMBRTUReceive( ). They are zero if the frame has been lost. */
+void
+vMBRTUGetTimes( xMBFrameTimes * pxTimes )
+{
+    ENTER_CRITICAL_SECTION(  );
+#if MB_SER_TIMES_ENABLED > 0
+    if( ucRcvBufUser != MB_SER_BUF_NONE )
+    {
+        *pxTimes = xRTURcvTimes[ucRcvBufUser];
+    }
+    else
+#endif
+    {
+        pxTimes->ulStartSec = 0;
+        pxTimes->ulStartNSec = 0;
+        pxTimes->ulDoneSec = 0;
+        pxTimes->ulDoneNSec = 0;
+    }
+    EXIT_CRITICAL_SECTION(  );
+}
+
 eMBErrorCode
 eMBRTUSend( UCHAR ucSlaveAddress, const UCHAR * pucFrame, USHORT usLength )
 {
@@ -203,17 +306,22 @@ eMBRTUSend( UCHAR ucSlaveAddress, const UCHAR * pucFrame, USHORT usLength )
     if( eRcvState == STATE_RX_IDLE )
     {
         /* First byte before the Modbus-PDU is the slave address. */
-        pucSndBufferCur = ( UCHAR * ) pucFrame - 1;
+        pucSndBufferCur = ucRTUSndBuf;
         usSndBufferCount = 1;
 
-        /* Now copy the Modbus-PDU into the Modbus-Serial-Line-PDU. */
+        /* Now copy the Modbus-PDU into the Modbus-Serial-Line-PDU. A
+         * response is usually built in the receive buffer. */
         pucSndBufferCur[MB_SER_PDU_ADDR_OFF] = ucSlaveAddress;
+        if( pucFrame != &ucRTUSndBuf[MB_SER_PDU_PDU_OFF] )
+        {
+            memcpy( ( UCHAR * ) &ucRTUSndBuf[MB_SER_PDU_PDU_OFF], pucFrame, usLength );
+        }
         usSndBufferCount += usLength;
 
         /* Calculate CRC16 checksum for Modbus-Serial-Line-PDU. */
         usCRC16 = usMBCRC16( ( UCHAR * ) pucSndBufferCur, usSndBufferCount );
-        ucRTUBuf[usSndBufferCount++] = ( UCHAR )( usCRC16 & 0xFF );
-        ucRTUBuf[usSndBufferCount++] = ( UCHAR )( usCRC16 >> 8 );
+        ucRTUSndBuf[usSndBufferCount++] = ( UCHAR )( usCRC16 & 0xFF );
+        ucRTUSndBuf[usSndBufferCount++] = ( UCHAR )( usCRC16 >> 8 );
 
         /* Activate the transmitter. */
         eSndState = STATE_TX_XMIT;
@@ -259,8 +367,19 @@ xMBRTUReceiveFSM( void )
          * receiver is in the state STATE_RX_RECEIVCE.
          */
     case STATE_RX_IDLE:
+        if( ucRcvBufDone == ucRcvBufCur )
+        {
+            /* The receiver has to reuse the buffer of the last frame. It
+             * has not been fetched and is lost. */
+            ucRcvBufDone = MB_SER_BUF_NONE;
+            xMBSerCounters.ulOverruns++;
+        }
+#if MB_SER_TIMES_ENABLED > 0
+        vMBPortTimersGetTimestamp( ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulStartSec,
+                                   ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulStartNSec );
+#endif
         usRcvBufferPos = 0;
-        ucRTUBuf[usRcvBufferPos++] = ucByte;
+        ucRTURcvBuf[ucRcvBufCur][usRcvBufferPos++] = ucByte;
         eRcvState = STATE_RX_RCV;
 
         /* Enable t3.5 timers. */
@@ -273,20 +392,129 @@ xMBRTUReceiveFSM( void )
          * ignored.
          */
     case STATE_RX_RCV:
+#if MB_RTU_T15_ENABLED > 0
+        /* The timer has been started by the previous character. If the
+         * gap was longer than t1.5 the frame is discarded. */
+        if( usMBPortTimersGetElapsed(  ) > usTimerT15_50us )
+        {
+            eRcvState = STATE_RX_ERROR;
+        }
+        else
+#endif
         if( usRcvBufferPos < MB_SER_PDU_SIZE_MAX )
         {
-            ucRTUBuf[usRcvBufferPos++] = ucByte;
+            ucRTURcvBuf[ucRcvBufCur][usRcvBufferPos++] = ucByte;
         }
         else
         {
+            xMBSerCounters.ulOverruns++;
             eRcvState = STATE_RX_ERROR;
         }
+#if MB_RTU_EARLY_EOF_ENABLED > 0
+        /* The frame is complete if it has the expected length and a valid
+         * CRC. Otherwise wait for t3.5 as usual. */
+        if( ( eRcvState == STATE_RX_RCV ) && ( prvusMBRTUFrameLength(  ) == usRcvBufferPos ) &&
+            ( usMBCRC16( ( UCHAR * ) ucRTURcvBuf[ucRcvBufCur], usRcvBufferPos ) == 0 ) )
+        {
+            vMBPortTimersDisable(  );
+            prvvMBRTUFrameDone(  );
+            eRcvState = STATE_RX_IDLE;
+            xTaskNeedSwitch = xMBPortEventPost( EV_FRAME_RECEIVED );
+            break;
+        }
+#endif
         vMBPortTimersEnable(  );
         break;
     }
     return xTaskNeedSwitch;
 }
 
+/* A frame has been received completely. Continue with the other buffer
+ * unless the protocol stack still uses it. If the last frame has not been
+ * fetched yet it is dropped in favour of the new one. */
+static void
+prvvMBRTUFrameDone( void )
+{
+    UCHAR           ucRcvBufNext = ( UCHAR )( ( ucRcvBufCur + 1 ) % MB_SER_RCV_BUFS );
+
+    xMBSerCounters.ulFrames++;
+    if( ucRcvBufDone != MB_SER_BUF_NONE )
+    {
+        xMBSerCounters.ulOverruns++;
+    }
+#if MB_SER_TIMES_ENABLED > 0
+    vMBPortTimersGetTimestamp( ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulDoneSec,
+                               ( ULONG * ) & xRTURcvTimes[ucRcvBufCur].ulDoneNSec );
+#endif
+    usRcvFrameLength = usRcvBufferPos;
+    ucRcvBufDone = ucRcvBufCur;
+    if( ucRcvBufUser != ucRcvBufNext )
+    {
+        ucRcvBufCur = ucRcvBufNext;
+    }
+}
+
+#if MB_RTU_EARLY_EOF_ENABLED > 0
+/* Return the length of the frame in the receive buffer including address
+ * and CRC. Returns 0 if the length is not known (yet). */
+static USHORT
+prvusMBRTUFrameLength( void )
+{
+    volatile UCHAR *pucRcvBuf = ucRTURcvBuf[ucRcvBufCur];
+    UCHAR           ucFunctionCode;
+
+    if( usRcvBufferPos < 2 )
+    {
+        return 0;
+    }
+    ucFunctionCode = pucRcvBuf[MB_SER_PDU_PDU_OFF];
+    if( xRcvResponses )
+    {
+        if( ucFunctionCode & MB_FUNC_ERROR )
+        {
+            /* Address, function code, exception code and CRC. */
+            return 5;
+        }
+        switch ( ucFunctionCode )
+        {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS:
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER:
+        case MB_FUNC_READWRITE_MULTIPLE_REGISTERS:
+            /* Address, function code, byte count, data and CRC. */
+            return usRcvBufferPos < 3 ? 0 : ( USHORT )( 5 + pucRcvBuf[2] );
+        case MB_FUNC_WRITE_SINGLE_COIL:
+        case MB_FUNC_WRITE_REGISTER:
+        case MB_FUNC_WRITE_MULTIPLE_COILS:
+        case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+            return 8;
+        }
+    }
+    else
+    {
+        switch ( ucFunctionCode )
+        {
+        case MB_FUNC_READ_COILS:
+        case MB_FUNC_READ_DISCRETE_INPUTS:
+        case MB_FUNC_READ_HOLDING_REGISTER:
+        case MB_FUNC_READ_INPUT_REGISTER:
+        case MB_FUNC_WRITE_SINGLE_COIL:
+        case MB_FUNC_WRITE_REGISTER:
+            /* Address, function code, address, value or quantity and CRC. */
+            return 8;
+        case MB_FUNC_WRITE_MULTIPLE_COILS:
+        case MB_FUNC_WRITE_MULTIPLE_REGISTERS:
+            /* Header up to the byte count, data and CRC. */
+            return usRcvBufferPos < 7 ? 0 : ( USHORT )( 9 + pucRcvBuf[6] );
+        case MB_FUNC_READWRITE_MULTIPLE_REGISTERS:
+            return usRcvBufferPos < 11 ? 0 : ( USHORT )( 13 + pucRcvBuf[10] );
+        }
+    }
+    return 0;
+}
+#endif
+
 BOOL
 xMBRTUTransmitFSM( void )
 {
@@ -340,11 +568,13 @@ xMBRTUTimerT35Expired( void )
         /* A frame was received and t35 expired. Notify the listener that
          * a new frame was received. */
     case STATE_RX_RCV:
+        prvvMBRTUFrameDone(  );
         xNeedPoll = xMBPortEventPost( EV_FRAME_RECEIVED );
         break;
 
         /* An error occured while receiving the frame. */
     case STATE_RX_ERROR:
+        xMBSerCounters.ulFrames++;
         break;
 
         /* Function called in an illegal state. */
@@ -40,6 +40,7 @@ void            eMBRTUStart( void );
 void            eMBRTUStop( void );
 void            vMBRTUGetBuffer ( UCHAR ** ppucFrame );
 eMBErrorCode    eMBRTUReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame, USHORT * pusLength );
+void            vMBRTUGetTimes( xMBFrameTimes * pxTimes );
 eMBErrorCode    eMBRTUSend( UCHAR slaveAddress, const UCHAR * pucFrame, USHORT usLength );
 BOOL            xMBRTUReceiveFSM( void );
 BOOL            xMBRTUTransmitFSM( void );
@@ -101,11 +101,6 @@ eMBTCPStop( void )
     vMBTCPPortDisable( );
 }
 
-void
-eMBTCPGetBuffer( UCHAR ** ppucFrame ) {
-    *ppucFrame = NULL;
-}
-
 eMBErrorCode
 eMBTCPReceive( UCHAR * pucRcvAddress, UCHAR ** ppucFrame, USHORT * pusLength )
 {
@@ -125,10 +120,15 @@ eMBTCPReceive( UCHAR * pucRcvAddress, UCHAR ** ppucFrame, USHORT * pusLength )
             *pusLength = usLength - MB_TCP_FUNC;
             eStatus = MB_ENOERR;
 
+#if MB_VIRTUAL_SLAVES_ENABLED > 0
+            /* The unit identifier selects the slave. */
+            *pucRcvAddress = pucMBTCPFrame[MB_TCP_UID];
+#else
             /* Modbus TCP does not use any addresses. Fake the source address such
              * that the processing part deals with this frame.
              */
             *pucRcvAddress = MB_TCP_PSEUDO_ADDRESS;
+#endif
         }
     }
     else
@@ -160,4 +160,14 @@ eMBTCPSend( UCHAR _unused, const UCHAR * pucFrame, USHORT usLength )
     return eStatus;
 }
 
+/* Transaction identifier of a frame returned by eMBTCPReceive( ) or passed
+ * to eMBTCPSend( ). The MBAP header is stored in front of the PDU. */
+USHORT
+usMBTCPGetTID( const UCHAR * pucFrame )
+{
+    const UCHAR    *pucMBTCPFrame = pucFrame - MB_TCP_FUNC;
+
+    return ( USHORT )( ( pucMBTCPFrame[MB_TCP_TID] << 8U ) | pucMBTCPFrame[MB_TCP_TID + 1] );
+}
+
 #endif
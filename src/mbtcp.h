@@ -46,6 +46,7 @@ eMBErrorCode    eMBTCPReceive( UCHAR * pucRcvAddress, UCHAR ** pucFrame,
                                USHORT * pusLength );
 eMBErrorCode    eMBTCPSend( UCHAR _unused, const UCHAR * pucFrame,
                             USHORT usLength );
+USHORT          usMBTCPGetTID( const UCHAR * pucFrame );
 
 #ifdef __cplusplus
 PR_END_EXTERN_C
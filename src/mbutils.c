@@ -38,10 +38,39 @@
 /* ----------------------- Modbus includes ----------------------------------*/
 #include "mb.h"
 #include "mbproto.h"
+#include "mbutils.h"
+
+/* ----------------------- SIMD support -------------------------------------*/
+
+/* Registers are swapped with vector instructions if the compiler targets
+ * them on a little endian host. Other hosts use the portable loop.
+ */
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define MB_UTIL_SWAP_AVX2
+#define MB_UTIL_SWAP_SIMD
+#elif defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define MB_UTIL_SWAP_SSE2
+#define MB_UTIL_SWAP_SIMD
+#elif defined( __ARM_NEON ) && !defined( __ARM_BIG_ENDIAN )
+#include <arm_neon.h>
+#define MB_UTIL_SWAP_NEON
+#define MB_UTIL_SWAP_SIMD
+#endif
 
 /* ----------------------- Defines ------------------------------------------*/
 #define BITS_UCHAR      8U
 
+/* vMBUtilCopyBits( ) moves all bytes of a ULONG but one per step because
+ * an unaligned source needs one extra byte. */
+#define COPY_CHUNK_BYTES ( sizeof( ULONG ) - 1U )
+#define COPY_CHUNK_BITS ( COPY_CHUNK_BYTES * BITS_UCHAR )
+
+/* ----------------------- Static functions ---------------------------------*/
+static UCHAR    prvucMBUtilGetByte( const UCHAR * pucSrc, UCHAR ucShift, UCHAR ucNBits );
+static void     prvvMBUtilPutByte( UCHAR * pucDst, UCHAR ucShift, UCHAR ucNBits, UCHAR ucValue );
+
 /* ----------------------- Start implementation -----------------------------*/
 void
 xMBUtilSetBits( UCHAR * ucByteBuf, USHORT usBitOffset, UCHAR ucNBits,
@@ -132,6 +161,10 @@ prveMBError2Exception( eMBErrorCode eErrorCode )
             eStatus = MB_EX_SLAVE_BUSY;
             break;
 
+        case MB_EPENDING:
+            eStatus = MB_EX_PENDING;
+            break;
+
         default:
             eStatus = MB_EX_SLAVE_DEVICE_FAILURE;
             break;
@@ -139,3 +172,173 @@ prveMBError2Exception( eMBErrorCode eErrorCode )
 
     return eStatus;
 }
+
+#if defined( MB_UTIL_SWAP_SIMD )
+/* Swap the bytes of 16 bit values. Source and destination may be the same
+ * and need not be aligned. The AVX2 loop handles 16 registers per
+ * iteration, the SSE2 and NEON loops 8. The rest is left to the portable
+ * loop.
+ */
+static void
+prvvMBUtilSwapRegs( UCHAR * pucDst, const UCHAR * pucSrc, USHORT usNRegs )
+{
+    USHORT          i = 0;
+    UCHAR           ucHigh;
+
+#if defined( MB_UTIL_SWAP_AVX2 )
+    const __m256i   xShuffle = _mm256_setr_epi8( 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+                                                 1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14 );
+
+    for( ; i + 16 <= usNRegs; i += 16 )
+    {
+        __m256i         xRegs = _mm256_loadu_si256( ( const __m256i * )&pucSrc[2 * i] );
+
+        _mm256_storeu_si256( ( __m256i * ) & pucDst[2 * i], _mm256_shuffle_epi8( xRegs, xShuffle ) );
+    }
+#elif defined( MB_UTIL_SWAP_SSE2 )
+    for( ; i + 8 <= usNRegs; i += 8 )
+    {
+        __m128i         xRegs = _mm_loadu_si128( ( const __m128i * )&pucSrc[2 * i] );
+
+        xRegs = _mm_or_si128( _mm_slli_epi16( xRegs, 8 ), _mm_srli_epi16( xRegs, 8 ) );
+        _mm_storeu_si128( ( __m128i * ) & pucDst[2 * i], xRegs );
+    }
+#elif defined( MB_UTIL_SWAP_NEON )
+    for( ; i + 8 <= usNRegs; i += 8 )
+    {
+        vst1q_u8( &pucDst[2 * i], vrev16q_u8( vld1q_u8( &pucSrc[2 * i] ) ) );
+    }
+#endif
+    for( ; i < usNRegs; i++ )
+    {
+        ucHigh = pucSrc[2 * i];
+        pucDst[2 * i] = pucSrc[2 * i + 1];
+        pucDst[2 * i + 1] = ucHigh;
+    }
+}
+#endif
+
+void
+vMBUtilRegsToHost( USHORT * pusRegs, const UCHAR * pucBuf, USHORT usNRegs )
+{
+#if defined( MB_UTIL_SWAP_SIMD )
+    prvvMBUtilSwapRegs( ( UCHAR * ) pusRegs, pucBuf, usNRegs );
+#else
+    USHORT          i;
+
+    for( i = 0; i < usNRegs; i++ )
+    {
+        pusRegs[i] = MB_UTIL_GET_REG( &pucBuf[2 * i] );
+    }
+#endif
+}
+
+void
+vMBUtilRegsFromHost( UCHAR * pucBuf, const USHORT * pusRegs, USHORT usNRegs )
+{
+#if defined( MB_UTIL_SWAP_SIMD )
+    prvvMBUtilSwapRegs( pucBuf, ( const UCHAR * )pusRegs, usNRegs );
+#else
+    USHORT          i;
+
+    for( i = 0; i < usNRegs; i++ )
+    {
+        MB_UTIL_SET_REG( &pucBuf[2 * i], pusRegs[i] );
+    }
+#endif
+}
+
+void
+vMBUtilCopyBits( UCHAR * pucDst, USHORT usDstBit, const UCHAR * pucSrc, USHORT usSrcBit,
+                 USHORT usNBits )
+{
+    ULONG           ulWord;
+    UCHAR           ucShift;
+    UCHAR           ucNBits;
+    USHORT          i;
+
+    pucDst += usDstBit / BITS_UCHAR;
+    pucSrc += usSrcBit / BITS_UCHAR;
+    ucShift = ( UCHAR )( usSrcBit % BITS_UCHAR );
+
+    /* Fill up the first byte of the destination. */
+    if( ( ( usDstBit % BITS_UCHAR ) != 0 ) && ( usNBits > 0 ) )
+    {
+        ucNBits = ( UCHAR )( BITS_UCHAR - usDstBit % BITS_UCHAR );
+        if( ucNBits > usNBits )
+        {
+            ucNBits = ( UCHAR )usNBits;
+        }
+        prvvMBUtilPutByte( pucDst, ( UCHAR )( usDstBit % BITS_UCHAR ), ucNBits,
+                           prvucMBUtilGetByte( pucSrc, ucShift, ucNBits ) );
+        pucDst++;
+        usNBits -= ucNBits;
+        ucShift += ucNBits;
+        pucSrc += ucShift / BITS_UCHAR;
+        ucShift %= BITS_UCHAR;
+    }
+
+    /* The destination is byte aligned now. */
+    if( ucShift == 0 )
+    {
+        memcpy( pucDst, pucSrc, usNBits / BITS_UCHAR );
+        pucDst += usNBits / BITS_UCHAR;
+        pucSrc += usNBits / BITS_UCHAR;
+        usNBits %= BITS_UCHAR;
+    }
+    else
+    {
+        /* Every step loads one byte more than it stores. It is still within
+         * the source because the shift adds at least one bit. */
+        for( ; usNBits >= COPY_CHUNK_BITS; usNBits -= COPY_CHUNK_BITS )
+        {
+            ulWord = 0;
+            for( i = COPY_CHUNK_BYTES + 1; i > 0; i-- )
+            {
+                ulWord = ( ulWord << BITS_UCHAR ) | pucSrc[i - 1];
+            }
+            ulWord >>= ucShift;
+            for( i = 0; i < COPY_CHUNK_BYTES; i++ )
+            {
+                pucDst[i] = ( UCHAR )ulWord;
+                ulWord >>= BITS_UCHAR;
+            }
+            pucDst += COPY_CHUNK_BYTES;
+            pucSrc += COPY_CHUNK_BYTES;
+        }
+        for( ; usNBits >= BITS_UCHAR; usNBits -= BITS_UCHAR )
+        {
+            *pucDst++ = prvucMBUtilGetByte( pucSrc++, ucShift, BITS_UCHAR );
+        }
+    }
+
+    /* Remaining bits of the last byte. */
+    if( usNBits > 0 )
+    {
+        prvvMBUtilPutByte( pucDst, 0, ( UCHAR )usNBits,
+                           prvucMBUtilGetByte( pucSrc, ucShift, ( UCHAR )usNBits ) );
+    }
+}
+
+/* Return up to 8 bits starting at bit ucShift of pucSrc. The second byte is
+ * only read if the bits extend into it. */
+static UCHAR
+prvucMBUtilGetByte( const UCHAR * pucSrc, UCHAR ucShift, UCHAR ucNBits )
+{
+    USHORT          usBits = pucSrc[0];
+
+    if( ucShift + ucNBits > BITS_UCHAR )
+    {
+        usBits |= ( USHORT )( pucSrc[1] << BITS_UCHAR );
+    }
+    return ( UCHAR )( ( usBits >> ucShift ) & ( ( 1U << ucNBits ) - 1U ) );
+}
+
+/* Replace ucNBits bits starting at bit ucShift of a single byte. */
+static void
+prvvMBUtilPutByte( UCHAR * pucDst, UCHAR ucShift, UCHAR ucNBits, UCHAR ucValue )
+{
+    UCHAR           ucMask = ( UCHAR )( ( ( 1U << ucNBits ) - 1U ) << ucShift );
+
+    *pucDst = ( UCHAR )( ( *pucDst & ~ucMask ) | ( ( ucValue << ucShift ) & ucMask ) );
+}
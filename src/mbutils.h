@@ -100,6 +100,62 @@ void            xMBUtilSetBits( UCHAR * ucByteBuf, USHORT usBitOffset,
 UCHAR           xMBUtilGetBits( UCHAR * ucByteBuf, USHORT usBitOffset,
                                 UCHAR ucNBits );
 
+/*! \brief Copy a range of bits between two bitfields.
+ *
+ * Both bitfields are packed like in a Modbus PDU, i.e. bit 0 is the LSB of
+ * the first byte. Source and destination may start at any bit offset and
+ * must not overlap. Bits outside of the range are not modified and no
+ * byte outside of the range is accessed. The bits are moved a ULONG at a
+ * time, so a request for 2000 coils takes 36 steps on a 64 bit host.
+ *
+ * \param pucDst Destination bitfield.
+ * \param usDstBit Offset of the first bit in the destination.
+ * \param pucSrc Source bitfield.
+ * \param usSrcBit Offset of the first bit in the source.
+ * \param usNBits Number of bits to copy.
+ */
+void            vMBUtilCopyBits( UCHAR * pucDst, USHORT usDstBit, const UCHAR * pucSrc,
+                                 USHORT usSrcBit, USHORT usNBits );
+
+/*! \brief Return a register value stored in Modbus byte order.
+ *
+ * Registers kept in Modbus byte order, i.e. high byte first, can be copied
+ * into and out of a PDU without conversion. These macros convert a single
+ * register to and from the byte order of the host.
+ *
+ * \code
+ * UCHAR ucRegs[2 * 4];
+ *
+ * MB_UTIL_SET_REG( &ucRegs[2 * 3], 1234 );
+ * usValue = MB_UTIL_GET_REG( &ucRegs[2 * 3] );
+ * \endcode
+ */
+#define MB_UTIL_GET_REG( pucReg ) \
+    ( ( USHORT )( ( ( USHORT )( pucReg )[0] << 8 ) | ( pucReg )[1] ) )
+
+/*! \brief Store a register value in Modbus byte order. */
+#define MB_UTIL_SET_REG( pucReg, usValue ) do { \
+    ( pucReg )[0] = ( UCHAR )( ( usValue ) >> 8 ); \
+    ( pucReg )[1] = ( UCHAR )( ( usValue ) & 0xFF ); \
+} while( 0 )
+
+/*! \brief Convert registers in Modbus byte order to host byte order.
+ *
+ * The buffers need not be aligned. The conversion uses AVX2, SSE2 or NEON
+ * instructions if the compiler targets them.
+ *
+ * \param pusRegs Array which receives the register values.
+ * \param pucBuf Registers in Modbus byte order, e.g. the data of a
+ *   response to a read request.
+ * \param usNRegs Number of registers.
+ */
+void            vMBUtilRegsToHost( USHORT * pusRegs, const UCHAR * pucBuf,
+                                   USHORT usNRegs );
+
+/*! \brief Convert registers in host byte order to Modbus byte order. */
+void            vMBUtilRegsFromHost( UCHAR * pucBuf, const USHORT * pusRegs,
+                                     USHORT usNRegs );
+
 /*! @} */
 
 #ifdef __cplusplus